@@ -0,0 +1,695 @@
+/**
+ * Project NNlight
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <algorithm>
+#include "NeuronNetwork.h"
+#include "CompiledNetwork.h"
+#include "Conv1D.h"
+#include "AllocationCounter.h"
+
+/**
+ * Micro-benchmark suite
+ *
+ * Measures the propagation and backpropagation kernels in ns per connection (edge), and the throughput of NeuronNetwork::test and
+ * NeuronNetwork::train in samples per second, across layer widths and depths, and the inference throughput of magnitude pruned networks, the time of
+ * reloading a saved network into a network that was already used, and the throughput of 1D convolution networks across sequence lengths. Results are written as JSON; a previous result file
+ * can be given as baseline to flag regressions. If the library counts allocations (CMake option NNLIGHT_COUNT_ALLOCATIONS), the heap allocations
+ * of warmed-up training epochs and test() calls are measured as well, and the suite exits with 1 if any of them allocates.
+ *
+ * Usage: nnlight_bench [--quick] [--filter TEXT] [--min-time SECONDS] [--json FILE] [--compare BASELINE] [--threshold RATIO]
+ *   --quick      fewer widths and depths and shorter measurements, for smoke runs
+ *   --filter     runs only the benchmarks whose name contains TEXT
+ *   --min-time   minimum measured time of each benchmark (default 0.2 s)
+ *   --json       writes the results to FILE instead of the standard output
+ *   --compare    compares the results to a JSON file written earlier, exits with 1 if any benchmark regressed
+ *   --threshold  relative slowdown reported as regression (default 0.1, that is 10%)
+ */
+
+using namespace std;
+using namespace NNlight;
+
+namespace {
+
+struct Result
+{
+	string name;
+	string unit;
+	double value;
+	bool lower_is_better;
+};
+
+struct Options
+{
+	Options() : quick(false), min_time(0.2), threshold(0.1) {}
+	bool quick;
+	string filter;
+	double min_time;
+	string json_filename;
+	string baseline_filename;
+	double threshold;
+};
+
+/**
+ * Network of ninputs inputs, depth hidden layers of the given width and noutputs outputs, fully connected layer by layer.
+ */
+struct Net
+{
+	Net(size_t ninputs, size_t width, size_t depth, size_t noutputs)
+		: input(make_layer<InputNeuron>(ninputs)), output(make_layer<OutputNeuron>(noutputs)), nedges(0)
+	{
+		network.add_layer(input);
+		vector<NeuronPtr> prev(input.begin(), input.end());
+		for (size_t d = 0; d < depth; ++d)
+		{
+			auto layer = make_layer<Neuron>(width);
+			Neuron::connect_layers(prev, layer);
+			network.add_layer(layer);
+			nedges += prev.size() * layer.size();
+			prev.assign(layer.begin(), layer.end());
+		}
+		Neuron::connect_layers(prev, output);
+		network.add_layer(output);
+		nedges += prev.size() * output.size();
+	}
+
+	vector<InputNeuronPtr> input;
+	vector<OutputNeuronPtr> output;
+	NeuronNetwork network;
+	size_t nedges;
+};
+
+/**
+ * Runs fun repeatedly, doubling the number of runs until they take at least min_time seconds. Returns the seconds per run.
+ */
+template <typename Fun>
+double time_per_run(Fun fun, double min_time)
+{
+	fun(); // warm-up
+	size_t nruns = 1;
+	for (;;)
+	{
+		auto start = chrono::steady_clock::now();
+		for (size_t i = 0; i < nruns; ++i)
+			fun();
+		double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		if (elapsed >= min_time)
+			return elapsed / nruns;
+		nruns *= 2;
+	}
+}
+
+vector<double> random_values(RandomGenerator& gen, size_t n)
+{
+	vector<double> values(n);
+	gen.fill_uniform(values.data(), n, -1.0, 1.0);
+	return values;
+}
+
+/**
+ * Full-batch trainer computing the error and its gradient once per step without moving the weights, to time the passes of the full-batch trainers.
+ */
+class GradientPass : public FullBatchTrainer
+{
+public:
+	explicit GradientPass(Precision precision_) : FullBatchTrainer(precision_) {}
+	shared_ptr<FullBatchTrainer> clone() const { return make_shared<GradientPass>(get_precision()); }
+
+protected:
+	void reset(size_t nparams) { gradient.assign(nparams, 0.0); }
+	bool iterate(vector<double>& params) { error_gradient(params, gradient); return false; }
+
+private:
+	vector<double> gradient;
+};
+
+class Suite
+{
+public:
+	Suite(const Options& options_) : options(options_), gen(42), nallocating(0)
+	{
+		RandomGenerator::seed_shared(42);
+	}
+
+	const vector<Result>& get_results() const { return results; }
+	size_t num_of_allocating() const { return nallocating; }
+
+	void run()
+	{
+		const size_t all_widths[] = { 2, 8, 32, 128, 512, 2048, 4096 };
+		const size_t quick_widths[] = { 2, 32, 512 };
+		const size_t all_depths[] = { 1, 2, 4, 8 };
+		const size_t quick_depths[] = { 1, 2 };
+		vector<size_t> widths = options.quick ? vector<size_t>(quick_widths, quick_widths + 3) : vector<size_t>(all_widths, all_widths + 7);
+		vector<size_t> depths = options.quick ? vector<size_t>(quick_depths, quick_depths + 2) : vector<size_t>(all_depths, all_depths + 4);
+
+		for (auto width : widths)
+			kernels(width);
+		for (auto width : widths)
+			throughput(width, 1);
+		for (auto depth : depths)
+			if (depth != 1)
+				throughput(64, depth);
+		pruning(options.quick ? 128 : 512);
+		reload(options.quick ? 128 : 512);
+		const size_t all_lengths[] = { 64, 256, 1024 };
+		for (size_t i = 0; i < (options.quick ? 2u : 3u); ++i)
+			conv1d(all_lengths[i]);
+		if (AllocationCounter::enabled())
+			allocations();
+	}
+
+private:
+	bool selected(const string& name) const
+	{
+		return options.filter.empty() || name.find(options.filter) != string::npos;
+	}
+
+	void add(const string& name, const string& unit, double value, bool lower_is_better)
+	{
+		Result result;
+		result.name = name;
+		result.unit = unit;
+		result.value = value;
+		result.lower_is_better = lower_is_better;
+		results.push_back(result);
+		cerr << std::left << setw(40) << name << " " << value << " " << unit << endl;
+	}
+
+	/**
+	 * ns/edge of the forward pass and of the backward pass with plain gradient descent and Rprop, through a width x width layer,
+	 * and of a gradient pass of the full-batch trainers in double and float precision, per sample.
+	 */
+	void kernels(size_t width)
+	{
+		ostringstream suffix;
+		suffix << "/width=" << width;
+		const string forward_name = "forward" + suffix.str();
+		const string backward_name = "backward" + suffix.str();
+		const string rprop_name = "backward_rprop" + suffix.str();
+		const string gradient_name = "full_batch_gradient" + suffix.str();
+		const string gradient_fp32_name = "full_batch_gradient_fp32" + suffix.str();
+		if (!selected(forward_name) && !selected(backward_name) && !selected(rprop_name) && !selected(gradient_name) && !selected(gradient_fp32_name))
+			return;
+
+		Net net(width, width, 1, 1);
+		vector<double> input = random_values(gen, width);
+		vector<double> output;
+		if (selected(forward_name))
+		{
+			double t = time_per_run([&] { net.network.test(input, output); }, options.min_time);
+			add(forward_name, "ns/edge", t * 1e9 / net.nedges, true);
+		}
+		if (selected(backward_name))
+		{
+			// the weights are updated by the same error over and over, a small learning rate keeps them finite
+			net.network.reset_neurons();
+			net.network.use_default_backpropation(1e-6, Neuron::def_regularization);
+			net.network.test(input, output);
+			double t = time_per_run([&] { for (auto& out : net.output) out->backpropagate(nullptr, 0.01); }, options.min_time);
+			add(backward_name, "ns/edge", t * 1e9 / net.nedges, true);
+		}
+		if (selected(rprop_name))
+		{
+			net.network.reset_neurons();
+			net.network.use_resilient_backpropagation();
+			net.network.test(input, output);
+			double t = time_per_run([&] { for (auto& out : net.output) out->backpropagate(nullptr, 0.01); }, options.min_time);
+			add(rprop_name, "ns/edge", t * 1e9 / net.nedges, true);
+		}
+		for (int fp32 = 0; fp32 < 2; ++fp32)
+		{
+			const string& name = fp32 ? gradient_fp32_name : gradient_name;
+			if (!selected(name))
+				continue;
+			const size_t nsamples = 32;
+			vector<vector<double>> inputs(nsamples), desired_outputs(nsamples, vector<double>(1, 1.0));
+			vector<size_t> samples(nsamples);
+			for (size_t s = 0; s < nsamples; ++s)
+			{
+				inputs[s] = random_values(gen, width);
+				samples[s] = s;
+			}
+			GradientPass pass(fp32 ? FullBatchTrainer::FLOAT_PRECISION : FullBatchTrainer::DOUBLE_PRECISION);
+			pass.start(net.network);
+			double t = time_per_run([&] { pass.step(inputs, desired_outputs, samples.data(), nsamples); }, options.min_time);
+			add(name, "ns/edge", t * 1e9 / (net.nedges * nsamples), true);
+		}
+	}
+
+	/**
+	 * samples/s of test() and of train() online, in batch mode, in batch mode with Rprop and with L-BFGS in double, float and bfloat16 precision, for a network of 16 inputs and 4 outputs.
+	 */
+	void throughput(size_t width, size_t depth)
+	{
+		ostringstream suffix;
+		suffix << "/width=" << width << "/depth=" << depth;
+		const string test_name = "test" + suffix.str();
+		const char* modes[] = { "online", "batch", "batch_rprop", "lbfgs", "lbfgs_fp32", "lbfgs_bf16" };
+		bool any = selected(test_name);
+		for (auto mode : modes)
+			any = any || selected("train" + suffix.str() + "/" + mode);
+		if (!any)
+			return;
+
+		const size_t ninputs = 16, noutputs = 4, nsamples = 128, nepoch = 2;
+		Net net(ninputs, width, depth, noutputs);
+		vector<vector<double>> input(nsamples), desired_output(nsamples);
+		for (size_t s = 0; s < nsamples; ++s)
+		{
+			input[s] = random_values(gen, ninputs);
+			desired_output[s] = random_values(gen, noutputs);
+			for (auto& d : desired_output[s])
+				d = d > 0 ? 1.0 : 0.0;
+		}
+
+		if (selected(test_name))
+		{
+			vector<double> output;
+			size_t s = 0;
+			double t = time_per_run([&] { net.network.test(input[s++ % nsamples], output); }, options.min_time);
+			add(test_name, "samples/s", 1.0 / t, false);
+		}
+
+		ostream null_log(nullptr);
+		net.network.settings.set_max_num_of_epochs(nepoch);
+		net.network.settings.set_num_of_threads(1);
+		net.network.settings.set_seed(1);
+		for (auto mode : modes)
+		{
+			const string name = "train" + suffix.str() + "/" + mode;
+			if (!selected(name))
+				continue;
+			bool batch_mode = strcmp(mode, "online") != 0;
+			use_trainer(net.network, mode);
+			double t = time_per_run([&] { net.network.train(input, desired_output, null_log, 1.0, batch_mode); }, options.min_time);
+			add(name, "samples/s", nsamples * nepoch / t, false);
+		}
+	}
+
+	/**
+	 * samples/s of test() and of the CompiledNetwork of a network of 64 inputs, two hidden layers of the given width and 4 outputs, magnitude pruned
+	 * to increasing sparsity. The weights are random and not retrained, so only the speed is meaningful.
+	 */
+	void pruning(size_t width)
+	{
+		const double sparsities[] = { 0.0, 0.5, 0.8, 0.9, 0.95 };
+		vector<string> test_names, compiled_names;
+		bool any = false;
+		for (auto sparsity : sparsities)
+		{
+			ostringstream suffix;
+			suffix << "/width=" << width << "/sparsity=" << sparsity;
+			test_names.push_back("pruned_test" + suffix.str());
+			compiled_names.push_back("pruned_compiled" + suffix.str());
+			any = any || selected(test_names.back()) || selected(compiled_names.back());
+		}
+		if (!any)
+			return;
+
+		const size_t ninputs = 64, noutputs = 4, nsamples = 128;
+		Net net(ninputs, width, 2, noutputs);
+		vector<vector<double>> input(nsamples);
+		vector<double> flat_input;
+		for (auto& sample : input)
+		{
+			sample = random_values(gen, ninputs);
+			flat_input.insert(flat_input.end(), sample.begin(), sample.end());
+		}
+		const double initial_nconnections = static_cast<double>(net.network.num_of_connections());
+		for (size_t i = 0; i < sizeof(sparsities) / sizeof(sparsities[0]); ++i)
+		{
+			// removing hidden neurons left without outputs may overshoot the sparsity of a step, the next step catches up
+			const double nconnections = static_cast<double>(net.network.num_of_connections());
+			net.network.prune(std::max(0.0, 1.0 - (1.0 - sparsities[i]) * initial_nconnections / nconnections));
+			if (selected(test_names[i]))
+			{
+				vector<double> output;
+				size_t s = 0;
+				double t = time_per_run([&] { net.network.test(input[s++ % nsamples], output); }, options.min_time);
+				add(test_names[i], "samples/s", 1.0 / t, false);
+			}
+			if (selected(compiled_names[i]))
+			{
+				CompiledNetwork model(net.network);
+				vector<double> output(nsamples * noutputs), activations(model.num_of_neurons());
+				double t = time_per_run([&] { model.test(flat_input.data(), nsamples, output.data(), activations.data()); }, options.min_time);
+				add(compiled_names[i], "samples/s", nsamples / t, false);
+			}
+		}
+	}
+
+	/**
+	 * ms of NeuronNetwork::load of a network of 64 inputs, a hidden layer of the given width and 4 outputs, into a network of the same shape that
+	 * was already fed. Checks that the reloaded network computes the outputs of the saved one, throws if it does not.
+	 */
+	void reload(size_t width)
+	{
+		ostringstream suffix;
+		suffix << "/width=" << width;
+		const string name = "reload" + suffix.str();
+		if (!selected(name))
+			return;
+
+		const size_t ninputs = 64, noutputs = 4;
+		const string filename = "nnlight_bench_reload.nnl";
+		Net saved(ninputs, width, 1, noutputs), reloaded(ninputs, width, 1, noutputs);
+		saved.network.save(filename);
+		const vector<double> sample = random_values(gen, ninputs);
+		vector<double> expected, output;
+		saved.network.test(sample, expected);
+		reloaded.network.test(sample, output);
+		double t = time_per_run([&] {
+			reloaded.network.load(filename);
+			reloaded.network.test(sample, output);
+			if (output != expected)
+				throw runtime_error("Reloaded network computes other outputs than the saved one!");
+		}, options.min_time);
+		std::remove(filename.c_str());
+		add(name, "ms/load", t * 1e3, true);
+	}
+
+	/**
+	 * samples/s of test() and of train() online for a network of a sequence of the given length of 4 channels, a convolution layer of 8 filters
+	 * of 8 positions averaged over 4 positions, 16 hidden neurons and 4 outputs.
+	 */
+	void conv1d(size_t length)
+	{
+		ostringstream suffix;
+		suffix << "/length=" << length;
+		const string test_name = "conv1d_test" + suffix.str(), train_name = "conv1d_train" + suffix.str() + "/online";
+		if (!selected(test_name) && !selected(train_name))
+			return;
+
+		const size_t nchannels = 4, noutputs = 4, nsamples = 64, nepoch = 2;
+		NeuronNetwork network;
+		vector<vector<double>> input(nsamples), desired_output(nsamples);
+		build_conv1d(network, length, nchannels, noutputs);
+		for (size_t s = 0; s < nsamples; ++s)
+		{
+			input[s] = random_values(gen, length * nchannels);
+			desired_output[s] = random_values(gen, noutputs);
+			for (auto& d : desired_output[s])
+				d = d > 0 ? 1.0 : 0.0;
+		}
+
+		if (selected(test_name))
+		{
+			vector<double> output;
+			size_t s = 0;
+			double t = time_per_run([&] { network.test(input[s++ % nsamples], output); }, options.min_time);
+			add(test_name, "samples/s", 1.0 / t, false);
+		}
+		if (selected(train_name))
+		{
+			ostream null_log(nullptr);
+			network.settings.set_max_num_of_epochs(nepoch);
+			network.settings.set_num_of_threads(1);
+			network.settings.set_seed(1);
+			double t = time_per_run([&] { network.train(input, desired_output, null_log, 1.0); }, options.min_time);
+			add(train_name, "samples/s", nsamples * nepoch / t, false);
+		}
+	}
+
+	/**
+	 * Adds a sequence of the given length of nchannels channels, a convolution layer of 8 filters of 8 positions averaged over 4 positions,
+	 * 16 hidden neurons and noutputs outputs to the network.
+	 */
+	static void build_conv1d(NeuronNetwork& network, size_t length, size_t nchannels, size_t noutputs)
+	{
+		auto input = make_layer<InputNeuron>(length * nchannels);
+		auto conv = make_conv1d_layer(input, nchannels, 8, 8, 1, 4);
+		auto hidden = make_layer<Neuron>(16);
+		auto output = make_layer<OutputNeuron>(noutputs);
+		Neuron::connect_layers(conv.output, hidden);
+		Neuron::connect_layers(hidden, output);
+		network.add_layer(input);
+		network.add_layer(conv.conv);
+		network.add_layer(conv.pool);
+		network.add_layer(hidden);
+		network.add_layer(output);
+	}
+
+	/**
+	 * Allocations per epoch of train() after the first epoch of each session, online, in batch mode, with Rprop, L-BFGS (also in float) and Levenberg-Marquardt, and online
+	 * for a 1D convolution network, and allocations per test() call
+	 * after the first call, on dense and on sparse samples. All of them are expected to be zero.
+	 */
+	void allocations()
+	{
+		const size_t ninputs = 16, width = 64, noutputs = 4, nsamples = 128, nepoch = 15;
+		Net net(ninputs, width, 1, noutputs);
+		vector<vector<double>> input(nsamples), sparse_input(nsamples), desired_output(nsamples);
+		for (size_t s = 0; s < nsamples; ++s)
+		{
+			input[s] = random_values(gen, ninputs);
+			sparse_input[s].assign(ninputs, 0.0);
+			sparse_input[s][s % ninputs] = 1.0;
+			desired_output[s] = random_values(gen, noutputs);
+			for (auto& d : desired_output[s])
+				d = d > 0 ? 1.0 : 0.0;
+		}
+
+		const char* modes[] = { "online", "batch", "batch_rprop", "lbfgs", "lbfgs_fp32", "levenberg_marquardt" };
+		ostream null_log(nullptr);
+		TrainingProfiler profiler;
+		net.network.settings.set_num_of_threads(1);
+		net.network.settings.set_seed(1);
+		net.network.settings.set_profiler(&profiler);
+		for (auto mode : modes)
+		{
+			const string name = string("allocations/train/") + mode;
+			if (!selected(name))
+				continue;
+			use_trainer(net.network, mode);
+			// an epoch of Levenberg-Marquardt is quadratic in the number of weights, a few epochs are enough to see it allocating
+			net.network.settings.set_max_num_of_epochs(strcmp(mode, "levenberg_marquardt") == 0 ? 3 : nepoch);
+			profiler.clear();
+			net.network.train(input, desired_output, null_log, 0.8, strcmp(mode, "online") != 0);
+			add_allocations(name, "allocs/epoch", static_cast<double>(max_allocations_after_first_epoch(profiler)));
+		}
+		net.network.settings.set_profiler(nullptr);
+
+		const string conv_name = "allocations/train/conv1d";
+		if (selected(conv_name))
+		{
+			const size_t length = 32, nchannels = 4;
+			NeuronNetwork conv_network;
+			build_conv1d(conv_network, length, nchannels, noutputs);
+			vector<vector<double>> sequences(nsamples);
+			for (auto& sequence : sequences)
+				sequence = random_values(gen, length * nchannels);
+			conv_network.settings.set_num_of_threads(1);
+			conv_network.settings.set_seed(1);
+			conv_network.settings.set_max_num_of_epochs(nepoch);
+			conv_network.settings.set_profiler(&profiler);
+			profiler.clear();
+			conv_network.train(sequences, desired_output, null_log, 0.8);
+			add_allocations(conv_name, "allocs/epoch", static_cast<double>(max_allocations_after_first_epoch(profiler)));
+		}
+
+		const string dense_name = "allocations/test/dense", sparse_name = "allocations/test/sparse";
+		vector<double> output;
+		if (selected(dense_name))
+			add_allocations(dense_name, "allocs/call", allocations_per_call([&] (size_t s) { net.network.test(input[s], output); }, nsamples));
+		if (selected(sparse_name))
+			add_allocations(sparse_name, "allocs/call", allocations_per_call([&] (size_t s) { net.network.test(sparse_input[s], output); }, nsamples));
+	}
+
+	/**
+	 * Largest number of allocations of a profiled epoch, apart from the first epoch of each session.
+	 */
+	static uint64_t max_allocations_after_first_epoch(const TrainingProfiler& profiler)
+	{
+		uint64_t nallocs = 0;
+		for (auto& profile : profiler.get_records())
+			if (profile.epoch > 0)
+				nallocs = std::max(nallocs, profile.nallocs);
+		return nallocs;
+	}
+
+	/**
+	 * Sets the weight update method of a mode: "batch_rprop", "lbfgs", "lbfgs_fp32" and "lbfgs_bf16" (L-BFGS computing in float and bfloat16),
+	 * "levenberg_marquardt", or gradient descent.
+	 */
+	static void use_trainer(NeuronNetwork& network, const char* mode)
+	{
+		if (strcmp(mode, "batch_rprop") == 0)
+			network.use_resilient_backpropagation();
+		else if (strcmp(mode, "lbfgs") == 0)
+			network.use_lbfgs();
+		else if (strcmp(mode, "lbfgs_fp32") == 0)
+			network.use_lbfgs(LbfgsTrainer::def_history, FullBatchTrainer::FLOAT_PRECISION);
+		else if (strcmp(mode, "lbfgs_bf16") == 0)
+			network.use_lbfgs(LbfgsTrainer::def_history, FullBatchTrainer::BFLOAT16_PRECISION);
+		else if (strcmp(mode, "levenberg_marquardt") == 0)
+			network.use_levenberg_marquardt();
+		else
+			network.use_default_backpropation();
+	}
+
+	/**
+	 * Allocations per call of fun(0), ..., fun(n - 1), after a warm-up call.
+	 */
+	template <typename Fun>
+	static double allocations_per_call(Fun fun, size_t n)
+	{
+		fun(0);
+		uint64_t start = AllocationCounter::thread_count();
+		for (size_t i = 0; i < n; ++i)
+			fun(i);
+		return static_cast<double>(AllocationCounter::thread_count() - start) / n;
+	}
+
+	void add_allocations(const string& name, const string& unit, double value)
+	{
+		add(name, unit, value, true);
+		if (value > 0)
+		{
+			cerr << name << " allocates in the steady state!" << endl;
+			++nallocating;
+		}
+	}
+
+	Options options;
+	RandomGenerator gen;
+	vector<Result> results;
+	size_t nallocating;
+};
+
+void write_json(const vector<Result>& results, ostream& out)
+{
+	// one benchmark per line, read back by read_json
+	out << "{" << endl << "  \"benchmarks\": [" << endl;
+	out << setprecision(6);
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const auto& r = results[i];
+		out << "    {\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\", \"value\": " << r.value
+			<< ", \"lower_is_better\": " << (r.lower_is_better ? "true" : "false") << "}" << (i + 1 < results.size() ? "," : "") << endl;
+	}
+	out << "  ]" << endl << "}" << endl;
+}
+
+/**
+ * Reads the name and value of each benchmark from a file written by write_json.
+ */
+map<string, double> read_json(const string& filename)
+{
+	ifstream in(filename.c_str());
+	if (!in)
+		throw runtime_error("Cannot open baseline file " + filename + "!");
+	map<string, double> values;
+	string line;
+	while (getline(in, line))
+	{
+		const string name_key = "\"name\": \"", value_key = "\"value\": ";
+		size_t name_pos = line.find(name_key), value_pos = line.find(value_key);
+		if (name_pos == string::npos || value_pos == string::npos)
+			continue;
+		name_pos += name_key.size();
+		string name = line.substr(name_pos, line.find('"', name_pos) - name_pos);
+		values[name] = atof(line.c_str() + value_pos + value_key.size());
+	}
+	return values;
+}
+
+/**
+ * Prints the change of each benchmark relative to the baseline. Returns the number of regressions.
+ */
+size_t compare(const vector<Result>& results, const map<string, double>& baseline, double threshold, ostream& out)
+{
+	size_t nregressions = 0;
+	out << std::left << setw(40) << "benchmark" << std::right << setw(14) << "baseline" << setw(14) << "current" << setw(10) << "change" << endl;
+	for (auto& r : results)
+	{
+		out << std::left << setw(40) << r.name << std::right;
+		auto base = baseline.find(r.name);
+		if (base == baseline.end() || base->second <= 0 || r.value <= 0)
+		{
+			out << setw(14) << "-" << setw(14) << r.value << "  new" << endl;
+			continue;
+		}
+		double slowdown = r.lower_is_better ? r.value / base->second : base->second / r.value;
+		out << setw(14) << base->second << setw(14) << r.value << setw(9) << fixed << setprecision(1) << (r.value / base->second - 1) * 100 << "%";
+		out.unsetf(std::ios::floatfield);
+		out << setprecision(6);
+		if (slowdown > 1 + threshold)
+		{
+			out << "  REGRESSION";
+			++nregressions;
+		}
+		else if (slowdown < 1 / (1 + threshold))
+			out << "  improved";
+		out << endl;
+	}
+	out << nregressions << " regression(s) above " << threshold * 100 << "%" << endl;
+	return nregressions;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--quick")
+		{
+			options.quick = true;
+			options.min_time = 0.02;
+		}
+		else if (arg == "--filter" && has_value) options.filter = argv[++i];
+		else if (arg == "--min-time" && has_value) options.min_time = atof(argv[++i]);
+		else if (arg == "--json" && has_value) options.json_filename = argv[++i];
+		else if (arg == "--compare" && has_value) options.baseline_filename = argv[++i];
+		else if (arg == "--threshold" && has_value) options.threshold = atof(argv[++i]);
+		else
+		{
+			cerr << "Usage: " << argv[0] << " [--quick] [--filter TEXT] [--min-time SECONDS] [--json FILE] [--compare BASELINE] [--threshold RATIO]" << endl;
+			return 2;
+		}
+	}
+
+	try {
+		map<string, double> baseline;
+		if (!options.baseline_filename.empty())
+			baseline = read_json(options.baseline_filename); // fail before running the suite
+
+		Suite suite(options);
+		suite.run();
+
+		if (!options.json_filename.empty())
+		{
+			ofstream json(options.json_filename.c_str());
+			write_json(suite.get_results(), json);
+		}
+		else if (options.baseline_filename.empty())
+			write_json(suite.get_results(), cout);
+
+		size_t nregressions = 0;
+		if (!options.baseline_filename.empty())
+			nregressions = compare(suite.get_results(), baseline, options.threshold, cout);
+		return nregressions || suite.num_of_allocating() ? 1 : 0;
+	}
+	catch (std::exception& e)
+	{
+		cerr << e.what() << endl;
+		return 2;
+	}
+	return 0;
+}
\ No newline at end of file
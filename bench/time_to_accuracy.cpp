@@ -0,0 +1,519 @@
+/**
+ * Project NNlight
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include "NeuronNetwork.h"
+#include "Conv1D.h"
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+/**
+ * Time-to-accuracy benchmark
+ *
+ * Trains a network on each bundled dataset in each training mode (online, batch, Rprop, Rprop on several threads, and L-BFGS in double, float and bfloat16 precision) until the test error reaches a target,
+ * and the networks of the sequence datasets also with a 1D convolution layer in front of the hidden layer (conv, trained online),
+ * and reports the wall time and epochs it took, the number of training sessions (restarts), the final errors and the peak resident memory of the run.
+ * Every run of a dataset starts from the same seed, so the modes start from the same weights and train/test split, and the results are reproducible.
+ * Results are written as JSON, one run per line; a table is printed to the standard error.
+ *
+ * Usage: nnlight_tta [--data DIR] [--quick] [--filter TEXT] [--json FILE]
+ *   --data    directory of the datasets (default dataset)
+ *   --quick   smaller datasets and fewer epochs, for smoke runs
+ *   --filter  runs only the runs whose name (dataset/mode) contains TEXT
+ *   --json    writes the results to FILE instead of the standard output
+ */
+
+using namespace std;
+using namespace NNlight;
+
+namespace {
+
+struct Options
+{
+	Options() : data_dir("dataset"), quick(false) {}
+	string data_dir;
+	bool quick;
+	string filter;
+	string json_filename;
+};
+
+struct Dataset
+{
+	vector<vector<double>> input;
+	vector<vector<double>> output;
+};
+
+/**
+ * Training setup of a dataset: network size, learning parameters and the target test error (MSE, the train error if train_ratio is 1).
+ * nchannels is the number of values per position of a sequence input, 0 if the input is not a sequence.
+ */
+struct Config
+{
+	const char* name;
+	Dataset (*load)(const string& data_dir, bool quick);
+	size_t nhidden;
+	double init_bound;
+	double learning_rate;
+	double batch_learning_rate;
+	double train_ratio;
+	double target_err;
+	size_t max_nepoch;
+	size_t max_nrestart;
+	size_t nchannels;
+};
+
+struct Mode
+{
+	const char* name;
+	bool batch;
+	bool rprop;
+	bool lbfgs;
+	FullBatchTrainer::Precision precision; // of L-BFGS
+	bool conv;
+	size_t nthreads; // 0 means one thread per core
+};
+
+struct Result
+{
+	string dataset;
+	string mode;
+	size_t nthreads;
+	size_t nsamples;
+	TrainingResult training;
+	long peak_rss_kb;
+};
+
+ifstream open_data(const string& data_dir, const string& filename)
+{
+	string path = data_dir + "/" + filename;
+	ifstream in(path.c_str());
+	if (!in)
+		throw runtime_error("Cannot open dataset file " + path + "!");
+	return in;
+}
+
+vector<string> split(const string& line, char sep)
+{
+	vector<string> fields;
+	std::istringstream fields_stream(line);
+	string field;
+	while (getline(fields_stream, field, sep))
+		fields.push_back(field);
+	return fields;
+}
+
+/**
+ * Scales every column of the samples into [0, 1].
+ */
+void normalize(vector<vector<double>>& samples)
+{
+	if (samples.empty())
+		return;
+	for (size_t c = 0; c < samples[0].size(); ++c)
+	{
+		double lo = samples[0][c], hi = samples[0][c];
+		for (auto& s : samples)
+		{
+			lo = std::min(lo, s[c]);
+			hi = std::max(hi, s[c]);
+		}
+		for (auto& s : samples)
+			s[c] = hi > lo ? (s[c] - lo) / (hi - lo) : 0.0;
+	}
+}
+
+vector<double> one_hot(size_t n, size_t hot)
+{
+	vector<double> values(n, 0.0);
+	values[hot] = 1.0;
+	return values;
+}
+
+Dataset load_xor(const string& data_dir, bool)
+{
+	auto in = open_data(data_dir, "xor.data");
+	Dataset data;
+	double a, b, y;
+	while (in >> a >> b >> y)
+	{
+		data.input.push_back(vector<double>(2));
+		data.input.back()[0] = a;
+		data.input.back()[1] = b;
+		data.output.push_back(vector<double>(1, y));
+	}
+	return data;
+}
+
+Dataset load_iris(const string& data_dir, bool)
+{
+	auto in = open_data(data_dir, "iris/iris.data.txt");
+	const string classes[] = { "Iris-setosa", "Iris-versicolor", "Iris-virginica" };
+	Dataset data;
+	string line;
+	while (getline(in, line))
+	{
+		auto fields = split(line, ',');
+		if (fields.size() != 5)
+			continue;
+		size_t label = std::find(classes, classes + 3, fields[4]) - classes;
+		if (label == 3)
+			continue;
+		vector<double> features;
+		for (size_t i = 0; i < 4; ++i)
+			features.push_back(atof(fields[i].c_str()));
+		data.input.push_back(features);
+		data.output.push_back(one_hot(3, label));
+	}
+	normalize(data.input);
+	return data;
+}
+
+/**
+ * Predicts the published relative performance (PRP) of a CPU from its cycle time, memory, cache and channel sizes, all on logarithmic scale.
+ */
+Dataset load_machine(const string& data_dir, bool)
+{
+	auto in = open_data(data_dir, "machine/machine.data");
+	Dataset data;
+	string line;
+	while (getline(in, line))
+	{
+		auto fields = split(line, ',');
+		if (fields.size() != 10)
+			continue;
+		vector<double> features;
+		for (size_t i = 2; i < 8; ++i)
+			features.push_back(std::log(1.0 + atof(fields[i].c_str())));
+		data.input.push_back(features);
+		data.output.push_back(vector<double>(1, std::log(1.0 + atof(fields[8].c_str()))));
+	}
+	normalize(data.input);
+	normalize(data.output);
+	return data;
+}
+
+Dataset load_tictactoe(const string& data_dir, bool)
+{
+	auto in = open_data(data_dir, "tictactoe/tic-tac-toe.data");
+	Dataset data;
+	string line;
+	while (getline(in, line))
+	{
+		auto fields = split(line, ',');
+		if (fields.size() != 10)
+			continue;
+		vector<double> board(18, 0.0); // x and o flags of every cell
+		for (size_t i = 0; i < 9; ++i)
+		{
+			board[2 * i] = fields[i] == "x" ? 1.0 : 0.0;
+			board[2 * i + 1] = fields[i] == "o" ? 1.0 : 0.0;
+		}
+		data.input.push_back(board);
+		data.output.push_back(vector<double>(1, fields[9].compare(0, 8, "positive") == 0 ? 1.0 : 0.0));
+	}
+	return data;
+}
+
+/**
+ * Classifies poker hands into 10 classes, each card encoded as its suit (4) and rank (13). The training file is capped, it has 25010 hands.
+ */
+Dataset load_poker(const string& data_dir, bool quick)
+{
+	auto in = open_data(data_dir, "poker/poker-hand-training-true.data");
+	const size_t max_nsamples = quick ? 500 : 2000;
+	Dataset data;
+	string line;
+	while (data.input.size() < max_nsamples && getline(in, line))
+	{
+		auto fields = split(line, ',');
+		if (fields.size() != 11)
+			continue;
+		vector<double> hand(5 * 17, 0.0);
+		for (size_t card = 0; card < 5; ++card)
+		{
+			size_t suit = atoi(fields[2 * card].c_str()), rank = atoi(fields[2 * card + 1].c_str());
+			if (suit < 1 || suit > 4 || rank < 1 || rank > 13)
+				throw runtime_error("Invalid card in poker dataset!");
+			hand[card * 17 + suit - 1] = 1.0;
+			hand[card * 17 + 4 + rank - 1] = 1.0;
+		}
+		data.input.push_back(hand);
+		data.output.push_back(one_hot(10, atoi(fields[10].c_str()) % 10));
+	}
+	return data;
+}
+
+/**
+ * Separates the EEG recordings of planning (class 1) and relaxed (class 2) states.
+ */
+Dataset load_eeg(const string& data_dir, bool)
+{
+	auto in = open_data(data_dir, "eeg/plrx.txt");
+	Dataset data;
+	string line;
+	while (getline(in, line))
+	{
+		std::istringstream values(line);
+		vector<double> features(12);
+		double label;
+		for (auto& f : features)
+			values >> f;
+		if (!(values >> label))
+			continue;
+		data.input.push_back(features);
+		data.output.push_back(vector<double>(1, label == 2 ? 1.0 : 0.0));
+	}
+	normalize(data.input);
+	return data;
+}
+
+/**
+ * Tells bats, birds and fishes apart by the first 150 bases of their COI barcode, each base one-hot encoded (unknown bases are all zero).
+ */
+Dataset load_animals(const string& data_dir, bool quick)
+{
+	const char* files[] = { "animals/bats.fas", "animals/birds.fas", "animals/fishes.fas" };
+	const size_t nbases = 150;
+	const size_t max_nsamples = quick ? 100 : 300; // per class
+	const string bases = "ACGT";
+	Dataset data;
+	for (size_t label = 0; label < 3; ++label)
+	{
+		auto in = open_data(data_dir, files[label]);
+		string line;
+		size_t nsamples = 0;
+		while (nsamples < max_nsamples && getline(in, line))
+		{
+			if (line.empty() || line[0] == '>' || line.size() < nbases)
+				continue;
+			vector<double> sequence(nbases * 4, 0.0);
+			for (size_t i = 0; i < nbases; ++i)
+			{
+				size_t base = bases.find(line[i]);
+				if (base != string::npos)
+					sequence[i * 4 + base] = 1.0;
+			}
+			data.input.push_back(sequence);
+			data.output.push_back(one_hot(3, label));
+			++nsamples;
+		}
+	}
+	return data;
+}
+
+/**
+ * Peak resident memory of the process in kB since the last reset_peak_rss(), or since the start of the process where it cannot be reset.
+ */
+long peak_rss_kb()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return static_cast<long>(counters.PeakWorkingSetSize / 1024);
+	return 0;
+#else
+	ifstream status("/proc/self/status");
+	string line;
+	while (getline(status, line))
+		if (line.compare(0, 6, "VmHWM:") == 0)
+			return atol(line.c_str() + 6);
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+	return usage.ru_maxrss / 1024; // bytes
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+void reset_peak_rss()
+{
+#if defined(__linux__)
+	ofstream clear_refs("/proc/self/clear_refs");
+	clear_refs << "5" << endl; // resets VmHWM to the current resident size
+#endif
+}
+
+Result run(const Config& config, const Dataset& data, const Mode& mode, bool quick)
+{
+	const uint64_t seed = 42;
+	RandomGenerator::seed_shared(seed);
+	Neuron::set_initial_weight_bounds(-config.init_bound, config.init_bound);
+
+	auto input = make_layer<InputNeuron>(data.input[0].size());
+	auto hidden = make_layer<Neuron>(config.nhidden);
+	auto output = make_layer<OutputNeuron>(data.output[0].size());
+	NeuronNetwork network;
+	network.add_layer(input);
+	if (mode.conv)
+	{
+		// 4 filters of 8 positions at every 4th position, averaged over 2 positions
+		auto conv = make_conv1d_layer(input, config.nchannels, 8, 4, 4, 2);
+		network.add_layer(conv.conv);
+		network.add_layer(conv.pool);
+		Neuron::connect_layers(conv.output, hidden);
+	}
+	else
+		Neuron::connect_layers(input, hidden);
+	Neuron::connect_layers(hidden, output);
+	network.add_layer(hidden);
+	network.add_layer(output);
+	if (mode.rprop)
+		network.use_resilient_backpropagation();
+	else if (mode.lbfgs)
+		network.use_lbfgs(LbfgsTrainer::def_history, mode.precision);
+	else
+		network.use_default_backpropation(mode.batch ? config.batch_learning_rate : config.learning_rate, 1e-5);
+	network.settings.set_seed(seed);
+	network.settings.set_target_error(config.target_err);
+	network.settings.set_max_num_of_epochs(quick ? config.max_nepoch / 4 : config.max_nepoch);
+	network.settings.restart_training_if_stuck(true, config.target_err, config.max_nrestart);
+	network.settings.set_num_of_threads(mode.nthreads);
+
+	Result result;
+	result.dataset = config.name;
+	result.mode = mode.name;
+	result.nthreads = mode.nthreads ? mode.nthreads : std::max<size_t>(1, std::thread::hardware_concurrency());
+	result.nsamples = data.input.size();
+	std::ostream null_log(nullptr);
+	reset_peak_rss();
+	result.training = network.train(data.input, data.output, null_log, config.train_ratio, mode.batch || mode.rprop);
+	result.peak_rss_kb = peak_rss_kb();
+	return result;
+}
+
+void print_header(ostream& out)
+{
+	out << std::left << setw(28) << "run" << std::right << setw(8) << "samples" << setw(10) << "time (s)" << setw(8) << "epochs" << setw(9) << "sessions"
+		<< setw(11) << "train err" << setw(11) << "test err" << setw(8) << "target" << setw(12) << "peak RSS kB" << endl;
+}
+
+void print_result(const Result& r, ostream& out)
+{
+	out << std::left << setw(28) << r.dataset + "/" + r.mode << std::right << setw(8) << r.nsamples << setw(10) << fixed << setprecision(3) << r.training.wall_time
+		<< setw(8) << r.training.nepoch << setw(9) << r.training.nsession << setprecision(5) << setw(11) << r.training.train_err;
+	if (r.training.test_err < std::numeric_limits<double>::max())
+		out << setw(11) << r.training.test_err;
+	else
+		out << setw(11) << "-";
+	out << setw(8) << (r.training.target_reached ? "yes" : "no") << setw(12) << r.peak_rss_kb << endl;
+	out.unsetf(std::ios::floatfield);
+}
+
+void write_json(const vector<Result>& results, ostream& out)
+{
+	// one run per line
+	out << "{" << endl << "  \"runs\": [" << endl;
+	out << setprecision(6);
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const auto& r = results[i];
+		out << "    {\"dataset\": \"" << r.dataset << "\", \"mode\": \"" << r.mode << "\", \"threads\": " << r.nthreads << ", \"samples\": " << r.nsamples
+			<< ", \"wall_time\": " << r.training.wall_time << ", \"epochs\": " << r.training.nepoch << ", \"target_reached\": " << (r.training.target_reached ? "true" : "false")
+			<< ", \"peak_rss_kb\": " << r.peak_rss_kb << ", \"restarts\": " << (r.training.nsession ? r.training.nsession - 1 : 0)
+			<< ", \"train_err\": " << r.training.train_err << ", \"test_err\": ";
+		if (r.training.test_err < std::numeric_limits<double>::max())
+			out << r.training.test_err;
+		else
+			out << "null";
+		out << "}" << (i + 1 < results.size() ? "," : "") << endl;
+	}
+	out << "  ]" << endl << "}" << endl;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--quick") options.quick = true;
+		else if (arg == "--data" && has_value) options.data_dir = argv[++i];
+		else if (arg == "--filter" && has_value) options.filter = argv[++i];
+		else if (arg == "--json" && has_value) options.json_filename = argv[++i];
+		else
+		{
+			cerr << "Usage: " << argv[0] << " [--data DIR] [--quick] [--filter TEXT] [--json FILE]" << endl;
+			return 2;
+		}
+	}
+
+	// name, loader, hidden neurons, initial weight bound, learning rate (online, batch), train ratio, target error, max epochs, max sessions, channels
+	const Config configs[] = {
+		{ "xor", load_xor, 4, 1.0, 0.2, 0.2, 1.0, 0.01, 4000, 32, 0 },
+		{ "iris", load_iris, 8, 1.0, 0.3, 0.005, 0.8, 0.03, 1000, 4, 0 },
+		{ "machine", load_machine, 8, 1.0, 0.05, 0.002, 0.8, 0.015, 1000, 4, 0 },
+		{ "tictactoe", load_tictactoe, 16, 0.5, 0.05, 0.0005, 0.8, 0.03, 1000, 4, 0 },
+		{ "poker", load_poker, 32, 0.3, 0.02, 0.0001, 0.8, 0.057, 100, 2, 0 },
+		{ "eeg", load_eeg, 8, 1.0, 0.05, 0.005, 0.8, 0.2, 500, 4, 0 },
+		{ "animals", load_animals, 8, 0.1, 0.02, 0.0002, 0.8, 0.01, 100, 2, 4 }
+	};
+	const Mode modes[] = {
+		{ "online", false, false, false, FullBatchTrainer::DOUBLE_PRECISION, false, 1 },
+		{ "batch", true, false, false, FullBatchTrainer::DOUBLE_PRECISION, false, 1 },
+		{ "rprop", true, true, false, FullBatchTrainer::DOUBLE_PRECISION, false, 1 },
+		{ "rprop_t2", true, true, false, FullBatchTrainer::DOUBLE_PRECISION, false, 2 },
+		{ "rprop_tall", true, true, false, FullBatchTrainer::DOUBLE_PRECISION, false, 0 },
+		{ "lbfgs", true, false, true, FullBatchTrainer::DOUBLE_PRECISION, false, 1 },
+		{ "lbfgs_fp32", true, false, true, FullBatchTrainer::FLOAT_PRECISION, false, 1 },
+		{ "lbfgs_bf16", true, false, true, FullBatchTrainer::BFLOAT16_PRECISION, false, 1 },
+		{ "conv", false, false, false, FullBatchTrainer::DOUBLE_PRECISION, true, 1 }
+	};
+
+	try {
+		vector<Result> results;
+		print_header(cerr);
+		for (auto& config : configs)
+		{
+			bool selected = false;
+			for (auto& mode : modes)
+				selected = selected || ((!mode.conv || config.nchannels > 0) && (string(config.name) + "/" + mode.name).find(options.filter) != string::npos);
+			if (!selected)
+				continue;
+
+			Dataset data = config.load(options.data_dir, options.quick);
+			if (data.input.empty())
+				throw runtime_error(string("No samples in dataset ") + config.name + "!");
+			for (auto& mode : modes)
+			{
+				if ((mode.conv && config.nchannels == 0) || (string(config.name) + "/" + mode.name).find(options.filter) == string::npos)
+					continue;
+				results.push_back(run(config, data, mode, options.quick));
+				print_result(results.back(), cerr);
+			}
+		}
+
+		if (!options.json_filename.empty())
+		{
+			ofstream json(options.json_filename.c_str());
+			write_json(results, json);
+		}
+		else
+			write_json(results, cout);
+	}
+	catch (std::exception& e)
+	{
+		cerr << e.what() << endl;
+		return 2;
+	}
+	return 0;
+}
\ No newline at end of file
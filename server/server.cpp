@@ -0,0 +1,504 @@
+/**
+ * Project NNlight
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "CompiledNetwork.h"
+#include "InferenceStats.h"
+
+/**
+ * Inference server
+ *
+ * Serves a model file written by NeuronNetwork::save() on a Unix domain socket or on a TCP port of localhost. Requests of concurrent connections
+ * are coalesced into micro-batches: a worker takes the queued requests once they add up to --max-batch samples or the oldest of them has waited
+ * --max-delay microseconds, and evaluates them by a single batched CompiledNetwork::test call. Each connection is read by its own thread and
+ * served one request at a time, so concurrency comes from concurrent connections.
+ *
+ * Protocol: every message is a header of two uint32 values in host byte order, followed by a payload.
+ *   request:  kind, count    kind 1 (INFER): count samples of num_of_inputs() float64 values follow
+ *                            kind 2 (INFO): no payload, count is 0
+ *                            kind 3 (STATS): no payload, count is 0
+ *   response: status, size   status 0 (OK), 1 (BAD_REQUEST, the connection is closed after it) or 2 (OVERLOADED, the queue is full);
+ *                            size bytes of payload follow: the outputs of INFER as count samples of num_of_outputs() float64 values,
+ *                            num_of_inputs() and num_of_outputs() as uint32 for INFO, a JSON text of the queue depth and latencies for STATS
+ *
+ * Usage: nnlight_serve --model FILE (--socket PATH | --port N) [--workers N] [--max-batch N] [--max-delay US] [--max-queue N] [--report SECONDS]
+ *   --model      model file to serve
+ *   --socket     listens on a Unix domain socket at PATH
+ *   --port       listens on a TCP port of 127.0.0.1
+ *   --workers    number of inference threads (default one per core)
+ *   --max-batch  samples per micro-batch (default 64), larger requests are evaluated alone
+ *   --max-delay  microseconds a request may wait for others to join its batch (default 500)
+ *   --max-queue  queued samples above which requests are rejected as overloaded (default 4096), also the largest request
+ *   --report     writes the statistics to the standard error every SECONDS seconds (default 0, never)
+ */
+
+using namespace std;
+using namespace NNlight;
+
+namespace {
+
+enum RequestKind { INFER = 1, INFO = 2, STATS = 3 };
+enum Status { OK = 0, BAD_REQUEST = 1, OVERLOADED = 2 };
+
+struct Options
+{
+	Options() : port(0), nworkers(0), max_batch(64), max_delay_us(500), max_queue(4096), report_sec(0) {}
+	string model_filename;
+	string socket_path;
+	int port;
+	size_t nworkers;
+	size_t max_batch;
+	size_t max_delay_us;
+	size_t max_queue;
+	double report_sec;
+};
+
+volatile sig_atomic_t stop_requested = 0;
+
+void request_stop(int)
+{
+	stop_requested = 1;
+}
+
+/**
+ * Reads exactly size bytes, returns false if the connection is closed or fails first.
+ */
+bool read_all(int fd, void* data, size_t size)
+{
+	char* p = static_cast<char*>(data);
+	while (size)
+	{
+		ssize_t n = read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+/**
+ * Writes exactly size bytes, returns false if the connection fails first.
+ */
+bool write_all(int fd, const void* data, size_t size)
+{
+	const char* p = static_cast<const char*>(data);
+	while (size)
+	{
+		ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool write_response(int fd, uint32_t status, const void* payload, size_t size)
+{
+	const uint32_t header[2] = { status, static_cast<uint32_t>(size) };
+	return write_all(fd, header, sizeof(header)) && (size == 0 || write_all(fd, payload, size));
+}
+
+/**
+ * An INFER request waiting in the queue. Owned by the thread of its connection, which waits until a worker marks it done.
+ */
+struct Request
+{
+	Request() : input(nullptr), nsamples(0), done(false) {}
+
+	const double* input;
+	/**
+	 * The response header is written into the first element, so the response goes out in a single write.
+	 */
+	vector<double> response;
+	size_t nsamples;
+	chrono::steady_clock::time_point arrival;
+	bool done;
+	mutex done_mutex;
+	condition_variable done_cond;
+};
+
+struct Connection
+{
+	Connection(int fd_) : fd(fd_), finished(false) {}
+
+	int fd;
+	thread reader;
+	atomic<bool> finished;
+};
+
+class Server
+{
+public:
+	Server(const Options& options_)
+		: options(options_), model(options_.model_filename), ninputs(model.num_of_inputs()), noutputs(model.num_of_outputs()),
+		queued_samples(0), max_queue_depth(0), noverloaded(0), stopping(false)
+	{
+		model.collect_inference_stats(&batch_stats);
+	}
+
+	/**
+	 * Accepts connections until SIGINT or SIGTERM, then finishes the pending requests.
+	 */
+	void run(int listen_fd)
+	{
+		size_t nworkers = options.nworkers ? options.nworkers : max<size_t>(1, thread::hardware_concurrency());
+		for (size_t w = 0; w < nworkers; ++w)
+			workers.push_back(thread(&Server::work, this));
+		cerr << "Serving " << options.model_filename << " (" << ninputs << " inputs, " << noutputs << " outputs) on " << nworkers << " workers" << endl;
+
+		auto last_report = chrono::steady_clock::now();
+		while (!stop_requested)
+		{
+			pollfd pfd = { listen_fd, POLLIN, 0 };
+			int ready = poll(&pfd, 1, 200);
+			if (options.report_sec > 0 && chrono::duration<double>(chrono::steady_clock::now() - last_report).count() >= options.report_sec)
+			{
+				write_stats(cerr);
+				last_report = chrono::steady_clock::now();
+			}
+			if (ready <= 0)
+				continue;
+			int fd = accept(listen_fd, nullptr, nullptr);
+			if (fd < 0)
+				continue;
+			if (options.socket_path.empty())
+			{
+				int one = 1;
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // responses are small, do not wait to coalesce them
+			}
+
+			// join the threads of closed connections
+			for (size_t c = 0; c < connections.size(); )
+			{
+				if (connections[c]->finished)
+				{
+					connections[c]->reader.join();
+					close(connections[c]->fd);
+					connections.erase(connections.begin() + c);
+				}
+				else
+					++c;
+			}
+			connections.push_back(unique_ptr<Connection>(new Connection(fd)));
+			Connection& connection = *connections.back();
+			connection.reader = thread(&Server::serve, this, std::ref(connection));
+		}
+
+		// the readers finish their current request, then the workers the queue
+		for (auto& connection : connections)
+		{
+			shutdown(connection->fd, SHUT_RDWR);
+			connection->reader.join();
+			close(connection->fd);
+		}
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			stopping = true;
+		}
+		queue_cond.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+		write_stats(cerr);
+	}
+
+private:
+	/**
+	 * Reads and answers the requests of a connection until it is closed.
+	 */
+	void serve(Connection& connection)
+	{
+		const int fd = connection.fd;
+		Request request;
+		vector<double> input;
+		uint32_t header[2];
+		while (read_all(fd, header, sizeof(header)))
+		{
+			const uint32_t kind = header[0], count = header[1];
+			if (kind == INFO && count == 0)
+			{
+				const uint32_t info[2] = { static_cast<uint32_t>(ninputs), static_cast<uint32_t>(noutputs) };
+				if (!write_response(fd, OK, info, sizeof(info)))
+					break;
+				continue;
+			}
+			if (kind == STATS && count == 0)
+			{
+				ostringstream json;
+				write_stats(json);
+				if (!write_response(fd, OK, json.str().data(), json.str().size()))
+					break;
+				continue;
+			}
+			if (kind != INFER || count == 0 || count > options.max_queue)
+			{
+				write_response(fd, BAD_REQUEST, nullptr, 0);
+				break;
+			}
+
+			request.arrival = chrono::steady_clock::now();
+			input.resize(count * ninputs);
+			if (!read_all(fd, input.data(), input.size() * sizeof(double)))
+				break;
+			request.input = input.data();
+			request.nsamples = count;
+			request.response.resize(1 + count * noutputs);
+			request.done = false;
+			if (!enqueue(request))
+			{
+				if (!write_response(fd, OVERLOADED, nullptr, 0))
+					break;
+				continue;
+			}
+			{
+				unique_lock<mutex> lock(request.done_mutex);
+				request.done_cond.wait(lock, [&request] { return request.done; });
+			}
+			request_stats.record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - request.arrival).count(), count);
+
+			const uint32_t response_header[2] = { OK, static_cast<uint32_t>(count * noutputs * sizeof(double)) };
+			memcpy(request.response.data(), response_header, sizeof(response_header));
+			if (!write_all(fd, request.response.data(), request.response.size() * sizeof(double)))
+				break;
+		}
+		connection.finished = true; // closed by the accepting thread, so the descriptor is not reused while it may shut it down
+	}
+
+	/**
+	 * Queues a request, unless the queue is full.
+	 */
+	bool enqueue(Request& request)
+	{
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			if (queued_samples + request.nsamples > options.max_queue)
+			{
+				++noverloaded;
+				return false;
+			}
+			queue.push_back(&request);
+			queued_samples += request.nsamples;
+			max_queue_depth = max(max_queue_depth, queue.size());
+		}
+		queue_cond.notify_one();
+		return true;
+	}
+
+	/**
+	 * Body of a worker thread: takes a micro-batch from the queue once it is full or its oldest request is due, and evaluates it.
+	 */
+	void work()
+	{
+		vector<double> input(options.max_batch * ninputs), output(options.max_batch * noutputs), activations(model.num_of_neurons());
+		vector<Request*> batch;
+		const auto max_delay = chrono::microseconds(options.max_delay_us);
+		unique_lock<mutex> lock(queue_mutex);
+		for (;;)
+		{
+			if (queue.empty())
+			{
+				if (stopping)
+					return;
+				queue_cond.wait(lock);
+				continue;
+			}
+			auto deadline = queue.front()->arrival + max_delay;
+			if (queued_samples < options.max_batch && !stopping && chrono::steady_clock::now() < deadline)
+			{
+				queue_cond.wait_until(lock, deadline);
+				continue;
+			}
+
+			// requests in arrival order up to max_batch samples, a larger request alone
+			batch.clear();
+			size_t nsamples = 0;
+			while (!queue.empty() && (batch.empty() || nsamples + queue.front()->nsamples <= options.max_batch))
+			{
+				batch.push_back(queue.front());
+				nsamples += queue.front()->nsamples;
+				queue.pop_front();
+			}
+			queued_samples -= nsamples;
+			if (!queue.empty())
+				queue_cond.notify_one(); // another worker starts waiting for the rest
+			lock.unlock();
+
+			if (batch.size() == 1)
+				model.test(batch[0]->input, nsamples, batch[0]->response.data() + 1, activations.data());
+			else
+			{
+				double* in = input.data();
+				for (auto request : batch)
+					in = copy(request->input, request->input + request->nsamples * ninputs, in);
+				model.test(input.data(), nsamples, output.data(), activations.data());
+				const double* out = output.data();
+				for (auto request : batch)
+				{
+					copy(out, out + request->nsamples * noutputs, request->response.data() + 1);
+					out += request->nsamples * noutputs;
+				}
+			}
+			for (auto request : batch)
+			{
+				// notified under the lock, so the request is not destroyed while notifying
+				lock_guard<mutex> done_lock(request->done_mutex);
+				request->done = true;
+				request->done_cond.notify_one();
+			}
+
+			lock.lock();
+		}
+	}
+
+	/**
+	 * Writes the queue depth, the latency of the requests (arrival to result) and the latency and size of the batches, as a JSON object.
+	 */
+	void write_stats(ostream& out)
+	{
+		size_t depth, nqueued, max_depth;
+		uint64_t nrejected;
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			depth = queue.size();
+			nqueued = queued_samples;
+			max_depth = max_queue_depth;
+			nrejected = noverloaded;
+		}
+		out << "{\"queue_depth\": " << depth << ", \"queued_samples\": " << nqueued << ", \"max_queue_depth\": " << max_depth
+			<< ", \"overloaded\": " << nrejected << ", \"requests\": ";
+		request_stats.snapshot().write_json(out);
+		out << ", \"batches\": ";
+		batch_stats.snapshot().write_json(out);
+		out << "}" << endl;
+	}
+
+	Options options;
+	CompiledNetwork model;
+	const size_t ninputs, noutputs;
+	InferenceStats request_stats, batch_stats;
+
+	mutex queue_mutex;
+	condition_variable queue_cond;
+	deque<Request*> queue;
+	size_t queued_samples, max_queue_depth;
+	uint64_t noverloaded;
+	bool stopping;
+
+	vector<thread> workers;
+	vector<unique_ptr<Connection>> connections;
+};
+
+int listen_unix(const string& path)
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+		throw runtime_error("Socket path is too long!");
+	strcpy(addr.sun_path, path.c_str());
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		throw runtime_error("Cannot create socket!");
+	unlink(path.c_str());
+	if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 128) < 0)
+		throw runtime_error("Cannot listen on " + path + ": " + strerror(errno));
+	return fd;
+}
+
+int listen_tcp(int port)
+{
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(static_cast<uint16_t>(port));
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		throw runtime_error("Cannot create socket!");
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 128) < 0)
+		throw runtime_error(string("Cannot listen on port ") + to_string(port) + ": " + strerror(errno));
+	return fd;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--model" && has_value) options.model_filename = argv[++i];
+		else if (arg == "--socket" && has_value) options.socket_path = argv[++i];
+		else if (arg == "--port" && has_value) options.port = atoi(argv[++i]);
+		else if (arg == "--workers" && has_value) options.nworkers = strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--max-batch" && has_value) options.max_batch = strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--max-delay" && has_value) options.max_delay_us = strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--max-queue" && has_value) options.max_queue = strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--report" && has_value) options.report_sec = atof(argv[++i]);
+		else
+		{
+			options.model_filename.clear();
+			break;
+		}
+	}
+	if (options.model_filename.empty() || options.socket_path.empty() == (options.port <= 0) || options.max_batch == 0 || options.max_queue == 0)
+	{
+		cerr << "Usage: " << argv[0] << " --model FILE (--socket PATH | --port N) [--workers N] [--max-batch N] [--max-delay US] [--max-queue N] [--report SECONDS]" << endl;
+		return 2;
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = request_stop;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	signal(SIGPIPE, SIG_IGN); // closed connections are seen as failed writes
+
+	try {
+		Server server(options);
+		int listen_fd = options.socket_path.empty() ? listen_tcp(options.port) : listen_unix(options.socket_path);
+		server.run(listen_fd);
+		close(listen_fd);
+		if (!options.socket_path.empty())
+			unlink(options.socket_path.c_str());
+	}
+	catch (exception& e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
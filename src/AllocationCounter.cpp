@@ -0,0 +1,131 @@
+/**
+ * Project NNlight
+ */
+
+#include "AllocationCounter.h"
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+/**
+ * AllocationCounter implementation
+ *
+ * The replaced operator new bumps a thread local counter, so counting costs no synchronization and the allocations of other threads
+ * (e.g. parallel sessions) do not show up in the counts of a training thread. The total is kept in a relaxed atomic.
+ */
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define NNLIGHT_THREAD_LOCAL __declspec(thread)
+#else
+#define NNLIGHT_THREAD_LOCAL thread_local
+#endif
+
+namespace NNlight {
+
+namespace {
+
+NNLIGHT_THREAD_LOCAL uint64_t thread_allocations;
+std::atomic<uint64_t> total_allocations(0);
+
+}
+
+/**
+ * True if the allocations are counted.
+ * @return bool
+ */
+bool AllocationCounter::enabled()
+{
+#ifdef NNLIGHT_COUNT_ALLOCATIONS
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * Number of allocations made by the calling thread since it started.
+ * @return uint64_t
+ */
+uint64_t AllocationCounter::thread_count()
+{
+	return thread_allocations;
+}
+
+/**
+ * Number of allocations made by all threads since the program started.
+ * @return uint64_t
+ */
+uint64_t AllocationCounter::total_count()
+{
+	return total_allocations.load(std::memory_order_relaxed);
+}
+
+}
+
+#ifdef NNLIGHT_COUNT_ALLOCATIONS
+
+namespace {
+
+void* counted_malloc(size_t size)
+{
+	++NNlight::thread_allocations;
+	NNlight::total_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (size == 0)
+		size = 1;
+	for (;;)
+	{
+		void* ptr = std::malloc(size);
+		if (ptr)
+			return ptr;
+		std::new_handler handler = std::set_new_handler(nullptr);
+		std::set_new_handler(handler);
+		if (!handler)
+			return nullptr;
+		handler();
+	}
+}
+
+}
+
+void* operator new(size_t size)
+{
+	void* ptr = counted_malloc(size);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size)
+{
+	void* ptr = counted_malloc(size);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw()
+{
+	try {
+		return counted_malloc(size);
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw()
+{
+	try {
+		return counted_malloc(size);
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+void operator delete(void* ptr) throw() { std::free(ptr); }
+void operator delete[](void* ptr) throw() { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) throw() { std::free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) throw() { std::free(ptr); }
+
+#endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _ALLOCATIONCOUNTER_H
+#define _ALLOCATIONCOUNTER_H
+
+#include <cstdint>
+
+namespace NNlight {
+
+/**
+ * Counts the heap allocations made through the global operator new. The counting operator new is only compiled in if NNLIGHT_COUNT_ALLOCATIONS
+ * is defined (CMake option NNLIGHT_COUNT_ALLOCATIONS), as it replaces the allocator of the whole program; otherwise the counts stay zero.
+ * Used to check that the training and inference loops do not allocate once warmed up (see EpochProfile::nallocs).
+ */
+class AllocationCounter
+{
+public:
+	/**
+	 * True if the allocations are counted.
+	 */
+	static bool enabled();
+
+	/**
+	 * Number of allocations made by the calling thread since it started.
+	 */
+	static uint64_t thread_count();
+
+	/**
+	 * Number of allocations made by all threads since the program started.
+	 */
+	static uint64_t total_count();
+
+private:
+	AllocationCounter(); // not instantiable
+};
+
+}
+
+#endif //_ALLOCATIONCOUNTER_H
\ No newline at end of file
@@ -0,0 +1,286 @@
+/**
+ * Project NNlight
+ */
+
+#include "Checkpoint.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/**
+ * Checkpoint implementation
+ *
+ * Binary checkpoint files of the training state: a magic string, version and byte order tag, followed by the fields of
+ * TrainingState. Vectors are prefixed with their length.
+ */
+
+namespace NNlight {
+
+static const char checkpoint_magic[8] = { 'N', 'N', 'L', 'C', 'K', 'P', 'T', '\0' };
+static const uint32_t checkpoint_version = 5;
+static const uint32_t checkpoint_endian_tag = 0x01020304;
+
+TrainingState::TrainingState()
+	: train_ratio(0), batch_mode(false), nrestart(0), epoch(0),
+	prev_train_err(0), prev_test_err(0), delta_train_err(0), delta_test_err(0),
+	best_test_err(0), best_train_err(0), best_epoch(0), ntrain(0), data_fingerprint(0)
+{}
+
+/**
+ * Computes a fingerprint of the training data.
+ * @param input
+ * @param desired_output
+ */
+uint64_t fingerprint(const vector<vector<double>>& input, const vector<vector<double>>& desired_output)
+{
+	uint64_t hash = 14695981039346656037ULL; // FNV-1a
+	auto add = [&hash] (const void* bytes, size_t size) {
+		auto p = static_cast<const unsigned char*>(bytes);
+		for (size_t i = 0; i < size; ++i)
+			hash = (hash ^ p[i]) * 1099511628211ULL;
+	};
+	uint64_t nsamples = input.size();
+	add(&nsamples, sizeof(nsamples));
+	for (size_t i = 0; i < input.size(); ++i)
+	{
+		if (!input[i].empty()) add(&input[i][0], input[i].size() * sizeof(double));
+		if (i < desired_output.size() && !desired_output[i].empty())
+			add(&desired_output[i][0], desired_output[i].size() * sizeof(double));
+	}
+	return hash;
+}
+
+// helpers to write and read plain values & length-prefixed vectors
+
+static void put(FILE* f, const void* data, size_t size)
+{
+	if (size && std::fwrite(data, 1, size, f) != size)
+		throw std::runtime_error("Cannot write checkpoint file!");
+}
+
+template <typename T>
+static void put_value(FILE* f, T value)
+{
+	put(f, &value, sizeof(value));
+}
+
+template <typename T>
+static void put_vector(FILE* f, const vector<T>& values)
+{
+	put_value<uint64_t>(f, values.size());
+	if (!values.empty()) put(f, &values[0], values.size() * sizeof(T));
+}
+
+static void get(FILE* f, void* data, size_t size)
+{
+	if (size && std::fread(data, 1, size, f) != size)
+		throw std::runtime_error("Checkpoint file is truncated!");
+}
+
+template <typename T>
+static T get_value(FILE* f)
+{
+	T value;
+	get(f, &value, sizeof(value));
+	return value;
+}
+
+template <typename T>
+static void get_vector(FILE* f, vector<T>& values)
+{
+	auto size = get_value<uint64_t>(f);
+	if (size > (uint64_t(1) << 40) / sizeof(T))
+		throw std::runtime_error("Checkpoint file is corrupt!");
+	values.resize(static_cast<size_t>(size));
+	if (!values.empty()) get(f, &values[0], values.size() * sizeof(T));
+}
+
+/**
+ * Writes the state to a temporary file, then renames it to the given name. Either the old or the new checkpoint is found on disk, never a partial one.
+ * @param filename
+ * @param state
+ */
+void write_checkpoint(const string& filename, const TrainingState& state)
+{
+	string tmp_filename = filename + ".tmp";
+	FILE* f = std::fopen(tmp_filename.c_str(), "wb");
+	if (!f)
+		throw std::runtime_error("Cannot open temporary checkpoint file!");
+	try {
+		put(f, checkpoint_magic, sizeof(checkpoint_magic));
+		put_value(f, checkpoint_version);
+		put_value(f, checkpoint_endian_tag);
+		put_value<uint64_t>(f, state.data_fingerprint);
+		put_value(f, state.train_ratio);
+		put_value<uint8_t>(f, state.batch_mode ? 1 : 0);
+		put_value<uint64_t>(f, state.nrestart);
+		put_value<uint64_t>(f, state.epoch);
+		put_value(f, state.prev_train_err);
+		put_value(f, state.prev_test_err);
+		put_value(f, state.delta_train_err);
+		put_value(f, state.delta_test_err);
+		vector<uint8_t> increasing(state.test_err_is_increasing.begin(), state.test_err_is_increasing.end());
+		put_vector(f, increasing);
+		put_value(f, state.best_test_err);
+		put_value(f, state.best_train_err);
+		put_value<uint64_t>(f, state.best_epoch);
+		put_vector(f, state.best_weights);
+		vector<uint64_t> gen_state(RandomGenerator::state_size);
+		state.gen.get_state(gen_state.data());
+		put_vector(f, gen_state);
+		state.init_gen.get_state(gen_state.data());
+		put_vector(f, gen_state);
+		vector<uint64_t> order(state.order.begin(), state.order.end());
+		put_vector(f, order);
+		put_value<uint64_t>(f, state.ntrain);
+		put_vector(f, state.weights);
+		put_vector(f, state.rprop_state);
+		put_vector(f, state.trainer_state);
+
+		// make sure data is on disk before the rename makes it visible
+		if (std::fflush(f) != 0)
+			throw std::runtime_error("Cannot write checkpoint file!");
+#ifdef _WIN32
+		_commit(_fileno(f));
+#else
+		fsync(fileno(f));
+#endif
+	}
+	catch (...)
+	{
+		std::fclose(f);
+		std::remove(tmp_filename.c_str());
+		throw;
+	}
+	if (std::fclose(f) != 0)
+		throw std::runtime_error("Cannot write checkpoint file!");
+
+#ifdef _WIN32
+	if (!MoveFileExA(tmp_filename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+#else
+	if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0)
+#endif
+		throw std::runtime_error("Cannot rename temporary checkpoint file!");
+}
+
+/**
+ * Reads a checkpoint written by write_checkpoint.
+ * @param filename
+ * @param state
+ */
+void read_checkpoint(const string& filename, TrainingState& state)
+{
+	FILE* f = std::fopen(filename.c_str(), "rb");
+	if (!f)
+		throw std::runtime_error("Cannot open checkpoint file!");
+	try {
+		char magic[sizeof(checkpoint_magic)];
+		get(f, magic, sizeof(magic));
+		if (std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0)
+			throw std::runtime_error("Not an NNlight checkpoint file!");
+		if (get_value<uint32_t>(f) != checkpoint_version)
+			throw std::runtime_error("Unsupported checkpoint file version!");
+		if (get_value<uint32_t>(f) != checkpoint_endian_tag)
+			throw std::runtime_error("Checkpoint file was written on a machine with different byte order!");
+		state.data_fingerprint = get_value<uint64_t>(f);
+		state.train_ratio = get_value<double>(f);
+		state.batch_mode = get_value<uint8_t>(f) != 0;
+		state.nrestart = static_cast<size_t>(get_value<uint64_t>(f));
+		state.epoch = static_cast<size_t>(get_value<uint64_t>(f));
+		state.prev_train_err = get_value<double>(f);
+		state.prev_test_err = get_value<double>(f);
+		state.delta_train_err = get_value<double>(f);
+		state.delta_test_err = get_value<double>(f);
+		vector<uint8_t> increasing;
+		get_vector(f, increasing);
+		state.test_err_is_increasing.assign(increasing.begin(), increasing.end());
+		state.best_test_err = get_value<double>(f);
+		state.best_train_err = get_value<double>(f);
+		state.best_epoch = static_cast<size_t>(get_value<uint64_t>(f));
+		get_vector(f, state.best_weights);
+		vector<uint64_t> gen_state;
+		get_vector(f, gen_state);
+		if (gen_state.size() != RandomGenerator::state_size)
+			throw std::runtime_error("Checkpoint file is corrupt, invalid random generator state!");
+		state.gen.set_state(gen_state.data());
+		get_vector(f, gen_state);
+		if (gen_state.size() != RandomGenerator::state_size)
+			throw std::runtime_error("Checkpoint file is corrupt, invalid random generator state!");
+		state.init_gen.set_state(gen_state.data());
+		vector<uint64_t> order;
+		get_vector(f, order);
+		state.order.assign(order.begin(), order.end());
+		state.ntrain = static_cast<size_t>(get_value<uint64_t>(f));
+		get_vector(f, state.weights);
+		get_vector(f, state.rprop_state);
+		get_vector(f, state.trainer_state);
+	}
+	catch (...)
+	{
+		std::fclose(f);
+		throw;
+	}
+	std::fclose(f);
+	if (state.ntrain > state.order.size())
+		throw std::runtime_error("Checkpoint file is corrupt!");
+}
+
+/**
+ * @param filename_ checkpoint file to (over)write
+ */
+CheckpointWriter::CheckpointWriter(const string& filename_)
+	: filename(filename_)
+{}
+
+/**
+ * Waits for the last checkpoint to be written.
+ */
+CheckpointWriter::~CheckpointWriter()
+{
+	wait();
+}
+
+/**
+ * Starts writing the given state, after the previous checkpoint is finished. The state is taken over, leaving the argument empty.
+ * Returns the error message if writing the previous checkpoint failed, otherwise an empty string.
+ * @param state snapshot of the training state
+ */
+string CheckpointWriter::write(TrainingState& state)
+{
+	string prev_error = wait();
+	pending = std::move(state);
+	state = TrainingState();
+	worker = std::thread([this] () {
+		try {
+			write_checkpoint(filename, pending);
+		}
+		catch (std::exception& e)
+		{
+			error = e.what();
+		}
+	});
+	return prev_error;
+}
+
+/**
+ * Waits for the last checkpoint to be written. Returns the error message if writing failed, otherwise an empty string.
+ */
+string CheckpointWriter::wait()
+{
+	if (worker.joinable())
+		worker.join();
+	string err;
+	err.swap(error);
+	return err;
+}
+
+}
@@ -0,0 +1,140 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <cstdint>
+#include "RandomGenerator.h"
+
+using std::vector;
+using std::deque;
+using std::string;
+
+namespace NNlight {
+
+/**
+ * Everything NeuronNetwork::train keeps between two epochs. Together with the training data, this is enough to continue a
+ * training exactly where it was left off.
+ */
+struct TrainingState
+{
+	TrainingState();
+
+	double train_ratio;
+	bool batch_mode;
+	/**
+	 * Index of the current training session (restart).
+	 */
+	size_t nrestart;
+	/**
+	 * Number of completed epochs in the current training session.
+	 */
+	size_t epoch;
+	double prev_train_err, prev_test_err;
+	double delta_train_err, delta_test_err;
+	deque<bool> test_err_is_increasing;
+	/**
+	 * Lowest test error of the current session, the train error and the number of completed epochs at that time.
+	 */
+	double best_test_err, best_train_err;
+	size_t best_epoch;
+	/**
+	 * Weights of the network when the lowest test error was measured, see NeuronNetwork::get_weights. Sized once per training.
+	 */
+	vector<double> best_weights;
+	/**
+	 * Random generator used for shuffling, and the one used for weight initialization, split off it before it is used, so the initial weights
+	 * do not depend on the number of samples shuffled and the other way around.
+	 */
+	RandomGenerator gen, init_gen;
+	/**
+	 * Sample indices in the current order, the first ntrain of them are training samples, the rest are test samples.
+	 */
+	vector<size_t> order;
+	size_t ntrain;
+	/**
+	 * Identifies the training data, so a checkpoint is not resumed with other data.
+	 */
+	uint64_t data_fingerprint;
+	/**
+	 * Weights of the network, see NeuronNetwork::get_weights. Only filled for checkpoints.
+	 */
+	vector<double> weights;
+	/**
+	 * Rprop state of all neurons, one after the other in network order. Only filled for checkpoints.
+	 */
+	vector<double> rprop_state;
+	/**
+	 * State of the full-batch trainer, see FullBatchTrainer::get_state. Only filled for checkpoints.
+	 */
+	vector<double> trainer_state;
+};
+
+/**
+ * Computes a fingerprint of the training data.
+ * @param input
+ * @param desired_output
+ */
+uint64_t fingerprint(const vector<vector<double>>& input, const vector<vector<double>>& desired_output);
+
+/**
+ * Writes the state to a temporary file, then renames it to the given name. Either the old or the new checkpoint is found on disk, never a partial one.
+ * @param filename
+ * @param state
+ */
+void write_checkpoint(const string& filename, const TrainingState& state);
+
+/**
+ * Reads a checkpoint written by write_checkpoint.
+ * @param filename
+ * @param state
+ */
+void read_checkpoint(const string& filename, TrainingState& state);
+
+/**
+ * Writes checkpoints on a background thread, so training continues while the file is written.
+ */
+class CheckpointWriter
+{
+public:
+	/**
+	 * @param filename_ checkpoint file to (over)write
+	 */
+	explicit CheckpointWriter(const string& filename_);
+
+	/**
+	 * Waits for the last checkpoint to be written.
+	 */
+	~CheckpointWriter();
+
+	/**
+	 * Starts writing the given state, after the previous checkpoint is finished. The state is taken over, leaving the argument empty.
+	 * Returns the error message if writing the previous checkpoint failed, otherwise an empty string.
+	 * @param state snapshot of the training state
+	 */
+	string write(TrainingState& state);
+
+	/**
+	 * Waits for the last checkpoint to be written. Returns the error message if writing failed, otherwise an empty string.
+	 */
+	string wait();
+
+private:
+	CheckpointWriter(const CheckpointWriter&); // not copyable
+	CheckpointWriter& operator=(const CheckpointWriter&);
+
+	string filename;
+	TrainingState pending;
+	std::thread worker;
+	string error;
+};
+
+}
+
+#endif //_CHECKPOINT_H
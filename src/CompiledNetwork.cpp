@@ -0,0 +1,594 @@
+/**
+ * Project NNlight
+ */
+
+#include "CompiledNetwork.h"
+#include "NeuronNetwork.h"
+#include <fstream>
+#include <iomanip>
+#include <cctype>
+#include <cstring>
+#include <queue>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+ * CompiledNetwork implementation
+ *
+ * Represents a network flattened into a single buffer: neuron records in topological order and contiguous weight blocks.
+ * The buffer has the exact layout of the binary model file, so compiling, saving and mapping share the same code path.
+ */
+
+namespace NNlight {
+
+using namespace ModelFormat;
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * Compiles the neurons of the network into a flat, read-only model held in memory. The network is not modified.
+ * @param network
+ */
+CompiledNetwork::CompiledNetwork(const NeuronNetwork& network)
+	: mapped(nullptr), mapped_size(0), file_handle(nullptr), mapping_handle(nullptr), inference_stats(nullptr), softmax_output(false)
+{
+	const auto& neurons = network.neurons;
+	const size_t nneurons = neurons.size();
+
+	// number neurons in the order they were added to the network
+	unordered_map<const Neuron*, uint32_t> ids;
+	ids.reserve(nneurons);
+	for (size_t i = 0; i < nneurons; ++i)
+		ids[neurons[i].get()] = static_cast<uint32_t>(i);
+	vector<uint32_t> kinds(nneurons, HIDDEN_NEURON);
+	for (auto& in : network.inputs) kinds[ids[in.get()]] = INPUT_NEURON;
+	for (auto& out : network.outputs) kinds[ids[out.get()]] = OUTPUT_NEURON;
+
+	// topological order, neurons without pending inputs are taken in the order they were added
+	vector<size_t> nwaiting(nneurons, 0);
+	vector<vector<uint32_t>> consumers(nneurons);
+	for (size_t i = 0; i < nneurons; ++i)
+	{
+		if (kinds[i] == INPUT_NEURON)
+			continue;
+		for (auto& in : neurons[i]->get_input_neurons())
+		{
+			auto it = ids.find(in.get());
+			if (it == ids.end())
+				throw std::runtime_error("Neuron is connected to a neuron that is not added to the network!");
+			consumers[it->second].push_back(static_cast<uint32_t>(i));
+			++nwaiting[i];
+		}
+	}
+	vector<uint32_t> order;
+	vector<uint32_t> position(nneurons);
+	order.reserve(nneurons);
+	std::queue<uint32_t> ready;
+	for (size_t i = 0; i < nneurons; ++i)
+		if (nwaiting[i] == 0) ready.push(static_cast<uint32_t>(i));
+	while (!ready.empty())
+	{
+		uint32_t i = ready.front();
+		ready.pop();
+		position[i] = static_cast<uint32_t>(order.size());
+		order.push_back(i);
+		for (auto consumer : consumers[i])
+			if (--nwaiting[consumer] == 0) ready.push(consumer);
+	}
+	if (order.size() != nneurons)
+		throw std::runtime_error("Network contains a cycle, it cannot be compiled!");
+
+	// lay out the sections, each weight block starts on a block_alignment boundary
+	const uint64_t block_slots = block_alignment / sizeof(double);
+	vector<uint64_t> first_weight(nneurons);
+	uint64_t nweights = 0;
+	for (size_t n = 0; n < nneurons; ++n)
+	{
+		first_weight[n] = nweights;
+		if (kinds[order[n]] != INPUT_NEURON)
+			nweights += align_up(neurons[order[n]]->get_input_neurons().size(), block_slots);
+	}
+	Header h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, magic, sizeof(h.magic));
+	h.version = version;
+	h.endian_tag = endian_tag;
+	h.nneurons = static_cast<uint32_t>(nneurons);
+	h.ninputs = static_cast<uint32_t>(network.inputs.size());
+	h.noutputs = static_cast<uint32_t>(network.outputs.size());
+	h.nweights = nweights;
+	h.neurons_offset = sizeof(Header);
+	h.input_ids_offset = h.neurons_offset + nneurons * sizeof(NeuronRecord);
+	h.output_ids_offset = h.input_ids_offset + h.ninputs * sizeof(uint32_t);
+	h.sources_offset = h.output_ids_offset + h.noutputs * sizeof(uint32_t);
+	h.weights_offset = align_up(h.sources_offset + nweights * sizeof(uint32_t), block_alignment);
+	h.file_size = h.weights_offset + nweights * sizeof(double);
+
+	// fill the buffer
+	storage.assign(static_cast<size_t>(h.file_size) + block_alignment, 0);
+	char* base = &storage[0] + (block_alignment - reinterpret_cast<uintptr_t>(&storage[0]) % block_alignment) % block_alignment;
+	std::memcpy(base, &h, sizeof(h));
+	auto recs = reinterpret_cast<NeuronRecord*>(base + h.neurons_offset);
+	auto sources_ = reinterpret_cast<uint32_t*>(base + h.sources_offset);
+	auto weights_ = reinterpret_cast<double*>(base + h.weights_offset);
+	std::fill(sources_, sources_ + nweights, no_source);
+	for (size_t n = 0; n < nneurons; ++n)
+	{
+		const auto& neur = neurons[order[n]];
+		auto& rec = recs[n];
+		rec.kind = kinds[order[n]];
+		rec.activation = rec.kind == INPUT_NEURON ? IDENTITY : rec.kind == OUTPUT_NEURON && network.softmax_output ? SOFTMAX
+			: neur->linear_activation ? IDENTITY : SIGMOID; // linear hidden neurons: pooling (see PoolNeuron)
+		rec.first_weight = first_weight[n];
+		rec.biasweight = neur->get_biasweight();
+		if (rec.kind == INPUT_NEURON)
+			continue;
+		const auto& ins = neur->get_input_neurons();
+		rec.ninputs = static_cast<uint32_t>(ins.size());
+		for (size_t k = 0; k < ins.size(); ++k)
+			sources_[rec.first_weight + k] = position[ids[ins[k].get()]];
+		std::copy(neur->get_input_weights().begin(), neur->get_input_weights().end(), weights_ + rec.first_weight);
+	}
+	auto in_ids_ = reinterpret_cast<uint32_t*>(base + h.input_ids_offset);
+	for (auto& in : network.inputs) *in_ids_++ = position[ids[in.get()]];
+	auto out_ids_ = reinterpret_cast<uint32_t*>(base + h.output_ids_offset);
+	for (auto& out : network.outputs) *out_ids_++ = position[ids[out.get()]];
+
+	attach(base, static_cast<size_t>(h.file_size));
+}
+
+/**
+ * Maps a model file written by NeuronNetwork::save() or save() into memory. The model is query-ready right away, weights are read from the mapping when used.
+ * Only the header and the neuron records are checked, call verify() if the file is not trusted.
+ * @param filename
+ */
+CompiledNetwork::CompiledNetwork(const string& filename)
+	: mapped(nullptr), mapped_size(0), file_handle(nullptr), mapping_handle(nullptr), inference_stats(nullptr), softmax_output(false)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Cannot open model file!");
+	file_handle = file;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart < static_cast<LONGLONG>(sizeof(Header)))
+	{
+		unmap();
+		throw std::runtime_error("Model file is too short!");
+	}
+	mapping_handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping_handle)
+		mapped = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+	mapped_size = static_cast<size_t>(size.QuadPart);
+	if (!mapped)
+	{
+		unmap();
+		throw std::runtime_error("Cannot map model file!");
+	}
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Cannot open model file!");
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header)))
+	{
+		close(fd);
+		throw std::runtime_error("Model file is too short!");
+	}
+	void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping stays valid
+	if (view == MAP_FAILED)
+		throw std::runtime_error("Cannot map model file!");
+	mapped = view;
+	mapped_size = static_cast<size_t>(st.st_size);
+#endif
+	try {
+		attach(static_cast<const char*>(mapped), mapped_size);
+	}
+	catch (...)
+	{
+		unmap();
+		throw;
+	}
+}
+
+CompiledNetwork::~CompiledNetwork()
+{
+	unmap();
+}
+
+/**
+ * Writes the model to a binary file that can be mapped or loaded into a NeuronNetwork later.
+ * @param filename
+ */
+void CompiledNetwork::save(const string& filename) const
+{
+	std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+	if (!file)
+		throw std::runtime_error("Cannot open model file for writing!");
+	file.write(data, static_cast<std::streamsize>(head->file_size));
+	if (!file)
+		throw std::runtime_error("Cannot write model file!");
+}
+
+/**
+ * Writes the model as a self-contained C++11 header: the weights in an aligned constant array and a fully unrolled evaluate() function,
+ * in a namespace of the given name, without any dependency on NNlight. The generated code computes the same outputs as test(), but its size
+ * grows with the number of weights, so it is meant for small networks.
+ * @param filename
+ * @param name namespace of the generated code, a C++ identifier
+ */
+void CompiledNetwork::export_header(const string& filename, const string& name) const
+{
+	if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+		throw std::runtime_error("Name of the exported network is not a C++ identifier!");
+	for (size_t i = 0; i < name.size(); ++i)
+		if (!std::isalnum(static_cast<unsigned char>(name[i])) && name[i] != '_')
+			throw std::runtime_error("Name of the exported network is not a C++ identifier!");
+
+	std::ofstream file(filename.c_str(), std::ios::trunc);
+	if (!file)
+		throw std::runtime_error("Cannot open header file for writing!");
+	file << std::setprecision(17);
+
+	string guard = "NNLIGHT_GENERATED_";
+	for (size_t i = 0; i < name.size(); ++i)
+		guard += static_cast<char>(std::toupper(static_cast<unsigned char>(name[i])));
+	guard += "_H";
+
+	file << "/**\n"
+		<< " * Generated by NNlight from a network of " << head->nneurons << " neurons, " << head->ninputs << " inputs and " << head->noutputs << " outputs.\n"
+		<< " * Self-contained, needs C++11. Do not edit.\n"
+		<< " */\n\n"
+		<< "#ifndef " << guard << "\n"
+		<< "#define " << guard << "\n\n"
+		<< "#include <cmath>\n"
+		<< "#include <cstddef>\n\n"
+		<< "namespace " << name << " {\n\n"
+		<< "static const std::size_t num_of_inputs = " << head->ninputs << ";\n"
+		<< "static const std::size_t num_of_outputs = " << head->noutputs << ";\n\n";
+
+	// weights of the non-input neurons in topological order, each neuron its bias followed by its input weights
+	file << "alignas(64) static const double weights[] = {";
+	size_t nweights = 0;
+	for (uint32_t n = 0; n < head->nneurons; ++n)
+	{
+		const auto& rec = records[n];
+		if (rec.kind == INPUT_NEURON)
+			continue;
+		for (uint32_t k = 0; k <= rec.ninputs; ++k, ++nweights)
+		{
+			const double w = k == 0 ? rec.biasweight : wghts[rec.first_weight + k - 1];
+			if (!std::isfinite(w))
+				throw std::runtime_error("Cannot export a network with non-finite weights!");
+			file << (nweights % 4 == 0 ? "\n\t" : " ") << w << ",";
+		}
+	}
+	if (nweights == 0)
+		file << "\n\t0.0,";
+	file << "\n};\n\n";
+
+	file << "static inline double sigmoid(double x)\n"
+		<< "{\n"
+		<< "\treturn 1.0 / (1.0 + std::exp(-x));\n"
+		<< "}\n\n";
+
+	file << "/**\n"
+		<< " * Evaluates the network for num_of_inputs input values, writes num_of_outputs output values.\n"
+		<< " */\n"
+		<< "static inline void evaluate(const double* input, double* output)\n"
+		<< "{\n";
+	vector<int64_t> input_index(head->nneurons, -1);
+	for (uint32_t i = 0; i < head->ninputs; ++i)
+		input_index[in_ids[i]] = i;
+	size_t widx = 0;
+	for (uint32_t n = 0; n < head->nneurons; ++n)
+	{
+		const auto& rec = records[n];
+		file << "\tconst double a" << n << " = ";
+		if (rec.kind == INPUT_NEURON)
+		{
+			if (input_index[n] >= 0)
+				file << "input[" << input_index[n] << "];\n";
+			else
+				file << "0.0;\n";
+			continue;
+		}
+		// same order of summation as evaluate(): bias first, then the inputs in slot order
+		const bool sigmoid = rec.activation == SIGMOID;
+		if (sigmoid)
+			file << "sigmoid(";
+		file << "weights[" << widx++ << "]";
+		const uint32_t* src = srcs + rec.first_weight;
+		for (uint32_t k = 0; k < rec.ninputs; ++k)
+			file << ((k + 1) % 4 == 0 ? "\n\t\t+ " : " + ") << "weights[" << widx++ << "] * a" << src[k];
+		file << (sigmoid ? ");\n" : ";\n");
+	}
+	if (softmax_output && head->noutputs > 0)
+	{
+		file << "\tdouble max_value = a" << out_ids[0] << ";\n";
+		for (uint32_t o = 1; o < head->noutputs; ++o)
+			file << "\tif (a" << out_ids[o] << " > max_value) max_value = a" << out_ids[o] << ";\n";
+		for (uint32_t o = 0; o < head->noutputs; ++o)
+			file << "\tconst double e" << o << " = std::exp(a" << out_ids[o] << " - max_value);\n";
+		file << "\tconst double exp_sum = 0.0";
+		for (uint32_t o = 0; o < head->noutputs; ++o)
+			file << " + e" << o;
+		file << ";\n";
+		for (uint32_t o = 0; o < head->noutputs; ++o)
+			file << "\toutput[" << o << "] = e" << o << " / exp_sum;\n";
+	}
+	else
+	{
+		for (uint32_t o = 0; o < head->noutputs; ++o)
+			file << "\toutput[" << o << "] = a" << out_ids[o] << ";\n";
+	}
+	file << "}\n\n";
+
+	file << "/**\n"
+		<< " * Evaluates the network for nsamples inputs stored one after the other.\n"
+		<< " */\n"
+		<< "static inline void evaluate(const double* input, std::size_t nsamples, double* output)\n"
+		<< "{\n"
+		<< "\tfor (std::size_t s = 0; s < nsamples; ++s, input += num_of_inputs, output += num_of_outputs)\n"
+		<< "\t\tevaluate(input, output);\n"
+		<< "}\n\n"
+		<< "}\n\n"
+		<< "#endif // " << guard << "\n";
+	if (!file)
+		throw std::runtime_error("Cannot write header file!");
+}
+
+/**
+ * Checks every source id of the model, throws if any of them is out of range or violates the topological order.
+ */
+void CompiledNetwork::verify() const
+{
+	for (uint32_t i = 0; i < head->ninputs; ++i)
+		if (records[in_ids[i]].kind != INPUT_NEURON)
+			throw std::runtime_error("Model input id does not refer to an input neuron!");
+	for (uint32_t n = 0; n < head->nneurons; ++n)
+	{
+		const uint32_t* src = srcs + records[n].first_weight;
+		for (uint32_t k = 0; k < records[n].ninputs; ++k)
+			if (src[k] >= n)
+				throw std::runtime_error("Model is corrupt, source id is out of order!");
+	}
+}
+
+/**
+ * Evaluates the model for the given input. The output vector is filled with as many elements as the number of output neurons.
+ * Uses a scratch buffer of the model, so do not call it concurrently on the same instance.
+ * @param input
+ * @param output
+ */
+void CompiledNetwork::test(const vector<double>& input, vector<double>& output)
+{
+	NNLIGHT_TIME_INFERENCE(inference_stats, 1);
+
+	if (input.size() < head->ninputs)
+		throw std::runtime_error("Not enough input values!");
+	output.resize(head->noutputs);
+	evaluate(input.data(), output.data(), activations.data());
+}
+
+/**
+ * Evaluates the model for the given input, using the given scratch buffer of num_of_neurons() elements for the activations.
+ * Can be called concurrently with distinct scratch buffers.
+ * @param input num_of_inputs() values
+ * @param output num_of_outputs() values are written here
+ * @param activations scratch buffer
+ */
+void CompiledNetwork::test(const double* input, double* output, double* activations) const
+{
+	NNLIGHT_TIME_INFERENCE(inference_stats, 1);
+
+	evaluate(input, output, activations);
+}
+
+/**
+ * Evaluates the model for each of the given inputs. The outputs are resized to the number of inputs, each filled with as many elements as the number of output neurons.
+ * Uses a scratch buffer of the model, so do not call it concurrently on the same instance. Recorded as a single call of a batch by the inference statistics.
+ * @param input
+ * @param output
+ */
+void CompiledNetwork::test(const vector<vector<double>>& input, vector<vector<double>>& output)
+{
+	NNLIGHT_TIME_INFERENCE(inference_stats, input.size());
+
+	for (auto& in : input)
+		if (in.size() < head->ninputs)
+			throw std::runtime_error("Not enough input values!");
+	output.resize(input.size());
+	for (size_t s = 0; s < input.size(); ++s)
+	{
+		output[s].resize(head->noutputs);
+		evaluate(input[s].data(), output[s].data(), activations.data());
+	}
+}
+
+/**
+ * Evaluates the model for nsamples inputs stored one after the other, using the given scratch buffer of num_of_neurons() elements for the activations.
+ * Can be called concurrently with distinct scratch buffers. Recorded as a single call of a batch by the inference statistics.
+ * @param input nsamples * num_of_inputs() values
+ * @param nsamples
+ * @param output nsamples * num_of_outputs() values are written here
+ * @param activations scratch buffer
+ */
+void CompiledNetwork::test(const double* input, size_t nsamples, double* output, double* activations) const
+{
+	NNLIGHT_TIME_INFERENCE(inference_stats, nsamples);
+
+	for (size_t s = 0; s < nsamples; ++s)
+		evaluate(input + s * head->ninputs, output + s * head->noutputs, activations);
+}
+
+/**
+ * Records the latency and batch size of every test() call to the given statistics, also of concurrent calls.
+ * The statistics are not owned and have to outlive the calls. Set them to nullptr (default) to turn collecting off.
+ * Nothing is recorded if NNLIGHT_NO_PROFILING is defined.
+ * @param stats_
+ */
+void CompiledNetwork::collect_inference_stats(InferenceStats* stats_)
+{
+	inference_stats = stats_;
+}
+
+/**
+ * Evaluates the model for a single input, like test(), without recording it to the inference statistics.
+ * @param input
+ * @param output
+ * @param activations
+ */
+void CompiledNetwork::evaluate(const double* input, double* output, double* activations) const
+{
+	for (uint32_t i = 0; i < head->ninputs; ++i)
+		activations[in_ids[i]] = input[i];
+	for (uint32_t n = 0; n < head->nneurons; ++n)
+	{
+		const auto& rec = records[n];
+		if (rec.kind == INPUT_NEURON)
+			continue;
+		const uint32_t* src = srcs + rec.first_weight;
+		const double* w = wghts + rec.first_weight;
+		double act = rec.biasweight;
+		for (uint32_t k = 0; k < rec.ninputs; ++k)
+			act += w[k] * activations[src[k]];
+		activations[n] = activate(rec.activation, act);
+	}
+	for (uint32_t o = 0; o < head->noutputs; ++o)
+		output[o] = activations[out_ids[o]];
+	if (softmax_output)
+		softmax(output, head->noutputs);
+}
+
+size_t CompiledNetwork::num_of_neurons() const { return head->nneurons; }
+size_t CompiledNetwork::num_of_inputs() const { return head->ninputs; }
+size_t CompiledNetwork::num_of_outputs() const { return head->noutputs; }
+bool CompiledNetwork::has_softmax_output() const { return softmax_output; }
+
+const Header& CompiledNetwork::header() const { return *head; }
+const NeuronRecord* CompiledNetwork::neuron_records() const { return records; }
+const uint32_t* CompiledNetwork::input_ids() const { return in_ids; }
+const uint32_t* CompiledNetwork::output_ids() const { return out_ids; }
+const uint32_t* CompiledNetwork::sources() const { return srcs; }
+const double* CompiledNetwork::weights() const { return wghts; }
+
+/**
+ * Applies the given activation function.
+ * @param activation ModelFormat::Activation
+ * @param x
+ */
+double CompiledNetwork::activate(uint32_t activation, double x)
+{
+	if (activation == SIGMOID)
+		return 1.0 / (1.0 + std::exp(-x));
+	return x;
+}
+
+/**
+ * Normalizes the given values by softmax in place, subtracting the largest value before exponentiating so large values do not overflow.
+ * @param values
+ * @param n
+ */
+void CompiledNetwork::softmax(double* values, size_t n)
+{
+	if (n == 0)
+		return;
+	const double max_value = *std::max_element(values, values + n);
+	double exp_sum = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		values[i] = std::exp(values[i] - max_value);
+		exp_sum += values[i];
+	}
+	for (size_t i = 0; i < n; ++i)
+		values[i] /= exp_sum;
+}
+
+/**
+ * Checks the header and the neuron records, then sets the section pointers.
+ * @param data_
+ * @param size
+ */
+void CompiledNetwork::attach(const char* data_, size_t size)
+{
+	if (size < sizeof(Header))
+		throw std::runtime_error("Model file is too short!");
+	auto h = reinterpret_cast<const Header*>(data_);
+	if (std::memcmp(h->magic, magic, sizeof(magic)) != 0)
+		throw std::runtime_error("Not an NNlight model file!");
+	if (h->version < min_version || h->version > version)
+		throw std::runtime_error("Unsupported model file version!");
+	if (h->endian_tag != endian_tag)
+		throw std::runtime_error("Model file was written on a machine with different byte order!");
+	if (h->file_size != size
+		|| h->neurons_offset != sizeof(Header)
+		|| h->input_ids_offset != h->neurons_offset + uint64_t(h->nneurons) * sizeof(NeuronRecord)
+		|| h->output_ids_offset != h->input_ids_offset + uint64_t(h->ninputs) * sizeof(uint32_t)
+		|| h->sources_offset != h->output_ids_offset + uint64_t(h->noutputs) * sizeof(uint32_t)
+		|| h->weights_offset < h->sources_offset + h->nweights * sizeof(uint32_t)
+		|| h->weights_offset % block_alignment != 0
+		|| h->file_size != h->weights_offset + h->nweights * sizeof(double))
+		throw std::runtime_error("Model file is corrupt, invalid section offsets!");
+
+	data = data_;
+	head = h;
+	records = reinterpret_cast<const NeuronRecord*>(data + h->neurons_offset);
+	in_ids = reinterpret_cast<const uint32_t*>(data + h->input_ids_offset);
+	out_ids = reinterpret_cast<const uint32_t*>(data + h->output_ids_offset);
+	srcs = reinterpret_cast<const uint32_t*>(data + h->sources_offset);
+	wghts = reinterpret_cast<const double*>(data + h->weights_offset);
+
+	const uint32_t max_activation = h->version >= 2 ? SOFTMAX : SIGMOID; // softmax was added by version 2
+	for (uint32_t n = 0; n < h->nneurons; ++n)
+	{
+		const auto& rec = records[n];
+		if (rec.kind > OUTPUT_NEURON || rec.activation > max_activation || (rec.activation == SOFTMAX && rec.kind != OUTPUT_NEURON)
+			|| rec.first_weight + rec.ninputs > h->nweights)
+			throw std::runtime_error("Model file is corrupt, invalid neuron record!");
+	}
+	for (uint32_t i = 0; i < h->ninputs; ++i)
+		if (in_ids[i] >= h->nneurons)
+			throw std::runtime_error("Model file is corrupt, invalid input id!");
+	for (uint32_t o = 0; o < h->noutputs; ++o)
+		if (out_ids[o] >= h->nneurons)
+			throw std::runtime_error("Model file is corrupt, invalid output id!");
+	softmax_output = h->noutputs > 0 && records[out_ids[0]].activation == SOFTMAX;
+	for (uint32_t o = 0; o < h->noutputs; ++o)
+		if ((records[out_ids[o]].activation == SOFTMAX) != softmax_output)
+			throw std::runtime_error("Model file is corrupt, softmax is applied to some outputs only!");
+
+	activations.assign(h->nneurons, 0.0);
+}
+
+/**
+ * Releases the file mapping, if any.
+ */
+void CompiledNetwork::unmap()
+{
+#ifdef _WIN32
+	if (mapped) UnmapViewOfFile(mapped);
+	if (mapping_handle) CloseHandle(mapping_handle);
+	if (file_handle) CloseHandle(file_handle);
+	file_handle = mapping_handle = nullptr;
+#else
+	if (mapped) munmap(mapped, mapped_size);
+#endif
+	mapped = nullptr;
+	mapped_size = 0;
+}
+
+}
@@ -0,0 +1,197 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _COMPILEDNETWORK_H
+#define _COMPILEDNETWORK_H
+
+#include <vector>
+#include <string>
+#include "ModelFormat.h"
+#include "InferenceStats.h"
+
+using std::vector;
+using std::string;
+
+namespace NNlight {
+
+class NeuronNetwork;
+
+class CompiledNetwork
+{
+public:
+	/**
+	 * Compiles the neurons of the network into a flat, read-only model held in memory. The network is not modified.
+	 * @param network
+	 */
+	explicit CompiledNetwork(const NeuronNetwork& network);
+
+	/**
+	 * Maps a model file written by NeuronNetwork::save() or save() into memory. The model is query-ready right away, weights are read from the mapping when used.
+	 * Only the header and the neuron records are checked, call verify() if the file is not trusted.
+	 * @param filename
+	 */
+	explicit CompiledNetwork(const string& filename);
+
+	~CompiledNetwork();
+
+	/**
+	 * Writes the model to a binary file that can be mapped or loaded into a NeuronNetwork later.
+	 * @param filename
+	 */
+	void save(const string& filename) const;
+
+	/**
+	 * Writes the model as a self-contained C++11 header: the weights in an aligned constant array and a fully unrolled evaluate() function,
+	 * in a namespace of the given name, without any dependency on NNlight. The generated code computes the same outputs as test(), but its size
+	 * grows with the number of weights, so it is meant for small networks.
+	 * @param filename
+	 * @param name namespace of the generated code, a C++ identifier
+	 */
+	void export_header(const string& filename, const string& name) const;
+
+	/**
+	 * Checks every source id of the model, throws if any of them is out of range or violates the topological order.
+	 */
+	void verify() const;
+
+	/**
+	 * Evaluates the model for the given input. The output vector is filled with as many elements as the number of output neurons.
+	 * Uses a scratch buffer of the model, so do not call it concurrently on the same instance.
+	 * @param input
+	 * @param output
+	 */
+	void test(const vector<double>& input, vector<double>& output);
+
+	/**
+	 * Evaluates the model for the given input, using the given scratch buffer of num_of_neurons() elements for the activations.
+	 * Can be called concurrently with distinct scratch buffers.
+	 * @param input num_of_inputs() values
+	 * @param output num_of_outputs() values are written here
+	 * @param activations scratch buffer
+	 */
+	void test(const double* input, double* output, double* activations) const;
+
+	/**
+	 * Evaluates the model for each of the given inputs. The outputs are resized to the number of inputs, each filled with as many elements as the number of output neurons.
+	 * Uses a scratch buffer of the model, so do not call it concurrently on the same instance. Recorded as a single call of a batch by the inference statistics.
+	 * @param input
+	 * @param output
+	 */
+	void test(const vector<vector<double>>& input, vector<vector<double>>& output);
+
+	/**
+	 * Evaluates the model for nsamples inputs stored one after the other, using the given scratch buffer of num_of_neurons() elements for the activations.
+	 * Can be called concurrently with distinct scratch buffers. Recorded as a single call of a batch by the inference statistics.
+	 * @param input nsamples * num_of_inputs() values
+	 * @param nsamples
+	 * @param output nsamples * num_of_outputs() values are written here
+	 * @param activations scratch buffer
+	 */
+	void test(const double* input, size_t nsamples, double* output, double* activations) const;
+
+	/**
+	 * Records the latency and batch size of every test() call to the given statistics, also of concurrent calls.
+	 * The statistics are not owned and have to outlive the calls. Set them to nullptr (default) to turn collecting off.
+	 * Nothing is recorded if NNLIGHT_NO_PROFILING is defined.
+	 * @param stats_
+	 */
+	void collect_inference_stats(InferenceStats* stats_);
+
+	size_t num_of_neurons() const;
+	size_t num_of_inputs() const;
+	size_t num_of_outputs() const;
+
+	/**
+	 * True if the outputs are normalized by softmax (see NeuronNetwork::use_softmax_output).
+	 */
+	bool has_softmax_output() const;
+
+	/**
+	 * Direct access to the sections of the model, see ModelFormat.h for the layout.
+	 */
+	const ModelFormat::Header& header() const;
+	const ModelFormat::NeuronRecord* neuron_records() const;
+	const uint32_t* input_ids() const;
+	const uint32_t* output_ids() const;
+	const uint32_t* sources() const;
+	const double* weights() const;
+
+	/**
+	 * Applies the given activation function.
+	 * @param activation ModelFormat::Activation
+	 * @param x
+	 */
+	static double activate(uint32_t activation, double x);
+
+	/**
+	 * Normalizes the given values by softmax in place, subtracting the largest value before exponentiating so large values do not overflow.
+	 * @param values
+	 * @param n
+	 */
+	static void softmax(double* values, size_t n);
+
+private:
+	CompiledNetwork(const CompiledNetwork&); // not copyable
+	CompiledNetwork& operator=(const CompiledNetwork&);
+
+	/**
+	 * Checks the header and the neuron records, then sets the section pointers.
+	 * @param data_
+	 * @param size
+	 */
+	void attach(const char* data_, size_t size);
+
+	/**
+	 * Releases the file mapping, if any.
+	 */
+	void unmap();
+
+	/**
+	 * Evaluates the model for a single input, like test(), without recording it to the inference statistics.
+	 * @param input
+	 * @param output
+	 * @param activations
+	 */
+	void evaluate(const double* input, double* output, double* activations) const;
+
+	/**
+	 * Holds the model when it is compiled in memory. Extra space is reserved so the model can start on a block_alignment boundary.
+	 */
+	vector<char> storage;
+	/**
+	 * Mapped view of the model file.
+	 */
+	void* mapped;
+	size_t mapped_size;
+	/**
+	 * Native handles of the mapping, used on Windows only.
+	 */
+	void* file_handle;
+	void* mapping_handle;
+
+	const char* data;
+	const ModelFormat::Header* head;
+	const ModelFormat::NeuronRecord* records;
+	const uint32_t* in_ids;
+	const uint32_t* out_ids;
+	const uint32_t* srcs;
+	const double* wghts;
+
+	/**
+	 * Scratch buffer for the activations of all neurons.
+	 */
+	vector<double> activations;
+	/**
+	 * Statistics of the test() calls, not owned. Null if not collected.
+	 */
+	InferenceStats* inference_stats;
+	/**
+	 * Set if the output neurons have SOFTMAX activation.
+	 */
+	bool softmax_output;
+};
+
+}
+
+#endif //_COMPILEDNETWORK_H
@@ -0,0 +1,345 @@
+/**
+ * Project NNlight
+ */
+
+#include "Conv1D.h"
+#include <algorithm>
+#include <stdexcept>
+
+/**
+ * Conv1D implementation
+ *
+ * A convolution layer is built of ordinary neurons, each connected to its own receptive field, so the forward pass is the direct convolution over
+ * contiguous slices of the input layer, and the compiled and saved forms of the network need no special treatment. Weight sharing only affects
+ * learning: the neurons of a filter add their gradients to the filter instead of learning, and the weights are updated once all of them did.
+ */
+
+namespace NNlight {
+
+/**
+ * Creates a convolution neuron, not tied to a filter yet.
+ * @param learning_rate_
+ * @param regularization_
+ */
+ConvNeuron::ConvNeuron(double learning_rate_, double regularization_)
+	: Neuron(learning_rate_, regularization_)
+{
+	tied_weights = true;
+}
+
+/**
+ * Sums the errors backpropagated from the output neurons. When all of them have arrived, adds the gradients of the neuron to the filter and
+ * backpropagates the error to the input neurons; the last neuron of the filter to do so updates the shared weights.
+ * @param from
+ * @param err
+ */
+void ConvNeuron::backpropagate(NeuronPtr from, double err)
+{
+	if (!filter)
+	{
+		Neuron::backpropagate(from, err);
+		return;
+	}
+	error_sum += err; // already multiplied by output weight
+	if (++nerrors_received < output_neurons.size())
+		return;
+	const double delta = error_sum;
+	error_sum = 0;
+	nerrors_received = 0;
+
+	// the first neuron of a backpropagation counts the neurons to wait for, neurons without output neurons get no error
+	Filter& f = *filter;
+	if (f.nreports == 0)
+	{
+		f.nexpected = 0;
+		for (auto unit : f.units)
+			if (!unit->output_neurons.empty())
+				++f.nexpected;
+	}
+
+	// same gradients as Neuron::learn, the regularization term is added once by update_filter()
+	f.bias_grad += delta;
+	const double sum_delta = linear_activation ? delta : delta * activation * (1.0 - activation); // derivative of the sigmoid
+	if (sparse_pass)
+		for (auto& in : active_inputs)
+			f.grads[in.first] += in.second * sum_delta;
+	else
+		for (size_t i = 0; i < input_weights.size(); ++i)
+			f.grads[i] += input_neurons[i]->activation * sum_delta;
+	if (!has_sparse_inputs())
+	{
+		auto self = shared_from_this();
+		for (size_t i = 0; i < input_weights.size(); ++i)
+			input_neurons[i]->backpropagate(self, delta * input_weights[i]); // multiplied by input weight
+	}
+	if (++f.nreports == f.nexpected)
+		f.units[0]->update_filter();
+}
+
+/**
+ * Randomizes the shared weights if this is the first neuron of the filter, and writes them to the other neurons of the filter.
+ * The other neurons only clear their inputs and errors.
+ * @param gen
+ * @param lower_bound
+ * @param upper_bound
+ */
+void ConvNeuron::reset(RandomGenerator& gen, double lower_bound, double upper_bound)
+{
+	if (filter && filter->units[0] != this)
+	{
+		clear_propagation();
+		activation = 0;
+		rprop.reset();
+		return;
+	}
+	Neuron::reset(gen, lower_bound, upper_bound);
+	if (filter)
+	{
+		std::fill(filter->grads.begin(), filter->grads.end(), 0.0);
+		filter->bias_grad = 0;
+		filter->nreports = 0;
+		share_weights();
+	}
+}
+
+/**
+ * Creates an unconnected copy of the neuron with the same weights and learning parameters, tied to the filter of the original neuron
+ * until replace_shared() is called.
+ * @return NeuronPtr
+ */
+NeuronPtr ConvNeuron::clone() const
+{
+	return clone_as<ConvNeuron>();
+}
+
+/**
+ * Ties the copies of the neurons of the filter of the original neuron into a filter of their own.
+ * @param copies copy of each neuron of the network
+ */
+void ConvNeuron::replace_shared(const unordered_map<const Neuron*, NeuronPtr>& copies)
+{
+	if (!filter)
+		return;
+	auto leader = copies.find(filter->units[0]);
+	if (leader == copies.end() || leader->second.get() != this)
+		return; // tied by the copy of the first neuron of the filter
+
+	auto copied = std::make_shared<Filter>(*filter);
+	for (auto& unit : copied->units)
+	{
+		auto it = copies.find(unit);
+		if (it == copies.end())
+			throw std::runtime_error("Neuron shares its weights with a neuron that is not added to the network!");
+		unit = static_cast<ConvNeuron*>(it->second.get());
+	}
+	std::fill(copied->grads.begin(), copied->grads.end(), 0.0);
+	copied->bias_grad = 0;
+	copied->nreports = 0;
+	for (auto unit : copied->units)
+		unit->filter = copied;
+}
+
+/**
+ * Ties the given neurons into a filter sharing the weights of the first one. Each of them has to have as many input neurons as the first one,
+ * each input aligned with the same input of the first one.
+ * @param units
+ */
+void ConvNeuron::tie(const vector<shared_ptr<ConvNeuron>>& units)
+{
+	if (units.empty())
+		return;
+	auto f = std::make_shared<Filter>();
+	const size_t ninputs = units[0]->input_weights.size();
+	for (auto& unit : units)
+	{
+		if (unit->input_weights.size() != ninputs)
+			throw std::runtime_error("Neurons of a filter have to have the same number of inputs!");
+		f->units.push_back(unit.get());
+	}
+	f->grads.assign(ninputs, 0.0);
+	f->bias_grad = 0;
+	f->nreports = f->nexpected = 0;
+	for (auto& unit : units)
+		unit->filter = f;
+	units[0]->share_weights();
+}
+
+/**
+ * Applies the summed gradients of the filter to the shared weights the way Neuron::learn does, and writes them to every neuron of the filter.
+ */
+void ConvNeuron::update_filter()
+{
+	Filter& f = *filter;
+	if (use_rprop) biasweight += rprop(f.bias_grad);
+	else biasweight -= learning_rate * f.bias_grad;
+	for (size_t i = 0; i < input_weights.size(); ++i)
+	{
+		auto grad = f.grads[i] - regularization * input_weights[i];
+		if (use_rprop) input_weights[i] += rprop(i, grad);
+		else input_weights[i] -= learning_rate * grad;
+		f.grads[i] = 0;
+	}
+	f.bias_grad = 0;
+	f.nreports = 0;
+	share_weights();
+}
+
+/**
+ * Writes the weights of this neuron to the other neurons of its filter.
+ */
+void ConvNeuron::share_weights()
+{
+	for (auto unit : filter->units)
+	{
+		if (unit == this)
+			continue;
+		unit->biasweight = biasweight;
+		std::copy(input_weights.begin(), input_weights.end(), unit->input_weights.begin());
+	}
+}
+
+/**
+ * Creates a pooling neuron.
+ * @param learning_rate_ not used
+ * @param regularization_ not used
+ */
+PoolNeuron::PoolNeuron(double learning_rate_, double regularization_)
+	: Neuron(learning_rate_, regularization_)
+{
+	linear_activation = true;
+	tied_weights = true;
+	biasweight = 0;
+}
+
+/**
+ * Sums the errors backpropagated from the output neurons, and passes them to the input neurons when all of them have arrived.
+ * @param from
+ * @param err
+ */
+void PoolNeuron::backpropagate(NeuronPtr from, double err)
+{
+	error_sum += err; // already multiplied by output weight
+	if (++nerrors_received < output_neurons.size())
+		return;
+	const double delta = error_sum;
+	error_sum = 0;
+	nerrors_received = 0;
+	if (has_sparse_inputs())
+		return;
+
+	auto self = shared_from_this();
+	for (size_t i = 0; i < input_weights.size(); ++i)
+		input_neurons[i]->backpropagate(self, delta * input_weights[i]); // multiplied by input weight
+}
+
+/**
+ * Keeps the fixed weights, only clears the inputs and errors.
+ * @param gen
+ * @param lower_bound
+ * @param upper_bound
+ */
+void PoolNeuron::reset(RandomGenerator& gen, double lower_bound, double upper_bound)
+{
+	clear_propagation();
+	activation = 0;
+}
+
+/**
+ * Creates an unconnected copy of the neuron.
+ * @return NeuronPtr
+ */
+NeuronPtr PoolNeuron::clone() const
+{
+	return clone_as<PoolNeuron>();
+}
+
+/**
+ * Sets the weights to average the input neurons. Call after the input neurons are connected.
+ */
+void PoolNeuron::average_inputs()
+{
+	biasweight = 0;
+	std::fill(input_weights.begin(), input_weights.end(), input_weights.empty() ? 0.0 : 1.0 / input_weights.size());
+}
+
+/**
+ * Creates a 1D convolution layer over the given input layer, a sequence of positions of nchannels values each, ordered by position, then by channel.
+ * Each of the nfilters filters is applied at every stride-th position where kernel_size positions fit (no padding), by a ConvNeuron connected to the
+ * kernel_size * nchannels inputs there. The neurons of a filter share their weights, so the layer has nfilters * (kernel_size * nchannels + 1)
+ * parameters whatever the length of the sequence. If pool_size is above 1, the outputs of each filter are averaged over non-overlapping windows of
+ * pool_size positions by PoolNeurons; positions not filling a last window are left out. Add the conv and pool neurons to the network, and connect the
+ * output neurons further, e.g. by Neuron::connect_layers or as the input of another convolution layer of nfilters channels.
+ * @param input_layer
+ * @param nchannels values per position of the input
+ * @param kernel_size positions covered by a filter
+ * @param nfilters number of filters, the channels of the output
+ * @param stride distance of the positions the filters are applied at
+ * @param pool_size positions averaged by a pooling neuron, 1 for no pooling
+ * @param init scheme of the initial weights
+ * @param learning_rate_ learning rate of the filters
+ * @param regularization_ regularization of the filters
+ * @return Conv1DLayer
+ */
+Conv1DLayer make_conv1d_layer(const vector<NeuronPtr>& input_layer, size_t nchannels, size_t kernel_size, size_t nfilters, size_t stride,
+	size_t pool_size, Neuron::WeightInit init, double learning_rate_, double regularization_)
+{
+	if (nchannels == 0 || kernel_size == 0 || nfilters == 0 || stride == 0 || pool_size == 0)
+		throw std::runtime_error("Parameters of a convolution layer have to be positive!");
+	if (input_layer.size() % nchannels != 0)
+		throw std::runtime_error("Size of the input layer is not a multiple of the number of channels!");
+	const size_t length = input_layer.size() / nchannels;
+	if (kernel_size > length)
+		throw std::runtime_error("Kernel of the convolution is longer than the input sequence!");
+	size_t nconv_positions = (length - kernel_size) / stride + 1;
+	if (pool_size > nconv_positions)
+		throw std::runtime_error("Pooling window is longer than the output of the convolution!");
+	nconv_positions -= nconv_positions % pool_size;
+
+	// the receptive field of a position is a contiguous slice of the input layer, connected to the neurons of all filters there
+	Conv1DLayer layer;
+	layer.conv.reserve(nconv_positions * nfilters);
+	vector<NeuronPtr> field, units(nfilters);
+	for (size_t p = 0; p < nconv_positions; ++p)
+	{
+		auto first = input_layer.begin() + p * stride * nchannels;
+		field.assign(first, first + kernel_size * nchannels);
+		for (size_t f = 0; f < nfilters; ++f)
+		{
+			auto unit = make_neuron<ConvNeuron>(learning_rate_, regularization_);
+			layer.conv.push_back(unit);
+			units[f] = unit;
+		}
+		Neuron::connect_layers(field, units, init);
+	}
+	vector<ConvNeuronPtr> filter_units(nconv_positions);
+	for (size_t f = 0; f < nfilters; ++f)
+	{
+		for (size_t p = 0; p < nconv_positions; ++p)
+			filter_units[p] = layer.conv[p * nfilters + f];
+		ConvNeuron::tie(filter_units);
+	}
+
+	if (pool_size == 1)
+	{
+		layer.output.assign(layer.conv.begin(), layer.conv.end());
+		layer.noutput_positions = nconv_positions;
+		return layer;
+	}
+	layer.noutput_positions = nconv_positions / pool_size;
+	layer.pool.reserve(layer.noutput_positions * nfilters);
+	for (size_t p = 0; p < layer.noutput_positions; ++p)
+	{
+		for (size_t f = 0; f < nfilters; ++f)
+		{
+			auto pool = make_neuron<PoolNeuron>(learning_rate_, regularization_);
+			for (size_t k = 0; k < pool_size; ++k)
+				Neuron::connect(layer.conv[(p * pool_size + k) * nfilters + f], pool);
+			pool->average_inputs();
+			layer.pool.push_back(pool);
+		}
+	}
+	layer.output.assign(layer.pool.begin(), layer.pool.end());
+	return layer;
+}
+
+}
\ No newline at end of file
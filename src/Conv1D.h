@@ -0,0 +1,208 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _CONV1D_H
+#define _CONV1D_H
+
+#include "Neuron.h"
+
+namespace NNlight {
+
+/**
+ * Neuron of a 1D convolution layer: the output of a filter at one position of the input sequence (see make_conv1d_layer). The neurons of a filter
+ * share their weights and bias. Each of them keeps a copy of the shared weights, so propagation, compiling, saving and cloning work as for any neuron,
+ * but the weights are updated once per backpropagation, by the gradients of all the neurons of the filter, and the update is written to every copy.
+ * The first neuron of the filter holds the learning parameters and the Rprop state of the filter.
+ */
+class ConvNeuron : public Neuron
+{
+public:
+	/**
+	 * Creates a convolution neuron, not tied to a filter yet.
+	 * @param learning_rate_
+	 * @param regularization_
+	 */
+	ConvNeuron(double learning_rate_ = def_learning_rate, double regularization_ = def_regularization);
+
+	/**
+	 * Sums the errors backpropagated from the output neurons. When all of them have arrived, adds the gradients of the neuron to the filter and
+	 * backpropagates the error to the input neurons; the last neuron of the filter to do so updates the shared weights.
+	 * @param from
+	 * @param err
+	 */
+	void backpropagate(NeuronPtr from, double err);
+
+	using Neuron::reset;
+
+	/**
+	 * Randomizes the shared weights if this is the first neuron of the filter, and writes them to the other neurons of the filter.
+	 * The other neurons only clear their inputs and errors.
+	 * @param gen
+	 * @param lower_bound
+	 * @param upper_bound
+	 */
+	void reset(RandomGenerator& gen, double lower_bound, double upper_bound);
+
+	/**
+	 * Creates an unconnected copy of the neuron with the same weights and learning parameters, tied to the filter of the original neuron
+	 * until replace_shared() is called.
+	 */
+	NeuronPtr clone() const;
+
+	/**
+	 * Ties the copies of the neurons of the filter of the original neuron into a filter of their own.
+	 * @param copies copy of each neuron of the network
+	 */
+	void replace_shared(const unordered_map<const Neuron*, NeuronPtr>& copies);
+
+	/**
+	 * Ties the given neurons into a filter sharing the weights of the first one. Each of them has to have as many input neurons as the first one,
+	 * each input aligned with the same input of the first one.
+	 * @param units
+	 */
+	static void tie(const vector<shared_ptr<ConvNeuron>>& units);
+
+private:
+	/**
+	 * Neurons sharing their weights, and the gradients summed over them during a backpropagation.
+	 */
+	struct Filter
+	{
+		/**
+		 * Not owned, the neurons are kept alive by the network.
+		 */
+		vector<ConvNeuron*> units;
+		vector<double> grads;
+		double bias_grad;
+		/**
+		 * Neurons that have added their gradients, and the number of neurons expected to: the ones having output neurons.
+		 */
+		size_t nreports, nexpected;
+	};
+
+	/**
+	 * Applies the summed gradients of the filter to the shared weights the way Neuron::learn does, and writes them to every neuron of the filter.
+	 */
+	void update_filter();
+
+	/**
+	 * Writes the weights of this neuron to the other neurons of its filter.
+	 */
+	void share_weights();
+
+	shared_ptr<Filter> filter;
+};
+
+typedef shared_ptr<ConvNeuron> ConvNeuronPtr;
+
+/**
+ * Neuron of an average pooling layer: outputs the mean of its input neurons, by fixed weights, no bias and no nonlinear function.
+ * Passes the error back to its input neurons without learning.
+ */
+class PoolNeuron : public Neuron
+{
+public:
+	/**
+	 * Creates a pooling neuron.
+	 * @param learning_rate_ not used
+	 * @param regularization_ not used
+	 */
+	PoolNeuron(double learning_rate_ = def_learning_rate, double regularization_ = def_regularization);
+
+	/**
+	 * Sums the errors backpropagated from the output neurons, and passes them to the input neurons when all of them have arrived.
+	 * @param from
+	 * @param err
+	 */
+	void backpropagate(NeuronPtr from, double err);
+
+	using Neuron::reset;
+
+	/**
+	 * Keeps the fixed weights, only clears the inputs and errors.
+	 * @param gen
+	 * @param lower_bound
+	 * @param upper_bound
+	 */
+	void reset(RandomGenerator& gen, double lower_bound, double upper_bound);
+
+	/**
+	 * Creates an unconnected copy of the neuron.
+	 */
+	NeuronPtr clone() const;
+
+	/**
+	 * Sets the weights to average the input neurons. Call after the input neurons are connected.
+	 */
+	void average_inputs();
+};
+
+typedef shared_ptr<PoolNeuron> PoolNeuronPtr;
+
+/**
+ * Neurons of a 1D convolution layer, see make_conv1d_layer.
+ */
+struct Conv1DLayer
+{
+	/**
+	 * Convolution neurons, ordered by position, then by filter.
+	 */
+	vector<ConvNeuronPtr> conv;
+	/**
+	 * Pooling neurons, ordered by position, then by filter. Empty without pooling.
+	 */
+	vector<PoolNeuronPtr> pool;
+	/**
+	 * The pooling neurons, or the convolution neurons without pooling: a sequence of noutput_positions positions with a channel per filter,
+	 * ordered by position, then by filter.
+	 */
+	vector<NeuronPtr> output;
+	size_t noutput_positions;
+};
+
+/**
+ * Creates a 1D convolution layer over the given input layer, a sequence of positions of nchannels values each, ordered by position, then by channel.
+ * Each of the nfilters filters is applied at every stride-th position where kernel_size positions fit (no padding), by a ConvNeuron connected to the
+ * kernel_size * nchannels inputs there. The neurons of a filter share their weights, so the layer has nfilters * (kernel_size * nchannels + 1)
+ * parameters whatever the length of the sequence. If pool_size is above 1, the outputs of each filter are averaged over non-overlapping windows of
+ * pool_size positions by PoolNeurons; positions not filling a last window are left out. Add the conv and pool neurons to the network, and connect the
+ * output neurons further, e.g. by Neuron::connect_layers or as the input of another convolution layer of nfilters channels.
+ * @param input_layer
+ * @param nchannels values per position of the input
+ * @param kernel_size positions covered by a filter
+ * @param nfilters number of filters, the channels of the output
+ * @param stride distance of the positions the filters are applied at
+ * @param pool_size positions averaged by a pooling neuron, 1 for no pooling
+ * @param init scheme of the initial weights
+ * @param learning_rate_ learning rate of the filters
+ * @param regularization_ regularization of the filters
+ */
+Conv1DLayer make_conv1d_layer(const vector<NeuronPtr>& input_layer, size_t nchannels, size_t kernel_size, size_t nfilters, size_t stride = 1,
+	size_t pool_size = 1, Neuron::WeightInit init = Neuron::UNIFORM_INIT, double learning_rate_ = Neuron::def_learning_rate,
+	double regularization_ = Neuron::def_regularization);
+
+/**
+ * Creates a 1D convolution layer over an input layer made by make_layer(n) or by another make_conv1d_layer(). See above.
+ * @param input_layer
+ * @param nchannels values per position of the input
+ * @param kernel_size positions covered by a filter
+ * @param nfilters number of filters, the channels of the output
+ * @param stride distance of the positions the filters are applied at
+ * @param pool_size positions averaged by a pooling neuron, 1 for no pooling
+ * @param init scheme of the initial weights
+ * @param learning_rate_ learning rate of the filters
+ * @param regularization_ regularization of the filters
+ */
+template <typename NeuronPtrType>
+Conv1DLayer make_conv1d_layer(const vector<NeuronPtrType>& input_layer, size_t nchannels, size_t kernel_size, size_t nfilters, size_t stride = 1,
+	size_t pool_size = 1, Neuron::WeightInit init = Neuron::UNIFORM_INIT, double learning_rate_ = Neuron::def_learning_rate,
+	double regularization_ = Neuron::def_regularization)
+{
+	return make_conv1d_layer(vector<NeuronPtr>(input_layer.begin(), input_layer.end()), nchannels, kernel_size, nfilters, stride, pool_size, init,
+		learning_rate_, regularization_);
+}
+
+}
+
+#endif //_CONV1D_H
\ No newline at end of file
@@ -0,0 +1,981 @@
+/**
+ * Project NNlight
+ */
+
+#include "FullBatchTrainer.h"
+#include "NeuronNetwork.h"
+#include <unordered_map>
+#include <queue>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+/**
+ * FullBatchTrainer implementation
+ *
+ * The network is flattened once per session into nodes in topological order, so the error and its gradient can be computed in a forward and a
+ * backward pass over arrays, with the parameters taken from a vector instead of the neurons. The optimizers only see the parameter vector.
+ * In float or bfloat16 precision the passes work on a float copy of the parameters, so the optimizers keep updating the double parameters:
+ * small steps are not lost to rounding, and the next copy picks them up once they add up.
+ * The samples are propagated in blocks, and the weights of a layer are walked in tiles of columns, the gradient and the derivatives by the sources
+ * computed in the same walk, so wide layers are read from memory once per block instead of twice per sample.
+ */
+
+namespace NNlight {
+
+namespace {
+
+double dot(const vector<double>& a, const vector<double>& b)
+{
+	double sum = 0;
+	for (size_t i = 0; i < a.size(); ++i)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+/**
+ * Rounds a float to the nearest bfloat16 (the upper 16 bits of the float), ties to even. Infinities and NaNs are kept.
+ */
+float to_bfloat16(float x)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &x, sizeof(bits));
+	if ((bits & 0x7F800000u) != 0x7F800000u)
+		bits += 0x7FFFu + ((bits >> 16) & 1u);
+	bits &= 0xFFFF0000u;
+	std::memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+/**
+ * Size of the values of the sources of a tile of a layer over a block of samples, about half of a common L1 data cache.
+ */
+const size_t tile_bytes = 16 * 1024;
+
+/**
+ * Sizes the buffers of a FullBatchTrainer::Pass for blocks of block_size samples.
+ */
+template <typename Pass>
+void allocate_pass(Pass& pass, size_t nneurons, size_t noutputs, size_t nparams, size_t block_size, bool copy_params)
+{
+	pass.params.assign(copy_params ? nparams : 0, 0);
+	pass.act.assign(nneurons * block_size, 0);
+	pass.dact.assign(nneurons * block_size, 0);
+	pass.dsum.assign(nneurons * block_size, 0);
+	pass.log_probs.assign(noutputs * block_size, 0);
+	pass.gradient.assign(nparams, 0);
+}
+
+/**
+ * Solves m x = b for a symmetric positive definite n x n matrix of which the upper triangle is given, by Cholesky decomposition.
+ * The matrix is overwritten by the decomposition, b by the solution.
+ * @return false if the matrix is not positive definite
+ */
+bool cholesky_solve(vector<double>& m, size_t n, vector<double>& b)
+{
+	// decompose to U^T U, U is stored in the upper triangle
+	for (size_t i = 0; i < n; ++i)
+	{
+		double d = m[i * n + i];
+		for (size_t k = 0; k < i; ++k)
+			d -= m[k * n + i] * m[k * n + i];
+		if (!(d > 0))
+			return false;
+		d = std::sqrt(d);
+		m[i * n + i] = d;
+		for (size_t j = i + 1; j < n; ++j)
+		{
+			double v = m[i * n + j];
+			for (size_t k = 0; k < i; ++k)
+				v -= m[k * n + i] * m[k * n + j];
+			m[i * n + j] = v / d;
+		}
+	}
+	// U^T z = b, then U x = z
+	for (size_t i = 0; i < n; ++i)
+	{
+		double v = b[i];
+		for (size_t k = 0; k < i; ++k)
+			v -= m[k * n + i] * b[k];
+		b[i] = v / m[i * n + i];
+	}
+	for (size_t i = n; i-- > 0; )
+	{
+		double v = b[i];
+		for (size_t k = i + 1; k < n; ++k)
+			v -= m[i * n + k] * b[k];
+		b[i] = v / m[i * n + i];
+	}
+	return true;
+}
+
+}
+
+const size_t FullBatchTrainer::no_input;
+const size_t FullBatchTrainer::block_size;
+
+/**
+ * Creates a trainer computing in the given precision.
+ * @param precision_
+ */
+FullBatchTrainer::FullBatchTrainer(Precision precision_)
+	: nparams(0), softmax_output(false), input(nullptr), desired_output(nullptr), samples(nullptr), nsamples(0), precision(precision_)
+{}
+
+FullBatchTrainer::~FullBatchTrainer() {}
+
+/**
+ * Prepares a training session of the network: flattens its topology and forgets the state of the previous session.
+ * Call again if neurons are added or connected.
+ * @param network
+ */
+void FullBatchTrainer::start(const NeuronNetwork& network)
+{
+	const auto& neurons = network.neurons;
+	const size_t nneurons = neurons.size();
+	unordered_map<const Neuron*, uint32_t> ids;
+	ids.reserve(nneurons);
+	for (size_t i = 0; i < nneurons; ++i)
+		ids[neurons[i].get()] = static_cast<uint32_t>(i);
+	vector<size_t> input_indices(nneurons, no_input);
+	for (size_t i = 0; i < network.inputs.size(); ++i)
+		input_indices[ids[network.inputs[i].get()]] = i;
+
+	// topological order, neurons without pending inputs are taken in the order they were added
+	vector<size_t> nwaiting(nneurons, 0);
+	vector<vector<uint32_t>> consumers(nneurons);
+	for (size_t i = 0; i < nneurons; ++i)
+	{
+		if (input_indices[i] != no_input)
+			continue;
+		if (neurons[i]->tied_weights)
+			throw std::runtime_error("Full-batch trainers do not support convolution and pooling neurons!");
+		for (auto& in : neurons[i]->get_input_neurons())
+		{
+			auto it = ids.find(in.get());
+			if (it == ids.end())
+				throw std::runtime_error("Neuron is connected to a neuron that is not added to the network!");
+			consumers[it->second].push_back(static_cast<uint32_t>(i));
+			++nwaiting[i];
+		}
+	}
+	vector<uint32_t> position(nneurons);
+	std::queue<uint32_t> ready;
+	for (size_t i = 0; i < nneurons; ++i)
+		if (nwaiting[i] == 0) ready.push(static_cast<uint32_t>(i));
+	nodes.clear();
+	nparams = 0;
+	while (!ready.empty())
+	{
+		uint32_t i = ready.front();
+		ready.pop();
+		position[i] = static_cast<uint32_t>(nodes.size());
+		Node node;
+		node.neuron = neurons[i].get();
+		node.input_index = input_indices[i];
+		node.ninputs = node.input_index == no_input ? node.neuron->get_input_neurons().size() : 0;
+		node.first_param = nparams;
+		node.linear = node.neuron->linear_activation;
+		if (node.input_index == no_input)
+			nparams += 1 + node.ninputs;
+		nodes.push_back(node);
+		for (auto consumer : consumers[i])
+			if (--nwaiting[consumer] == 0) ready.push(consumer);
+	}
+	if (nodes.size() != nneurons)
+		throw std::runtime_error("Network contains a cycle, it cannot be trained by a full-batch trainer!");
+
+	sources.assign(nparams, 0);
+	for (auto& node : nodes)
+	{
+		const uint32_t* src = &sources[node.first_param];
+		node.contiguous = true;
+		for (size_t k = 0; k < node.ninputs; ++k)
+		{
+			sources[node.first_param + 1 + k] = position[ids[node.neuron->get_input_neurons()[k].get()]];
+			node.contiguous = node.contiguous && (k == 0 || src[k + 1] == src[k] + 1);
+		}
+	}
+	layers.clear();
+	for (size_t n = 0; n < nodes.size(); ++n)
+	{
+		if (nodes[n].input_index != no_input)
+			continue;
+		if (!layers.empty() && layers.back().end_node == n)
+		{
+			const Node& prev = nodes[n - 1];
+			if (nodes[n].contiguous && prev.contiguous && nodes[n].ninputs == prev.ninputs
+				&& (nodes[n].ninputs == 0 || sources[nodes[n].first_param + 1] == sources[prev.first_param + 1]))
+			{
+				++layers.back().end_node;
+				continue;
+			}
+		}
+		Layer layer;
+		layer.first_node = n;
+		layer.end_node = n + 1;
+		layers.push_back(layer);
+	}
+	input_ids.resize(network.inputs.size());
+	for (size_t i = 0; i < network.inputs.size(); ++i)
+		input_ids[i] = position[ids[network.inputs[i].get()]];
+	output_ids.resize(network.outputs.size());
+	for (size_t o = 0; o < network.outputs.size(); ++o)
+		output_ids[o] = position[ids[network.outputs[o].get()]];
+	softmax_output = network.softmax_output;
+
+	if (precision == DOUBLE_PRECISION)
+		allocate_pass(double_pass, nneurons, output_ids.size(), nparams, block_size, false); // reads the parameters directly
+	else
+		allocate_pass(float_pass, nneurons, output_ids.size(), nparams, block_size, true);
+	params.assign(nparams, 0.0);
+	reset(nparams);
+}
+
+/**
+ * Makes one iteration of the optimizer on the given train samples, and updates the weights of the network by it.
+ * @param input
+ * @param desired_output
+ * @param samples indices of the train samples
+ * @param nsamples
+ * @return false if no step decreasing the error was found, the weights are unchanged then
+ */
+bool FullBatchTrainer::step(const vector<vector<double>>& input_, const vector<vector<double>>& desired_output_, const size_t* samples_, size_t nsamples_)
+{
+	if (nsamples_ == 0)
+		return false;
+	input = &input_;
+	desired_output = &desired_output_;
+	samples = samples_;
+	nsamples = nsamples_;
+
+	for (auto& node : nodes)
+	{
+		if (node.input_index != no_input)
+			continue;
+		params[node.first_param] = node.neuron->get_biasweight();
+		const auto& weights = node.neuron->get_input_weights();
+		std::copy(weights.begin(), weights.end(), params.begin() + node.first_param + 1);
+	}
+	if (!iterate(params))
+		return false;
+	for (auto& node : nodes)
+	{
+		if (node.input_index != no_input)
+			continue;
+		node.neuron->set_biasweight(params[node.first_param]);
+		node.neuron->set_input_weights(params.data() + node.first_param + 1);
+	}
+	return true;
+}
+
+/**
+ * Error of the network with the given parameters on the train samples of the step.
+ * @param params
+ * @return double
+ */
+double FullBatchTrainer::error(const vector<double>& params_)
+{
+	if (precision == DOUBLE_PRECISION)
+		return error(double_pass, params_.data());
+	round_params(params_);
+	return error(float_pass, float_pass.params.data());
+}
+
+/**
+ * Error of the network with the given parameters on the train samples of the step, and its gradient by the parameters.
+ * @param params
+ * @param gradient
+ * @return double
+ */
+double FullBatchTrainer::error_gradient(const vector<double>& params_, vector<double>& gradient)
+{
+	gradient.assign(nparams, 0.0);
+	if (precision == DOUBLE_PRECISION)
+		return error_gradient(double_pass, params_.data(), gradient.data());
+	// the gradient is accumulated in float, and only the sum is converted
+	round_params(params_);
+	std::fill(float_pass.gradient.begin(), float_pass.gradient.end(), 0.0f);
+	const double err = error_gradient(float_pass, float_pass.params.data(), float_pass.gradient.data());
+	std::copy(float_pass.gradient.begin(), float_pass.gradient.end(), gradient.begin());
+	return err;
+}
+
+/**
+ * Error of the network with the given parameters on the train samples of the step, as the sum of squared residuals (output - desired output,
+ * scaled), and the Gauss-Newton normal equations: the upper triangle of J^T J to hessian and J^T r to gradient, J being the Jacobian of the residuals.
+ * Squared error outputs only.
+ * @param params
+ * @param hessian nparams x nparams, row-major
+ * @param gradient
+ * @return double
+ */
+double FullBatchTrainer::normal_equations(const vector<double>& params_, vector<double>& hessian, vector<double>& gradient)
+{
+	if (softmax_output)
+		throw std::runtime_error("Levenberg-Marquardt needs squared error outputs, turn off softmax output first!");
+	hessian.assign(nparams * nparams, 0.0);
+	gradient.assign(nparams, 0.0);
+	if (precision == DOUBLE_PRECISION)
+		return normal_equations(double_pass, params_.data(), hessian, gradient);
+	round_params(params_);
+	return normal_equations(float_pass, float_pass.params.data(), hessian, gradient);
+}
+
+/**
+ * Returns the precision of the forward and backward passes.
+ * @return Precision
+ */
+FullBatchTrainer::Precision FullBatchTrainer::get_precision() const
+{
+	return precision;
+}
+
+/**
+ * Stores the state of the optimizer in the session, so a training resumed from a checkpoint continues it. Empty if the optimizer has no state.
+ * @param state
+ */
+void FullBatchTrainer::get_state(vector<double>& state) const
+{
+	state.clear();
+}
+
+/**
+ * Restores the state of the optimizer stored by get_state(), after start() of a session of the same network.
+ * @param state
+ */
+void FullBatchTrainer::set_state(const vector<double>& state)
+{
+	if (!state.empty())
+		throw std::runtime_error("Invalid state of the full-batch trainer!");
+}
+
+/**
+ * Copies the optimized parameters into the float pass, rounded to bfloat16 if computing in it.
+ * @param params
+ */
+void FullBatchTrainer::round_params(const vector<double>& params_)
+{
+	for (size_t i = 0; i < nparams; ++i)
+		float_pass.params[i] = static_cast<float>(params_[i]);
+	if (precision == BFLOAT16_PRECISION)
+		for (auto& p : float_pass.params)
+			p = to_bfloat16(p);
+}
+
+/**
+ * Error of the network with the given parameters on the train samples of the step, see error().
+ * @param pass
+ * @param params
+ * @return double
+ */
+template <typename Real>
+double FullBatchTrainer::error(Pass<Real>& pass, const Real* params_)
+{
+	double err = 0;
+	for (size_t b = 0; b < nsamples; b += block_size)
+	{
+		const size_t nblock = std::min(block_size, nsamples - b);
+		forward(pass, params_, samples + b, nblock);
+		for (size_t s = 0; s < nblock; ++s)
+			err += sample_error(pass, s, (*desired_output)[samples[b + s]]);
+	}
+	return err / nsamples;
+}
+
+/**
+ * Error of the network with the given parameters on the train samples of the step, and its gradient added to gradient, see error_gradient().
+ * @param pass
+ * @param params
+ * @param gradient
+ * @return double
+ */
+template <typename Real>
+double FullBatchTrainer::error_gradient(Pass<Real>& pass, const Real* params_, Real* gradient)
+{
+	const size_t nneurons = nodes.size();
+	double err = 0;
+	for (size_t b = 0; b < nsamples; b += block_size)
+	{
+		const size_t nblock = std::min(block_size, nsamples - b);
+		forward(pass, params_, samples + b, nblock);
+
+		// seed the derivatives of the mean error of all samples by the outputs, zero for the samples missing from the block
+		std::fill(pass.dact.begin(), pass.dact.end(), Real(0));
+		std::fill(pass.dsum.begin(), pass.dsum.end(), Real(0));
+		for (size_t s = 0; s < nblock; ++s)
+		{
+			const auto& dout = (*desired_output)[samples[b + s]];
+			err += sample_error(pass, s, dout);
+			const Real* act = &pass.act[s * nneurons];
+			if (softmax_output)
+			{
+				// cross-entropy through softmax: output * sum of desired outputs - desired output, by the sums
+				double dout_sum = 0;
+				for (auto d : dout)
+					dout_sum += d;
+				for (size_t o = 0; o < output_ids.size(); ++o)
+					pass.dsum[s * nneurons + output_ids[o]] += static_cast<Real>((act[output_ids[o]] * dout_sum - dout[o]) / nsamples);
+			}
+			else
+				for (size_t o = 0; o < output_ids.size(); ++o)
+					pass.dact[s * nneurons + output_ids[o]] += static_cast<Real>(2.0 * (act[output_ids[o]] - dout[o]) / (output_ids.size() * nsamples));
+		}
+		backward(pass, params_, gradient);
+	}
+	return err / nsamples;
+}
+
+/**
+ * Sum of squared residuals and the Gauss-Newton normal equations added to hessian and gradient, see normal_equations().
+ * The Jacobian rows are computed in the precision of the pass, the normal equations are summed in double.
+ * @param pass
+ * @param params
+ * @param hessian
+ * @param gradient
+ * @return double
+ */
+template <typename Real>
+double FullBatchTrainer::normal_equations(Pass<Real>& pass, const Real* params_, vector<double>& hessian, vector<double>& gradient)
+{
+	// the residuals are scaled so their sum of squares is the mean squared error
+	const double scale = 1.0 / std::sqrt(static_cast<double>(output_ids.size() * nsamples));
+	const size_t nneurons = nodes.size();
+	auto& jacobian_row = pass.gradient;
+	double err = 0;
+	for (size_t b = 0; b < nsamples; b += block_size)
+	{
+		const size_t nblock = std::min(block_size, nsamples - b);
+		forward(pass, params_, samples + b, nblock);
+		for (size_t s = 0; s < nblock; ++s)
+		{
+			const auto& dout = (*desired_output)[samples[b + s]];
+			for (size_t o = 0; o < output_ids.size(); ++o)
+			{
+				const size_t out = s * nneurons + output_ids[o];
+				const double residual = (pass.act[out] - dout[o]) * scale;
+				err += residual * residual;
+
+				// a row of the Jacobian by backpropagating the residual of a single output of a single sample of the block
+				std::fill(pass.dact.begin(), pass.dact.end(), Real(0));
+				std::fill(pass.dsum.begin(), pass.dsum.end(), Real(0));
+				std::fill(jacobian_row.begin(), jacobian_row.end(), Real(0));
+				pass.dact[out] = static_cast<Real>(scale);
+				backward(pass, params_, jacobian_row.data());
+				for (size_t i = 0; i < nparams; ++i)
+				{
+					const double ji = jacobian_row[i];
+					if (ji == 0.0) // rows are zero for the weights of the other outputs
+						continue;
+					gradient[i] += ji * residual;
+					double* row = &hessian[i * nparams];
+					for (size_t j = i; j < nparams; ++j)
+						row[j] += ji * jacobian_row[j];
+				}
+			}
+		}
+	}
+	return err;
+}
+
+/**
+ * Propagates a block of train samples through the flattened network into the activations of the pass, normalizing the outputs by softmax if set.
+ * The samples after nblock in the block get zero inputs.
+ * @param pass
+ * @param params
+ * @param block indices of the train samples
+ * @param nblock number of samples, at most block_size
+ */
+template <typename Real>
+void FullBatchTrainer::forward(Pass<Real>& pass, const Real* params_, const size_t* block, size_t nblock)
+{
+	const size_t nneurons = nodes.size();
+	const bool round = precision == BFLOAT16_PRECISION;
+	for (size_t s = 0; s < block_size; ++s)
+	{
+		Real* act = &pass.act[s * nneurons];
+		for (size_t i = 0; i < input_ids.size(); ++i)
+		{
+			act[input_ids[i]] = s < nblock ? static_cast<Real>((*input)[block[s]][i]) : Real(0);
+			if (round)
+				act[input_ids[i]] = to_bfloat16(static_cast<float>(act[input_ids[i]]));
+		}
+	}
+
+	const size_t ntile = tile_bytes / (block_size * sizeof(Real));
+	for (auto& layer : layers)
+	{
+		for (size_t n = layer.first_node; n < layer.end_node; ++n)
+			for (size_t s = 0; s < block_size; ++s)
+				pass.act[s * nneurons + n] = params_[nodes[n].first_param];
+		const size_t ninputs = nodes[layer.first_node].ninputs;
+		if (!nodes[layer.first_node].contiguous)
+		{
+			// a single node, its sources gathered
+			const size_t n = layer.first_node;
+			const Real* w = params_ + nodes[n].first_param;
+			const uint32_t* src = &sources[nodes[n].first_param];
+			for (size_t s = 0; s < block_size; ++s)
+			{
+				Real* act = &pass.act[s * nneurons];
+				Real sum = act[n];
+				for (size_t k = 1; k <= ninputs; ++k)
+					sum += w[k] * act[src[k]];
+				act[n] = sum;
+			}
+		}
+		else
+			for (size_t first = 0; first < ninputs; first += ntile)
+			{
+				// the sources of the tile of all samples of the block stay in the cache while the rows of the tile are read, each once
+				const size_t m = std::min(ntile, ninputs - first);
+				const size_t m4 = m - m % 4;
+				const size_t source = sources[nodes[layer.first_node].first_param + 1] + first;
+				for (size_t n = layer.first_node; n < layer.end_node; ++n)
+				{
+					const Real* w = params_ + nodes[n].first_param + 1 + first;
+					for (size_t s = 0; s < block_size; ++s)
+					{
+						// independent partial sums, so the additions do not wait for each other and can be vectorized
+						const Real* a = &pass.act[s * nneurons + source];
+						Real partial[4] = { 0, 0, 0, 0 };
+						for (size_t k = 0; k < m4; k += 4)
+						{
+							partial[0] += w[k] * a[k];
+							partial[1] += w[k + 1] * a[k + 1];
+							partial[2] += w[k + 2] * a[k + 2];
+							partial[3] += w[k + 3] * a[k + 3];
+						}
+						for (size_t k = m4; k < m; ++k)
+							partial[0] += w[k] * a[k];
+						pass.act[s * nneurons + n] += (partial[0] + partial[1]) + (partial[2] + partial[3]);
+					}
+				}
+			}
+		for (size_t s = 0; s < block_size; ++s)
+		{
+			Real* act = &pass.act[s * nneurons];
+			for (size_t n = layer.first_node; n < layer.end_node; ++n)
+			{
+				if (!nodes[n].linear)
+					act[n] = Real(1) / (Real(1) + std::exp(-act[n]));
+				if (round)
+					act[n] = to_bfloat16(static_cast<float>(act[n]));
+			}
+		}
+	}
+
+	if (softmax_output)
+	{
+		const size_t noutputs = output_ids.size();
+		for (size_t s = 0; s < block_size; ++s)
+		{
+			Real* act = &pass.act[s * nneurons];
+			Real* log_probs = &pass.log_probs[s * noutputs];
+			Real max_sum = -std::numeric_limits<Real>::max();
+			for (auto id : output_ids)
+				max_sum = std::max(max_sum, act[id]);
+			Real exp_sum = 0;
+			for (size_t o = 0; o < noutputs; ++o)
+			{
+				log_probs[o] = act[output_ids[o]] - max_sum;
+				exp_sum += std::exp(log_probs[o]);
+			}
+			const Real log_exp_sum = std::log(exp_sum);
+			for (size_t o = 0; o < noutputs; ++o)
+			{
+				log_probs[o] -= log_exp_sum;
+				act[output_ids[o]] = std::exp(log_probs[o]);
+			}
+		}
+	}
+}
+
+/**
+ * Error of a sample of the latest forward propagation of the pass.
+ * @param pass
+ * @param lane position of the sample in the block
+ * @param desired_output
+ * @return double
+ */
+template <typename Real>
+double FullBatchTrainer::sample_error(const Pass<Real>& pass, size_t lane, const vector<double>& dout) const
+{
+	double err = 0;
+	if (softmax_output)
+	{
+		const Real* log_probs = &pass.log_probs[lane * output_ids.size()];
+		for (size_t o = 0; o < output_ids.size(); ++o)
+			err -= dout[o] * log_probs[o];
+		return err;
+	}
+	const Real* act = &pass.act[lane * nodes.size()];
+	for (size_t o = 0; o < output_ids.size(); ++o)
+		err += (act[output_ids[o]] - dout[o]) * (act[output_ids[o]] - dout[o]);
+	return err / output_ids.size();
+}
+
+/**
+ * Backpropagates the derivatives of the error by the activations (dact) and by the sums (dsum) of the output neurons, seeded by the caller for each
+ * sample of the block, through the latest forward propagation of the pass, and adds the derivatives by the parameters, summed over the block, to gradient.
+ * @param pass
+ * @param params
+ * @param gradient
+ */
+template <typename Real>
+void FullBatchTrainer::backward(Pass<Real>& pass, const Real* params_, Real* gradient)
+{
+	const size_t nneurons = nodes.size();
+	const size_t ntile = tile_bytes / (block_size * sizeof(Real));
+	for (size_t l = layers.size(); l-- > 0; )
+	{
+		// the derivatives by the sums of the layer, final since the nodes of a layer do not feed each other
+		const Layer& layer = layers[l];
+		bool any = false;
+		for (size_t s = 0; s < block_size; ++s)
+		{
+			const Real* act = &pass.act[s * nneurons];
+			const Real* dact = &pass.dact[s * nneurons];
+			Real* dsum = &pass.dsum[s * nneurons];
+			for (size_t n = layer.first_node; n < layer.end_node; ++n)
+			{
+				dsum[n] += nodes[n].linear ? dact[n] : dact[n] * act[n] * (Real(1) - act[n]);
+				gradient[nodes[n].first_param] += dsum[n];
+				any = any || dsum[n] != Real(0);
+			}
+		}
+		if (!any)
+			continue;
+
+		const size_t ninputs = nodes[layer.first_node].ninputs;
+		if (!nodes[layer.first_node].contiguous)
+		{
+			const size_t n = layer.first_node;
+			const Real* w = params_ + nodes[n].first_param;
+			const uint32_t* src = &sources[nodes[n].first_param];
+			Real* g = gradient + nodes[n].first_param;
+			for (size_t s = 0; s < block_size; ++s)
+			{
+				const Real* act = &pass.act[s * nneurons];
+				Real* dact = &pass.dact[s * nneurons];
+				const Real d = pass.dsum[s * nneurons + n];
+				for (size_t k = 1; k <= ninputs; ++k)
+				{
+					g[k] += d * act[src[k]];
+					dact[src[k]] += d * w[k];
+				}
+			}
+			continue;
+		}
+		for (size_t first = 0; first < ninputs; first += ntile)
+		{
+			// the gradient of the weights and the derivatives by the sources while the row of the tile is in the cache
+			const size_t m = std::min(ntile, ninputs - first);
+			const size_t source = sources[nodes[layer.first_node].first_param + 1] + first;
+			for (size_t n = layer.first_node; n < layer.end_node; ++n)
+			{
+				Real d[block_size];
+				bool zero = true;
+				for (size_t s = 0; s < block_size; ++s)
+				{
+					d[s] = pass.dsum[s * nneurons + n];
+					zero = zero && d[s] == Real(0);
+				}
+				if (zero) // e.g. the weights of the other outputs in a row of the Jacobian
+					continue;
+				const Real* w = params_ + nodes[n].first_param + 1 + first;
+				Real* g = gradient + nodes[n].first_param + 1 + first;
+				for (size_t s = 0; s < block_size; s += 4)
+				{
+					const Real* a0 = &pass.act[s * nneurons + source];
+					const Real* a1 = a0 + nneurons;
+					const Real* a2 = a1 + nneurons;
+					const Real* a3 = a2 + nneurons;
+					for (size_t k = 0; k < m; ++k)
+						g[k] += (d[s] * a0[k] + d[s + 1] * a1[k]) + (d[s + 2] * a2[k] + d[s + 3] * a3[k]);
+				}
+				for (size_t s = 0; s < block_size; ++s)
+				{
+					Real* da = &pass.dact[s * nneurons + source];
+					for (size_t k = 0; k < m; ++k)
+						da[k] += d[s] * w[k];
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Creates an L-BFGS trainer.
+ * @param history_ number of steps kept for approximating the inverse Hessian
+ * @param precision_ precision of the forward and backward passes
+ */
+LbfgsTrainer::LbfgsTrainer(size_t history_, Precision precision_)
+	: FullBatchTrainer(precision_), history(history_), nsteps(0), newest(0), cached_error(0), has_cached(false)
+{
+	if (history == 0)
+		throw std::runtime_error("L-BFGS needs at least one step of history!");
+}
+
+/**
+ * Creates a trainer with the same parameters, without the state of the session.
+ * @return shared_ptr<FullBatchTrainer>
+ */
+shared_ptr<FullBatchTrainer> LbfgsTrainer::clone() const
+{
+	return std::make_shared<LbfgsTrainer>(history, get_precision());
+}
+
+/**
+ * Stores the state of the optimizer in the session: the step counters, the error and gradient of the latest step, and the history of the
+ * parameter and gradient changes.
+ * @param state
+ */
+void LbfgsTrainer::get_state(vector<double>& state) const
+{
+	state.clear();
+	state.push_back(static_cast<double>(nsteps));
+	state.push_back(static_cast<double>(newest));
+	state.push_back(has_cached ? 1.0 : 0.0);
+	state.push_back(cached_error);
+	state.insert(state.end(), cached_params.begin(), cached_params.end());
+	state.insert(state.end(), gradient.begin(), gradient.end());
+	state.insert(state.end(), rho.begin(), rho.end());
+	for (size_t k = 0; k < history; ++k)
+	{
+		state.insert(state.end(), s[k].begin(), s[k].end());
+		state.insert(state.end(), y[k].begin(), y[k].end());
+	}
+}
+
+/**
+ * Restores the state of the optimizer stored by get_state(), after start() of a session of the same network.
+ * @param state
+ */
+void LbfgsTrainer::set_state(const vector<double>& state)
+{
+	const size_t n = cached_params.size();
+	if (state.size() != 4 + 2 * n + history * (1 + 2 * n) || !(state[1] < history))
+		throw std::runtime_error("Invalid state of the full-batch trainer!");
+	auto it = state.begin();
+	nsteps = static_cast<size_t>(*it++);
+	newest = static_cast<size_t>(*it++);
+	has_cached = *it++ != 0;
+	cached_error = *it++;
+	std::copy(it, it + n, cached_params.begin());
+	it += n;
+	std::copy(it, it + n, gradient.begin());
+	it += n;
+	std::copy(it, it + history, rho.begin());
+	it += history;
+	for (size_t k = 0; k < history; ++k)
+	{
+		std::copy(it, it + n, s[k].begin());
+		it += n;
+		std::copy(it, it + n, y[k].begin());
+		it += n;
+	}
+}
+
+/**
+ * Forgets the state of the previous session.
+ * @param nparams number of optimized parameters
+ */
+void LbfgsTrainer::reset(size_t nparams)
+{
+	s.assign(history, vector<double>(nparams, 0.0));
+	y.assign(history, vector<double>(nparams, 0.0));
+	rho.assign(history, 0.0);
+	alpha.assign(history, 0.0);
+	nsteps = newest = 0;
+	cached_params.assign(nparams, 0.0);
+	gradient.assign(nparams, 0.0);
+	new_gradient.assign(nparams, 0.0);
+	direction.assign(nparams, 0.0);
+	new_params.assign(nparams, 0.0);
+	has_cached = false;
+}
+
+/**
+ * Moves the parameters by one iteration of the optimizer.
+ * @param params
+ * @return false if no step decreasing the error was found
+ */
+bool LbfgsTrainer::iterate(vector<double>& params)
+{
+	// the error and gradient of the previous step are reused unless the weights were changed since (e.g. rolled back)
+	double err = has_cached && params == cached_params ? cached_error : error_gradient(params, gradient);
+	const size_t n = params.size();
+
+	// two-loop recursion: direction = -H gradient
+	for (size_t i = 0; i < n; ++i)
+		direction[i] = -gradient[i];
+	const size_t nhistory = std::min(nsteps, history);
+	for (size_t h = 0; h < nhistory; ++h)
+	{
+		size_t k = (newest + history - h) % history;
+		alpha[k] = rho[k] * dot(s[k], direction);
+		for (size_t i = 0; i < n; ++i)
+			direction[i] -= alpha[k] * y[k][i];
+	}
+	if (nhistory)
+	{
+		const double gamma = 1.0 / (rho[newest] * dot(y[newest], y[newest])); // s^T y / y^T y
+		for (auto& d : direction)
+			d *= gamma;
+	}
+	for (size_t h = nhistory; h-- > 0; )
+	{
+		size_t k = (newest + history - h) % history;
+		const double beta = rho[k] * dot(y[k], direction);
+		for (size_t i = 0; i < n; ++i)
+			direction[i] += (alpha[k] - beta) * s[k][i];
+	}
+	double slope = dot(gradient, direction);
+	if (!(slope < 0)) // not a descent direction, start over from the gradient
+	{
+		nsteps = 0;
+		for (size_t i = 0; i < n; ++i)
+			direction[i] = -gradient[i];
+		slope = -dot(gradient, gradient);
+		if (!(slope < 0))
+			return false; // stationary point
+	}
+
+	// backtracking line search, the first step is scaled by the gradient until there is a history
+	const double armijo = 1e-4;
+	double step_size = nsteps ? 1.0 : std::min(1.0, 1.0 / std::sqrt(-slope));
+	for (size_t t = 0; t < max_nbacktrack; ++t, step_size *= 0.5)
+	{
+		for (size_t i = 0; i < n; ++i)
+			new_params[i] = params[i] + step_size * direction[i];
+		double new_err = error_gradient(new_params, new_gradient);
+		if (!(new_err <= err + armijo * step_size * slope))
+			continue;
+
+		// keep the step if the curvature is positive, so the approximation stays positive definite; the oldest pair is only overwritten then
+		double sy = 0, yy = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			const double si = new_params[i] - params[i];
+			const double yi = new_gradient[i] - gradient[i];
+			sy += si * yi;
+			yy += yi * yi;
+		}
+		if (sy > 1e-10 * yy && sy > 0)
+		{
+			size_t k = nsteps ? (newest + 1) % history : 0;
+			for (size_t i = 0; i < n; ++i)
+			{
+				s[k][i] = new_params[i] - params[i];
+				y[k][i] = new_gradient[i] - gradient[i];
+			}
+			rho[k] = 1.0 / sy;
+			newest = k;
+			++nsteps;
+		}
+		params.swap(new_params);
+		gradient.swap(new_gradient);
+		cached_params = params;
+		cached_error = new_err;
+		has_cached = true;
+		return true;
+	}
+	nsteps = 0;
+	has_cached = false;
+	return false;
+}
+
+const double LevenbergMarquardtTrainer::def_damping = 1e-3;
+
+/**
+ * Creates a Levenberg-Marquardt trainer.
+ * @param damping_ initial damping, relative to the diagonal of the normal equations
+ * @param precision_ precision of the forward and backward passes
+ */
+LevenbergMarquardtTrainer::LevenbergMarquardtTrainer(double damping_, Precision precision_)
+	: FullBatchTrainer(precision_), initial_damping(damping_), damping(damping_)
+{
+	if (damping_ <= 0)
+		throw std::runtime_error("Damping has to be positive!");
+}
+
+/**
+ * Creates a trainer with the same parameters, without the state of the session.
+ * @return shared_ptr<FullBatchTrainer>
+ */
+shared_ptr<FullBatchTrainer> LevenbergMarquardtTrainer::clone() const
+{
+	return std::make_shared<LevenbergMarquardtTrainer>(initial_damping, get_precision());
+}
+
+/**
+ * Stores the state of the optimizer in the session: the damping.
+ * @param state
+ */
+void LevenbergMarquardtTrainer::get_state(vector<double>& state) const
+{
+	state.assign(1, damping);
+}
+
+/**
+ * Restores the state of the optimizer stored by get_state(), after start() of a session of the same network.
+ * @param state
+ */
+void LevenbergMarquardtTrainer::set_state(const vector<double>& state)
+{
+	if (state.size() != 1 || !(state[0] > 0))
+		throw std::runtime_error("Invalid state of the full-batch trainer!");
+	damping = state[0];
+}
+
+/**
+ * Forgets the state of the previous session.
+ * @param nparams number of optimized parameters
+ */
+void LevenbergMarquardtTrainer::reset(size_t nparams)
+{
+	damping = initial_damping;
+	hessian.assign(nparams * nparams, 0.0);
+	damped.assign(nparams * nparams, 0.0);
+	gradient.assign(nparams, 0.0);
+	delta.assign(nparams, 0.0);
+	new_params.assign(nparams, 0.0);
+}
+
+/**
+ * Moves the parameters by one iteration of the optimizer.
+ * @param params
+ * @return false if no step decreasing the error was found
+ */
+bool LevenbergMarquardtTrainer::iterate(vector<double>& params)
+{
+	const double err = normal_equations(params, hessian, gradient);
+	const size_t n = params.size();
+	for (size_t t = 0; t < max_ndamping; ++t, damping *= 10)
+	{
+		// (J^T J + damping * diag(J^T J)) delta = -J^T r, weights not affecting the outputs have zero diagonal and get a tiny one
+		damped = hessian;
+		for (size_t i = 0; i < n; ++i)
+		{
+			damped[i * n + i] += damping * hessian[i * n + i] + 1e-12;
+			delta[i] = -gradient[i];
+		}
+		if (!cholesky_solve(damped, n, delta))
+			continue;
+		for (size_t i = 0; i < n; ++i)
+			new_params[i] = params[i] + delta[i];
+		if (error(new_params) < err)
+		{
+			params.swap(new_params);
+			damping = std::max(damping / 10, 1e-12);
+			return true;
+		}
+	}
+	damping = initial_damping;
+	return false;
+}
+
+}
\ No newline at end of file
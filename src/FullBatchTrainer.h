@@ -0,0 +1,353 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _FULLBATCHTRAINER_H
+#define _FULLBATCHTRAINER_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "Neuron.h"
+
+using std::vector;
+using std::shared_ptr;
+
+namespace NNlight {
+
+class NeuronNetwork;
+
+/**
+ * Trains a network on all of its train samples at once, by an optimizer working on a flat vector of the weights and biases of the neurons
+ * (see NeuronNetwork::use_lbfgs and NeuronNetwork::use_levenberg_marquardt). The gradient of the error is computed exactly over the flattened
+ * topology of the network, for the same error NeuronNetwork::train reports: mean squared error, or cross-entropy for softmax outputs.
+ * The learning rates, regularization and Rprop settings of the neurons are not used.
+ */
+class FullBatchTrainer
+{
+public:
+	/**
+	 * Precision of the forward and backward passes. The optimized parameters and the state of the optimizer are kept in double in any case.
+	 * FLOAT_PRECISION computes the activations and the gradient in float from a float copy of the parameters, made whenever they change;
+	 * BFLOAT16_PRECISION also rounds the copy of the parameters and the activations to bfloat16 (8 bits of mantissa), computing in float.
+	 */
+	enum Precision { DOUBLE_PRECISION, FLOAT_PRECISION, BFLOAT16_PRECISION };
+
+	/**
+	 * Creates a trainer computing in the given precision.
+	 * @param precision_
+	 */
+	explicit FullBatchTrainer(Precision precision_ = DOUBLE_PRECISION);
+	virtual ~FullBatchTrainer();
+
+	/**
+	 * Prepares a training session of the network: flattens its topology and forgets the state of the previous session.
+	 * Call again if neurons are added or connected.
+	 * @param network
+	 */
+	void start(const NeuronNetwork& network);
+
+	/**
+	 * Makes one iteration of the optimizer on the given train samples, and updates the weights of the network by it.
+	 * @param input
+	 * @param desired_output
+	 * @param samples indices of the train samples
+	 * @param nsamples
+	 * @return false if no step decreasing the error was found, the weights are unchanged then
+	 */
+	bool step(const vector<vector<double>>& input, const vector<vector<double>>& desired_output, const size_t* samples, size_t nsamples);
+
+	/**
+	 * Creates a trainer with the same parameters, without the state of the session.
+	 */
+	virtual shared_ptr<FullBatchTrainer> clone() const = 0;
+
+	/**
+	 * Returns the precision of the forward and backward passes.
+	 */
+	Precision get_precision() const;
+
+	/**
+	 * Stores the state of the optimizer in the session, so a training resumed from a checkpoint continues it. Empty if the optimizer has no state.
+	 * @param state
+	 */
+	virtual void get_state(vector<double>& state) const;
+
+	/**
+	 * Restores the state of the optimizer stored by get_state(), after start() of a session of the same network.
+	 * @param state
+	 */
+	virtual void set_state(const vector<double>& state);
+
+protected:
+	/**
+	 * Forgets the state of the previous session.
+	 * @param nparams number of optimized parameters
+	 */
+	virtual void reset(size_t nparams) = 0;
+
+	/**
+	 * Moves the parameters by one iteration of the optimizer.
+	 * @param params
+	 * @return false if no step decreasing the error was found
+	 */
+	virtual bool iterate(vector<double>& params) = 0;
+
+	/**
+	 * Error of the network with the given parameters on the train samples of the step.
+	 * @param params
+	 */
+	double error(const vector<double>& params);
+
+	/**
+	 * Error of the network with the given parameters on the train samples of the step, and its gradient by the parameters.
+	 * @param params
+	 * @param gradient
+	 */
+	double error_gradient(const vector<double>& params, vector<double>& gradient);
+
+	/**
+	 * Error of the network with the given parameters on the train samples of the step, as the sum of squared residuals (output - desired output,
+	 * scaled), and the Gauss-Newton normal equations: the upper triangle of J^T J to hessian and J^T r to gradient, J being the Jacobian of the residuals.
+	 * Squared error outputs only.
+	 * @param params
+	 * @param hessian nparams x nparams, row-major
+	 * @param gradient
+	 */
+	double normal_equations(const vector<double>& params, vector<double>& hessian, vector<double>& gradient);
+
+private:
+	FullBatchTrainer(const FullBatchTrainer&); // not copyable
+	FullBatchTrainer& operator=(const FullBatchTrainer&);
+
+	/**
+	 * A neuron of the flattened network. Parameters of a neuron are its bias followed by its input weights, the input weights are aligned with
+	 * the positions of their source neurons in sources.
+	 */
+	struct Node
+	{
+		Neuron* neuron;
+		size_t first_param;
+		size_t ninputs;
+		/**
+		 * Index of the input value fed to the neuron if it is an input neuron, or no_input.
+		 */
+		size_t input_index;
+		bool linear;
+		/**
+		 * Set if the sources of the inputs are consecutive neurons (e.g. a whole layer), so the node can be grouped with its neighbours into a Layer.
+		 */
+		bool contiguous;
+	};
+	static const size_t no_input = ~size_t(0);
+
+	/**
+	 * Consecutive nodes (not input neurons) having the same contiguous sources, e.g. a fully connected layer, or a single node otherwise.
+	 * The passes walk the weights of a layer in tiles of columns, so the values of the sources of a tile stay in the L1 cache while every
+	 * node of the layer reads them, and each weight is read once per block of samples.
+	 */
+	struct Layer
+	{
+		size_t first_node, end_node;
+	};
+
+	/**
+	 * Number of samples propagated together, so a weight is loaded once for all samples of the block while the sources of its tile are in the cache.
+	 * Levenberg-Marquardt backpropagates the samples of a block one by one.
+	 */
+	static const size_t block_size = 8;
+
+	/**
+	 * Values of the forward and backward passes in the precision of the computation: a copy of the parameters (not used if computing in double,
+	 * the optimized parameters are read directly), the activations, the derivatives of the error by the activations and by the sums of the neurons,
+	 * log of the softmax outputs, and the derivatives by the parameters (a row of the Jacobian for Levenberg-Marquardt). The values of the neurons
+	 * and of the outputs are kept for a block of samples, the value of sample s of neuron n at s * nneurons + n,
+	 * and of output o at s * noutputs + o.
+	 */
+	template <typename Real>
+	struct Pass
+	{
+		vector<Real> params, act, dact, dsum, log_probs, gradient;
+	};
+
+	/**
+	 * Copies the optimized parameters into the float pass, rounded to bfloat16 if computing in it.
+	 * @param params
+	 */
+	void round_params(const vector<double>& params);
+
+	/**
+	 * Error of the network with the given parameters on the train samples of the step, see error().
+	 * @param pass
+	 * @param params
+	 */
+	template <typename Real>
+	double error(Pass<Real>& pass, const Real* params);
+
+	/**
+	 * Error of the network with the given parameters on the train samples of the step, and its gradient added to gradient, see error_gradient().
+	 * @param pass
+	 * @param params
+	 * @param gradient
+	 */
+	template <typename Real>
+	double error_gradient(Pass<Real>& pass, const Real* params, Real* gradient);
+
+	/**
+	 * Sum of squared residuals and the Gauss-Newton normal equations added to hessian and gradient, see normal_equations().
+	 * The Jacobian rows are computed in the precision of the pass, the normal equations are summed in double.
+	 * @param pass
+	 * @param params
+	 * @param hessian
+	 * @param gradient
+	 */
+	template <typename Real>
+	double normal_equations(Pass<Real>& pass, const Real* params, vector<double>& hessian, vector<double>& gradient);
+
+	/**
+	 * Propagates a block of train samples through the flattened network into the activations of the pass, normalizing the outputs by softmax if set.
+	 * The samples after nblock in the block get zero inputs.
+	 * @param pass
+	 * @param params
+	 * @param block indices of the train samples
+	 * @param nblock number of samples, at most block_size
+	 */
+	template <typename Real>
+	void forward(Pass<Real>& pass, const Real* params, const size_t* block, size_t nblock);
+
+	/**
+	 * Error of a sample of the latest forward propagation of the pass.
+	 * @param pass
+	 * @param lane position of the sample in the block
+	 * @param desired_output
+	 */
+	template <typename Real>
+	double sample_error(const Pass<Real>& pass, size_t lane, const vector<double>& desired_output) const;
+
+	/**
+	 * Backpropagates the derivatives of the error by the activations (dact) and by the sums (dsum) of the output neurons, seeded by the caller for each
+	 * sample of the block, through the latest forward propagation of the pass, and adds the derivatives by the parameters, summed over the block, to gradient.
+	 * @param pass
+	 * @param params
+	 * @param gradient
+	 */
+	template <typename Real>
+	void backward(Pass<Real>& pass, const Real* params, Real* gradient);
+
+	/**
+	 * Neurons in topological order, the position of each neuron in it is its id in sources, input_ids and output_ids.
+	 */
+	vector<Node> nodes;
+	vector<Layer> layers;
+	vector<uint32_t> sources;
+	vector<uint32_t> input_ids;
+	vector<uint32_t> output_ids;
+	size_t nparams;
+	bool softmax_output;
+
+	/**
+	 * Train samples of the current step.
+	 */
+	const vector<vector<double>>* input;
+	const vector<vector<double>>* desired_output;
+	const size_t* samples;
+	size_t nsamples;
+
+	/**
+	 * Scratch buffers, allocated by start(): the passes in double and in float (the one of the precision is used), and the parameters.
+	 */
+	Precision precision;
+	Pass<double> double_pass;
+	Pass<float> float_pass;
+	vector<double> params;
+};
+
+/**
+ * Limited-memory BFGS: approximates the inverse Hessian of the error from the latest parameter and gradient changes, and searches along the
+ * direction it gives by backtracking until the error decreases enough (Armijo condition). See Nocedal & Wright, Numerical Optimization, chapter 7.
+ */
+class LbfgsTrainer : public FullBatchTrainer
+{
+public:
+	/**
+	 * Default number of steps kept for approximating the inverse Hessian.
+	 */
+	static const size_t def_history = 10;
+
+	/**
+	 * Creates an L-BFGS trainer.
+	 * @param history_ number of steps kept for approximating the inverse Hessian
+	 * @param precision_ precision of the forward and backward passes
+	 */
+	explicit LbfgsTrainer(size_t history_ = def_history, Precision precision_ = DOUBLE_PRECISION);
+
+	shared_ptr<FullBatchTrainer> clone() const;
+	void get_state(vector<double>& state) const;
+	void set_state(const vector<double>& state);
+
+protected:
+	void reset(size_t nparams);
+	bool iterate(vector<double>& params);
+
+private:
+	/**
+	 * Maximum number of halvings of the step in the line search.
+	 */
+	static const size_t max_nbacktrack = 30;
+
+	size_t history;
+	/**
+	 * Parameter and gradient changes of the latest steps, in a ring of history elements; rho is 1 / (s^T y).
+	 */
+	vector<vector<double>> s, y;
+	vector<double> rho, alpha;
+	size_t nsteps, newest;
+	/**
+	 * Error and gradient at cached_params, the parameters of the latest step.
+	 */
+	vector<double> cached_params, gradient, new_gradient, direction, new_params;
+	double cached_error;
+	bool has_cached;
+};
+
+/**
+ * Levenberg-Marquardt: solves the Gauss-Newton normal equations of the squared error, damped by a multiple of their diagonal. The damping is
+ * decreased after every step decreasing the error and increased until one does. Needs squared error outputs, memory and time grow with the
+ * square of the number of weights.
+ */
+class LevenbergMarquardtTrainer : public FullBatchTrainer
+{
+public:
+	/**
+	 * Default initial damping.
+	 */
+	static const double def_damping;
+
+	/**
+	 * Creates a Levenberg-Marquardt trainer.
+	 * @param damping_ initial damping, relative to the diagonal of the normal equations
+	 * @param precision_ precision of the forward and backward passes
+	 */
+	explicit LevenbergMarquardtTrainer(double damping_ = def_damping, Precision precision_ = DOUBLE_PRECISION);
+
+	shared_ptr<FullBatchTrainer> clone() const;
+	void get_state(vector<double>& state) const;
+	void set_state(const vector<double>& state);
+
+protected:
+	void reset(size_t nparams);
+	bool iterate(vector<double>& params);
+
+private:
+	/**
+	 * Maximum number of damping increases in an iteration.
+	 */
+	static const size_t max_ndamping = 12;
+
+	double initial_damping, damping;
+	vector<double> hessian, damped, gradient, delta, new_params;
+};
+
+}
+
+#endif //_FULLBATCHTRAINER_H
\ No newline at end of file
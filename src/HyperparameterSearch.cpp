@@ -0,0 +1,412 @@
+/**
+ * Project NNlight
+ */
+
+#include "HyperparameterSearch.h"
+#include "Checkpoint.h"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <sstream>
+#include <iomanip>
+
+/**
+ * HyperparameterSearch implementation
+ *
+ * Every trial (run) owns a clone of the network and a training state. A run is trained by NeuronNetwork::run_session for a
+ * budget of epochs, then paused, so successive halving can continue the survivors later exactly where they were left.
+ */
+
+namespace NNlight {
+
+/**
+ * A trial in progress.
+ */
+struct HyperparameterSearch::Run
+{
+	Trial trial;
+	shared_ptr<NeuronNetwork> network;
+	TrainingState state;
+	/**
+	 * Random stream of the trial, split from the stream of the search.
+	 */
+	RandomGenerator gen;
+};
+
+HyperparameterSearch::Config::Config()
+	: use_rprop(false), learning_rate(Neuron::def_learning_rate), regularization(Neuron::def_regularization),
+	delta0(Neuron::Rprop::def_delta0), deltamax(Neuron::Rprop::def_deltamax)
+{}
+
+/**
+ * Short description of the method and its parameters.
+ */
+string HyperparameterSearch::Config::to_string() const
+{
+	std::ostringstream desc;
+	if (use_rprop)
+		desc << "rprop delta0=" << delta0 << " deltamax=" << deltamax;
+	else
+		desc << "default rate=" << learning_rate << " reg=" << regularization;
+	return desc.str();
+}
+
+HyperparameterSearch::Trial::Trial()
+	: train_err(std::numeric_limits<double>::max()), test_err(std::numeric_limits<double>::max()), nepoch(0), wall_time(0), killed(false)
+{}
+
+/**
+ * Splits the samples into training and test samples once, the same split is used by all trials. The network is cloned, so it can be changed or trained afterwards.
+ * The search is reproducible if a seed is set in the settings of the network.
+ * The data is not copied, it has to outlive the search.
+ * @param network_ network to be trained, its neurons and settings (except the maximum number of epochs) are used by all trials
+ * @param input_
+ * @param desired_output_
+ * @param train_ratio_
+ */
+HyperparameterSearch::HyperparameterSearch(const NeuronNetwork& network_, const vector<vector<double>>& input_, const vector<vector<double>>& desired_output_, double train_ratio_)
+	: network(network_.clone()), input(&input_), desired_output(&desired_output_), ntrain(static_cast<size_t>(input_.size() * train_ratio_)), train_ratio(train_ratio_),
+	search_default(true), search_rprop(true), nthreads(0)
+{
+	if (ntrain == 0)
+		throw std::runtime_error("Cannot search hyperparameters, no training data provided - either train_ratio is too close to zero or the input is empty!");
+	if (desired_output_.size() != input_.size())
+		throw std::runtime_error("Number of inputs and desired outputs differ!");
+
+	learning_rates.push_back(Neuron::def_learning_rate);
+	regularizations.push_back(Neuron::def_regularization);
+	delta0s.push_back(Neuron::Rprop::def_delta0);
+	deltamaxs.push_back(Neuron::Rprop::def_deltamax);
+
+	gen = network->make_random();
+	order.resize(input_.size());
+	std::iota(order.begin(), order.end(), 0);
+	gen.shuffle(order.begin(), order.end());
+}
+
+HyperparameterSearch::~HyperparameterSearch() {}
+
+/**
+ * Sets whether default backpropagation and Rprop configurations are searched. Both are by default.
+ * @param search_default_
+ * @param search_rprop_
+ */
+void HyperparameterSearch::set_methods(bool search_default_, bool search_rprop_)
+{
+	if (!search_default_ && !search_rprop_)
+		throw std::runtime_error("At least one backpropagation method has to be searched!");
+	search_default = search_default_;
+	search_rprop = search_rprop_;
+}
+
+/**
+ * Sets the values tried for the parameters of the default backpropagation. Random search samples log-uniformly between the lowest and the highest value.
+ * @param learning_rates_
+ * @param regularizations_
+ */
+void HyperparameterSearch::set_default_parameters(const vector<double>& learning_rates_, const vector<double>& regularizations_)
+{
+	if (learning_rates_.empty() || regularizations_.empty())
+		throw std::runtime_error("At least one value has to be given for each parameter!");
+	learning_rates = learning_rates_;
+	regularizations = regularizations_;
+}
+
+/**
+ * Sets the values tried for the parameters of Rprop. Random search samples log-uniformly between the lowest and the highest value.
+ * @param delta0s_
+ * @param deltamaxs_
+ */
+void HyperparameterSearch::set_rprop_parameters(const vector<double>& delta0s_, const vector<double>& deltamaxs_)
+{
+	if (delta0s_.empty() || deltamaxs_.empty())
+		throw std::runtime_error("At least one value has to be given for each parameter!");
+	delta0s = delta0s_;
+	deltamaxs = deltamaxs_;
+}
+
+/**
+ * Sets the number of trials trained at once. 0 means one thread per core (default).
+ * @param nthreads_
+ */
+void HyperparameterSearch::set_num_of_threads(size_t nthreads_)
+{
+	nthreads = nthreads_;
+}
+
+/**
+ * Returns every combination of the parameter values, for each searched method.
+ */
+vector<HyperparameterSearch::Config> HyperparameterSearch::grid() const
+{
+	vector<Config> configs;
+	Config config;
+	if (search_default)
+		for (auto rate : learning_rates)
+			for (auto reg : regularizations)
+			{
+				config.use_rprop = false;
+				config.learning_rate = rate;
+				config.regularization = reg;
+				configs.push_back(config);
+			}
+	if (search_rprop)
+		for (auto delta0 : delta0s)
+			for (auto deltamax : deltamaxs)
+			{
+				config.use_rprop = true;
+				config.delta0 = delta0;
+				config.deltamax = deltamax;
+				configs.push_back(config);
+			}
+	return configs;
+}
+
+/**
+ * Returns ntrials randomly sampled configurations, the methods are chosen with equal chance.
+ * @param ntrials
+ */
+vector<HyperparameterSearch::Config> HyperparameterSearch::sample(size_t ntrials)
+{
+	// log-uniform between the lowest and highest value, uniform if any of them is not positive
+	auto draw = [this] (const vector<double>& values) -> double {
+		double lower = *std::min_element(values.begin(), values.end());
+		double upper = *std::max_element(values.begin(), values.end());
+		if (lower == upper)
+			return lower;
+		if (lower <= 0)
+			return gen.uniform(lower, upper);
+		return std::exp(gen.uniform(std::log(lower), std::log(upper)));
+	};
+
+	vector<Config> configs(ntrials);
+	for (auto& config : configs)
+	{
+		config.use_rprop = search_default && search_rprop ? (gen() >> 63) != 0 : search_rprop;
+		if (config.use_rprop)
+		{
+			config.delta0 = draw(delta0s);
+			config.deltamax = draw(deltamaxs);
+		}
+		else
+		{
+			config.learning_rate = draw(learning_rates);
+			config.regularization = draw(regularizations);
+		}
+	}
+	return configs;
+}
+
+/**
+ * Trains all configurations for max_nepoch epochs (or until a stopping criterion of the network is met). Returns the trials ranked, best first.
+ * @param configs
+ * @param max_nepoch
+ */
+vector<HyperparameterSearch::Trial> HyperparameterSearch::evaluate(const vector<Config>& configs, size_t max_nepoch)
+{
+	return successive_halving(configs, max_nepoch, max_nepoch);
+}
+
+/**
+ * Trains all configurations for min_nepoch epochs, keeps the best 1/eta of them and continues them for eta times as many epochs, and so on,
+ * until max_nepoch is reached. Survivors continue from the weights of their lowest test error. Returns the trials ranked, best first.
+ * @param configs
+ * @param min_nepoch
+ * @param max_nepoch
+ * @param eta
+ */
+vector<HyperparameterSearch::Trial> HyperparameterSearch::successive_halving(const vector<Config>& configs, size_t min_nepoch, size_t max_nepoch, size_t eta)
+{
+	if (min_nepoch == 0 || min_nepoch > max_nepoch || eta < 2)
+		throw std::runtime_error("Invalid successive halving budget, 0 < min_nepoch <= max_nepoch and eta >= 2 are required!");
+
+	auto runs = create_runs(configs);
+	vector<Run*> alive;
+	for (auto& run : runs)
+		alive.push_back(run.get());
+
+	size_t nepoch = min_nepoch;
+	while (true)
+	{
+		train(alive, nepoch);
+		if (nepoch >= max_nepoch)
+			break;
+
+		// keep the best 1/eta of the trials, free the networks of the others
+		std::stable_sort(alive.begin(), alive.end(), [this] (const Run* a, const Run* b) { return score(a->trial) < score(b->trial); });
+		size_t nkeep = std::max<size_t>(1, alive.size() / eta);
+		for (size_t i = nkeep; i < alive.size(); ++i)
+		{
+			alive[i]->trial.killed = true;
+			alive[i]->network.reset();
+		}
+		alive.resize(nkeep);
+		nepoch = std::min(nepoch * eta, max_nepoch);
+	}
+
+	vector<Trial> trials;
+	for (auto& run : runs)
+		trials.push_back(run->trial);
+	rank(trials);
+	return trials;
+}
+
+/**
+ * Runs successive halving in several brackets (Hyperband): from many randomly sampled configurations starting with min_nepoch epochs,
+ * to a few configurations trained for max_nepoch epochs right away. Returns the trials of all brackets ranked, best first.
+ * @param min_nepoch
+ * @param max_nepoch
+ * @param eta
+ */
+vector<HyperparameterSearch::Trial> HyperparameterSearch::hyperband(size_t min_nepoch, size_t max_nepoch, size_t eta)
+{
+	if (min_nepoch == 0 || min_nepoch > max_nepoch || eta < 2)
+		throw std::runtime_error("Invalid Hyperband budget, 0 < min_nepoch <= max_nepoch and eta >= 2 are required!");
+
+	// number of halvings in the most aggressive bracket
+	size_t smax = 0;
+	for (size_t nepoch = min_nepoch; nepoch * eta <= max_nepoch; nepoch *= eta)
+		++smax;
+
+	vector<Trial> trials;
+	for (size_t s = smax + 1; s-- > 0; )
+	{
+		double etapow = std::pow(static_cast<double>(eta), static_cast<double>(s));
+		size_t nconfigs = static_cast<size_t>(std::ceil((smax + 1) * etapow / (s + 1)));
+		size_t nepoch = std::max<size_t>(1, static_cast<size_t>(max_nepoch / etapow));
+		auto bracket = successive_halving(sample(nconfigs), nepoch, max_nepoch, eta);
+		trials.insert(trials.end(), bracket.begin(), bracket.end());
+	}
+	rank(trials);
+	return trials;
+}
+
+/**
+ * Writes the ranked trials as a table.
+ * @param trials
+ * @param output_stream
+ */
+void HyperparameterSearch::print_ranking(const vector<Trial>& trials, ostream& output_stream) const
+{
+	bool has_test = ntrain < order.size();
+	output_stream << std::left << std::setw(5) << "#" << std::setw(40) << "configuration" << std::right << std::setw(8) << "epochs"
+		<< std::setw(14) << "train error" << std::setw(14) << (has_test ? "test error" : "") << std::setw(12) << "time [s]" << "  status" << std::endl;
+	size_t place = 0;
+	for (auto& trial : trials)
+	{
+		output_stream << std::left << std::setw(5) << ++place << std::setw(40) << trial.config.to_string() << std::right << std::setw(8) << trial.nepoch
+			<< std::setw(14) << trial.train_err;
+		if (has_test)
+			output_stream << std::setw(14) << trial.test_err;
+		else
+			output_stream << std::setw(14) << "";
+		std::ostringstream wall_time;
+		wall_time << std::fixed << std::setprecision(3) << trial.wall_time;
+		output_stream << std::setw(12) << wall_time.str() << "  " << (trial.killed ? "killed" : "finished") << std::endl;
+	}
+}
+
+/**
+ * Trains the runs concurrently until each of them has completed nepoch epochs or stopped. Clones the network for runs not started yet.
+ * @param runs
+ * @param nepoch
+ */
+void HyperparameterSearch::train(const vector<Run*>& runs, size_t nepoch)
+{
+	size_t nworkers = nthreads ? nthreads : std::thread::hardware_concurrency();
+	nworkers = std::max<size_t>(1, std::min(nworkers, runs.size()));
+
+	std::atomic<size_t> next_run(0);
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	auto work = [&] () {
+		for (size_t r = next_run++; r < runs.size(); r = next_run++)
+		{
+			Run& run = *runs[r];
+			try {
+				auto start = std::chrono::steady_clock::now();
+				if (!run.network)
+				{
+					// reuse the topology of the network, only the weights and learning parameters differ
+					run.network = network->clone();
+					run.network->settings.set_num_of_threads(1);
+					if (run.trial.config.use_rprop)
+						run.network->use_resilient_backpropagation(run.trial.config.delta0, run.trial.config.deltamax);
+					else
+						run.network->use_default_backpropation(run.trial.config.learning_rate, run.trial.config.regularization);
+					run.state.train_ratio = train_ratio;
+					run.state.batch_mode = run.trial.config.use_rprop;
+					run.state.order = order;
+					run.state.ntrain = ntrain;
+					run.state.gen = run.gen;
+					run.state.init_gen = run.state.gen.split();
+					run.state.best_weights.resize(run.network->num_of_weights());
+					run.network->start_session(run.state, false, false);
+				}
+				run.network->settings.set_max_num_of_epochs(nepoch);
+				std::ostringstream session_log;
+				run.network->run_session(run.state, *input, *desired_output, session_log, true, nullptr, nullptr);
+
+				run.trial.nepoch = run.state.epoch;
+				run.trial.train_err = run.state.prev_train_err;
+				run.trial.test_err = run.state.prev_test_err;
+				run.trial.wall_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (!error)
+					error = std::current_exception();
+			}
+		}
+	};
+
+	vector<std::thread> workers;
+	for (size_t t = 1; t < nworkers; ++t)
+		workers.push_back(std::thread(work));
+	work();
+	for (auto& worker : workers)
+		worker.join();
+	if (error)
+		std::rethrow_exception(error);
+}
+
+/**
+ * Creates runs for the configurations, each with its own random stream.
+ * @param configs
+ */
+vector<shared_ptr<HyperparameterSearch::Run>> HyperparameterSearch::create_runs(const vector<Config>& configs)
+{
+	vector<shared_ptr<Run>> runs;
+	for (auto& config : configs)
+	{
+		auto run = std::make_shared<Run>();
+		run->trial.config = config;
+		run->gen = gen.split();
+		runs.push_back(run);
+	}
+	return runs;
+}
+
+/**
+ * Error the trials are ranked by: test error, or train error if there are no test samples.
+ * @param trial
+ */
+double HyperparameterSearch::score(const Trial& trial) const
+{
+	return ntrain < order.size() ? trial.test_err : trial.train_err;
+}
+
+/**
+ * Sorts the trials by score, best first.
+ * @param trials
+ */
+void HyperparameterSearch::rank(vector<Trial>& trials) const
+{
+	std::stable_sort(trials.begin(), trials.end(), [this] (const Trial& a, const Trial& b) { return score(a) < score(b); });
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,199 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _HYPERPARAMETERSEARCH_H
+#define _HYPERPARAMETERSEARCH_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <iostream>
+#include "NeuronNetwork.h"
+
+using std::vector;
+using std::string;
+using std::shared_ptr;
+using std::ostream;
+
+namespace NNlight {
+
+/**
+ * Trains many backpropagation configurations of the same network concurrently and ranks them by their test error (train error if there are no test samples).
+ * All trials share one read-only copy of the data and the same train/test split, each trial trains its own clone of the network.
+ */
+class HyperparameterSearch
+{
+public:
+	/**
+	 * Backpropagation settings of a trial, see NeuronNetwork::use_default_backpropation and NeuronNetwork::use_resilient_backpropagation.
+	 * Rprop trials are trained in batch mode, the others online.
+	 */
+	struct Config
+	{
+		Config();
+		bool use_rprop;
+		double learning_rate, regularization;
+		double delta0, deltamax;
+		/**
+		 * Short description of the method and its parameters.
+		 */
+		string to_string() const;
+	};
+
+	/**
+	 * Outcome of a trial.
+	 */
+	struct Trial
+	{
+		Trial();
+		Config config;
+		double train_err, test_err;
+		/**
+		 * Number of epochs trained.
+		 */
+		size_t nepoch;
+		/**
+		 * Time spent on training the trial, in seconds.
+		 */
+		double wall_time;
+		/**
+		 * True if the trial was stopped by successive halving before reaching the maximum number of epochs.
+		 */
+		bool killed;
+	};
+
+	/**
+	 * Splits the samples into training and test samples once, the same split is used by all trials. The network is cloned, so it can be changed or trained afterwards.
+	 * The search is reproducible if a seed is set in the settings of the network.
+	 * The data is not copied, it has to outlive the search.
+	 * @param network_ network to be trained, its neurons and settings (except the maximum number of epochs) are used by all trials
+	 * @param input_
+	 * @param desired_output_
+	 * @param train_ratio_
+	 */
+	HyperparameterSearch(const NeuronNetwork& network_, const vector<vector<double>>& input_, const vector<vector<double>>& desired_output_, double train_ratio_);
+
+	~HyperparameterSearch();
+
+	/**
+	 * Sets whether default backpropagation and Rprop configurations are searched. Both are by default.
+	 * @param search_default_
+	 * @param search_rprop_
+	 */
+	void set_methods(bool search_default_, bool search_rprop_);
+
+	/**
+	 * Sets the values tried for the parameters of the default backpropagation. Random search samples log-uniformly between the lowest and the highest value.
+	 * @param learning_rates_
+	 * @param regularizations_
+	 */
+	void set_default_parameters(const vector<double>& learning_rates_, const vector<double>& regularizations_);
+
+	/**
+	 * Sets the values tried for the parameters of Rprop. Random search samples log-uniformly between the lowest and the highest value.
+	 * @param delta0s_
+	 * @param deltamaxs_
+	 */
+	void set_rprop_parameters(const vector<double>& delta0s_, const vector<double>& deltamaxs_);
+
+	/**
+	 * Sets the number of trials trained at once. 0 means one thread per core (default).
+	 * @param nthreads_
+	 */
+	void set_num_of_threads(size_t nthreads_);
+
+	/**
+	 * Returns every combination of the parameter values, for each searched method.
+	 */
+	vector<Config> grid() const;
+
+	/**
+	 * Returns ntrials randomly sampled configurations, the methods are chosen with equal chance.
+	 * @param ntrials
+	 */
+	vector<Config> sample(size_t ntrials);
+
+	/**
+	 * Trains all configurations for max_nepoch epochs (or until a stopping criterion of the network is met). Returns the trials ranked, best first.
+	 * @param configs
+	 * @param max_nepoch
+	 */
+	vector<Trial> evaluate(const vector<Config>& configs, size_t max_nepoch);
+
+	/**
+	 * Trains all configurations for min_nepoch epochs, keeps the best 1/eta of them and continues them for eta times as many epochs, and so on,
+	 * until max_nepoch is reached. Survivors continue from the weights of their lowest test error. Returns the trials ranked, best first.
+	 * @param configs
+	 * @param min_nepoch
+	 * @param max_nepoch
+	 * @param eta
+	 */
+	vector<Trial> successive_halving(const vector<Config>& configs, size_t min_nepoch, size_t max_nepoch, size_t eta = 3);
+
+	/**
+	 * Runs successive halving in several brackets (Hyperband): from many randomly sampled configurations starting with min_nepoch epochs,
+	 * to a few configurations trained for max_nepoch epochs right away. Returns the trials of all brackets ranked, best first.
+	 * @param min_nepoch
+	 * @param max_nepoch
+	 * @param eta
+	 */
+	vector<Trial> hyperband(size_t min_nepoch, size_t max_nepoch, size_t eta = 3);
+
+	/**
+	 * Writes the ranked trials as a table.
+	 * @param trials
+	 * @param output_stream
+	 */
+	void print_ranking(const vector<Trial>& trials, ostream& output_stream) const;
+
+private:
+	struct Run;
+
+	HyperparameterSearch(const HyperparameterSearch&); // not copyable
+	HyperparameterSearch& operator=(const HyperparameterSearch&);
+
+	/**
+	 * Trains the runs concurrently until each of them has completed nepoch epochs or stopped. Clones the network for runs not started yet.
+	 * @param runs
+	 * @param nepoch
+	 */
+	void train(const vector<Run*>& runs, size_t nepoch);
+
+	/**
+	 * Creates runs for the configurations, each with its own random stream.
+	 * @param configs
+	 */
+	vector<shared_ptr<Run>> create_runs(const vector<Config>& configs);
+
+	/**
+	 * Error the trials are ranked by: test error, or train error if there are no test samples.
+	 * @param trial
+	 */
+	double score(const Trial& trial) const;
+
+	/**
+	 * Sorts the trials by score, best first.
+	 * @param trials
+	 */
+	void rank(vector<Trial>& trials) const;
+
+	shared_ptr<NeuronNetwork> network;
+	const vector<vector<double>>* input;
+	const vector<vector<double>>* desired_output;
+	/**
+	 * Shared train/test split: sample indices, the first ntrain of them are training samples.
+	 */
+	vector<size_t> order;
+	size_t ntrain;
+	double train_ratio;
+	bool search_default, search_rprop;
+	vector<double> learning_rates, regularizations;
+	vector<double> delta0s, deltamaxs;
+	size_t nthreads;
+	RandomGenerator gen;
+};
+
+}
+
+#endif //_HYPERPARAMETERSEARCH_H
\ No newline at end of file
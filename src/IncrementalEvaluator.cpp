@@ -0,0 +1,226 @@
+/**
+ * Project NNlight
+ */
+
+#include "IncrementalEvaluator.h"
+#include <algorithm>
+#include <stdexcept>
+
+/**
+ * IncrementalEvaluator implementation
+ *
+ * Evaluates a compiled model NNUE-style: the first layer is kept as accumulators updated by the changed inputs, and a stack of
+ * accumulator states lets a search undo its moves without recomputing them.
+ */
+
+namespace NNlight {
+
+using namespace ModelFormat;
+
+/**
+ * Creates an evaluator with all inputs set to zero. The model has to outlive the evaluator.
+ * @param model_
+ */
+IncrementalEvaluator::IncrementalEvaluator(const CompiledNetwork& model_)
+	: model(model_), ndepth(0)
+{
+	const size_t nneurons = model.num_of_neurons();
+	const size_t ninputs = model.num_of_inputs();
+	const NeuronRecord* records = model.neuron_records();
+	const uint32_t* srcs = model.sources();
+	const double* wghts = model.weights();
+
+	vector<uint32_t> input_index(nneurons, no_source);
+	for (size_t i = 0; i < ninputs; ++i)
+		input_index[model.input_ids()[i]] = static_cast<uint32_t>(i);
+
+	// neurons fed by input neurons only are accumulated
+	is_accumulated.assign(nneurons, 0);
+	for (uint32_t n = 0; n < nneurons; ++n)
+	{
+		const auto& rec = records[n];
+		if (rec.kind == INPUT_NEURON || rec.ninputs == 0)
+			continue;
+		bool accumulated = true;
+		for (uint32_t k = 0; k < rec.ninputs && accumulated; ++k)
+			accumulated = input_index[srcs[rec.first_weight + k]] != no_source;
+		if (accumulated)
+		{
+			is_accumulated[n] = 1;
+			acc_ids.push_back(n);
+		}
+	}
+
+	// transpose the weights of the accumulated neurons by input
+	input_offsets.assign(ninputs + 1, 0);
+	for (auto n : acc_ids)
+		for (uint32_t k = 0; k < records[n].ninputs; ++k)
+			++input_offsets[input_index[srcs[records[n].first_weight + k]] + 1];
+	for (size_t i = 0; i < ninputs; ++i)
+		input_offsets[i + 1] += input_offsets[i];
+	targets.resize(input_offsets[ninputs]);
+	target_weights.resize(input_offsets[ninputs]);
+	vector<size_t> next(input_offsets.begin(), input_offsets.end() - 1);
+	for (uint32_t a = 0; a < acc_ids.size(); ++a)
+	{
+		const auto& rec = records[acc_ids[a]];
+		for (uint32_t k = 0; k < rec.ninputs; ++k)
+		{
+			size_t slot = next[input_index[srcs[rec.first_weight + k]]]++;
+			targets[slot] = a;
+			target_weights[slot] = wghts[rec.first_weight + k];
+		}
+	}
+
+	inputs.assign(ninputs, 0.0);
+	accumulators.resize(acc_ids.size());
+	activations.resize(nneurons);
+	refresh();
+}
+
+IncrementalEvaluator::~IncrementalEvaluator() {}
+
+/**
+ * Sets every input and recomputes the accumulators.
+ * @param input num_of_inputs() values
+ */
+void IncrementalEvaluator::set_input(const vector<double>& input)
+{
+	if (input.size() < inputs.size())
+		throw std::runtime_error("Not enough input values!");
+	std::copy(input.begin(), input.begin() + inputs.size(), inputs.begin());
+	refresh();
+}
+
+/**
+ * Sets one input, updating the accumulators fed by it.
+ * @param index
+ * @param value
+ */
+void IncrementalEvaluator::set_input(size_t index, double value)
+{
+	if (index >= inputs.size())
+		throw std::runtime_error("Input index is out of range!");
+	add_input(index, value - inputs[index]);
+	inputs[index] = value;
+}
+
+/**
+ * Adds to one input, updating the accumulators fed by it.
+ * @param index
+ * @param delta
+ */
+void IncrementalEvaluator::add_input(size_t index, double delta)
+{
+	if (index >= inputs.size())
+		throw std::runtime_error("Input index is out of range!");
+	inputs[index] += delta;
+	for (size_t slot = input_offsets[index]; slot < input_offsets[index + 1]; ++slot)
+		accumulators[targets[slot]] += target_weights[slot] * delta;
+}
+
+/**
+ * Returns the current value of an input.
+ * @param index
+ * @return double
+ */
+double IncrementalEvaluator::get_input(size_t index) const
+{
+	if (index >= inputs.size())
+		throw std::runtime_error("Input index is out of range!");
+	return inputs[index];
+}
+
+/**
+ * Recomputes the accumulators from the current input, dropping the rounding errors of many updates.
+ */
+void IncrementalEvaluator::refresh()
+{
+	const NeuronRecord* records = model.neuron_records();
+	for (size_t a = 0; a < acc_ids.size(); ++a)
+		accumulators[a] = records[acc_ids[a]].biasweight;
+	for (size_t i = 0; i < inputs.size(); ++i)
+		if (inputs[i] != 0.0)
+			for (size_t slot = input_offsets[i]; slot < input_offsets[i + 1]; ++slot)
+				accumulators[targets[slot]] += target_weights[slot] * inputs[i];
+}
+
+/**
+ * Saves the current input and accumulators on the stack.
+ */
+void IncrementalEvaluator::push()
+{
+	// the stacks keep their capacity, so pushing again after a pop does not allocate
+	input_stack.insert(input_stack.end(), inputs.begin(), inputs.end());
+	accumulator_stack.insert(accumulator_stack.end(), accumulators.begin(), accumulators.end());
+	++ndepth;
+}
+
+/**
+ * Restores the input and accumulators saved by the last push().
+ */
+void IncrementalEvaluator::pop()
+{
+	if (ndepth == 0)
+		throw std::runtime_error("No saved state to pop!");
+	--ndepth;
+	std::copy(input_stack.end() - inputs.size(), input_stack.end(), inputs.begin());
+	std::copy(accumulator_stack.end() - accumulators.size(), accumulator_stack.end(), accumulators.begin());
+	input_stack.resize(ndepth * inputs.size());
+	accumulator_stack.resize(ndepth * accumulators.size());
+}
+
+/**
+ * Returns the number of saved states on the stack.
+ * @return size_t
+ */
+size_t IncrementalEvaluator::depth() const
+{
+	return ndepth;
+}
+
+/**
+ * Evaluates the model for the current input. The output vector is filled with as many elements as the number of output neurons.
+ * @param output
+ */
+void IncrementalEvaluator::evaluate(vector<double>& output)
+{
+	output.resize(model.num_of_outputs());
+	evaluate(output.data());
+}
+
+/**
+ * Evaluates the model for the current input.
+ * @param output num_of_outputs() values are written here
+ */
+void IncrementalEvaluator::evaluate(double* output)
+{
+	const NeuronRecord* records = model.neuron_records();
+	const uint32_t* srcs = model.sources();
+	const double* wghts = model.weights();
+
+	for (size_t i = 0; i < inputs.size(); ++i)
+		activations[model.input_ids()[i]] = inputs[i];
+	for (size_t a = 0; a < acc_ids.size(); ++a)
+		activations[acc_ids[a]] = CompiledNetwork::activate(records[acc_ids[a]].activation, accumulators[a]);
+
+	// the rest of the neurons in topological order
+	for (uint32_t n = 0; n < activations.size(); ++n)
+	{
+		const auto& rec = records[n];
+		if (rec.kind == INPUT_NEURON || is_accumulated[n])
+			continue;
+		const uint32_t* src = srcs + rec.first_weight;
+		const double* w = wghts + rec.first_weight;
+		double act = rec.biasweight;
+		for (uint32_t k = 0; k < rec.ninputs; ++k)
+			act += w[k] * activations[src[k]];
+		activations[n] = CompiledNetwork::activate(rec.activation, act);
+	}
+	for (size_t o = 0; o < model.num_of_outputs(); ++o)
+		output[o] = activations[model.output_ids()[o]];
+	if (model.has_softmax_output())
+		CompiledNetwork::softmax(output, model.num_of_outputs());
+}
+
+}
\ No newline at end of file
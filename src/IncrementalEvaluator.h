@@ -0,0 +1,125 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _INCREMENTALEVALUATOR_H
+#define _INCREMENTALEVALUATOR_H
+
+#include <vector>
+#include "CompiledNetwork.h"
+
+using std::vector;
+
+namespace NNlight {
+
+/**
+ * Evaluates a compiled model for a current input that changes a few values at a time (e.g. positions of a game-tree search).
+ * Keeps the weighted input sums (accumulators) of the neurons having only input neurons as inputs, and updates them by the changed inputs only,
+ * the remaining neurons are evaluated as usual. The accumulators can be pushed on a stack and popped back, to undo moves of the search.
+ * The model is not modified, evaluators of the same model can be used concurrently.
+ */
+class IncrementalEvaluator
+{
+public:
+	/**
+	 * Creates an evaluator with all inputs set to zero. The model has to outlive the evaluator.
+	 * @param model_
+	 */
+	explicit IncrementalEvaluator(const CompiledNetwork& model_);
+
+	~IncrementalEvaluator();
+
+	/**
+	 * Sets every input and recomputes the accumulators.
+	 * @param input num_of_inputs() values
+	 */
+	void set_input(const vector<double>& input);
+
+	/**
+	 * Sets one input, updating the accumulators fed by it.
+	 * @param index
+	 * @param value
+	 */
+	void set_input(size_t index, double value);
+
+	/**
+	 * Adds to one input, updating the accumulators fed by it.
+	 * @param index
+	 * @param delta
+	 */
+	void add_input(size_t index, double delta);
+
+	/**
+	 * Returns the current value of an input.
+	 * @param index
+	 */
+	double get_input(size_t index) const;
+
+	/**
+	 * Recomputes the accumulators from the current input, dropping the rounding errors of many updates.
+	 */
+	void refresh();
+
+	/**
+	 * Saves the current input and accumulators on the stack.
+	 */
+	void push();
+
+	/**
+	 * Restores the input and accumulators saved by the last push().
+	 */
+	void pop();
+
+	/**
+	 * Returns the number of saved states on the stack.
+	 */
+	size_t depth() const;
+
+	/**
+	 * Evaluates the model for the current input. The output vector is filled with as many elements as the number of output neurons.
+	 * @param output
+	 */
+	void evaluate(vector<double>& output);
+
+	/**
+	 * Evaluates the model for the current input.
+	 * @param output num_of_outputs() values are written here
+	 */
+	void evaluate(double* output);
+
+private:
+	IncrementalEvaluator(const IncrementalEvaluator&); // not copyable
+	IncrementalEvaluator& operator=(const IncrementalEvaluator&);
+
+	const CompiledNetwork& model;
+	/**
+	 * Ids of the accumulated neurons, and a flag for each neuron of the model telling if it is accumulated.
+	 */
+	vector<uint32_t> acc_ids;
+	vector<char> is_accumulated;
+	/**
+	 * Weights from each input to the accumulated neurons: the targets of input i are in [input_offsets[i], input_offsets[i + 1]).
+	 */
+	vector<size_t> input_offsets;
+	vector<uint32_t> targets;
+	vector<double> target_weights;
+	/**
+	 * Current input and weighted input sums of the accumulated neurons (biases included).
+	 */
+	vector<double> inputs;
+	vector<double> accumulators;
+	/**
+	 * Saved inputs and accumulators, one state after another.
+	 */
+	vector<double> input_stack;
+	vector<double> accumulator_stack;
+	size_t ndepth;
+	/**
+	 * Scratch buffer for the activations of all neurons.
+	 */
+	vector<double> activations;
+};
+
+}
+
+#endif //_INCREMENTALEVALUATOR_H
\ No newline at end of file
@@ -0,0 +1,336 @@
+/**
+ * Project NNlight
+ */
+
+#include "InferenceStats.h"
+#include <atomic>
+#include <algorithm>
+#include <iomanip>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/**
+ * InferenceStats implementation
+ *
+ * Each shard has a single writer, its thread, so counters are bumped by a relaxed load and store instead of a locked read-modify-write.
+ * Other threads only read the shards. A thread finds its shard through a small thread local cache keyed by the instance id; only the first call
+ * of a thread, or a call after the thread used several other instances, takes the lock. Resetting subtracts a baseline instead of writing
+ * the shards, so it does not race with the writers.
+ */
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define NNLIGHT_THREAD_LOCAL __declspec(thread)
+#else
+#define NNLIGHT_THREAD_LOCAL thread_local
+#endif
+
+namespace NNlight {
+
+const size_t InferenceStats::nlatency_buckets;
+const size_t InferenceStats::nbatch_buckets;
+
+struct InferenceStats::Shard
+{
+	Shard()
+	{
+		ncalls.store(0);
+		nsamples.store(0);
+		latency_sum_ns.store(0);
+		for (auto& count : latency_counts)
+			count.store(0);
+		for (auto& count : batch_counts)
+			count.store(0);
+	}
+
+	std::atomic<uint64_t> ncalls, nsamples, latency_sum_ns;
+	std::atomic<uint64_t> latency_counts[nlatency_buckets];
+	std::atomic<uint64_t> batch_counts[nbatch_buckets];
+};
+
+namespace {
+
+std::atomic<uint64_t> next_stats_id(1);
+
+/**
+ * Shards of the last few instances used by the thread.
+ */
+const size_t ncached_shards = 4;
+struct CachedShard
+{
+	uint64_t stats_id;
+	void* shard;
+};
+NNLIGHT_THREAD_LOCAL CachedShard shard_cache[ncached_shards];
+NNLIGHT_THREAD_LOCAL size_t next_cache_slot;
+
+/**
+ * Adds to a counter written by a single thread.
+ */
+inline void bump(std::atomic<uint64_t>& counter, uint64_t delta)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+/**
+ * Index of the most significant set bit of a nonzero value.
+ */
+inline unsigned msb(uint64_t x)
+{
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanReverse64(&index, x);
+	return index;
+#else
+	unsigned index = 0;
+	while (x >>= 1)
+		++index;
+	return index;
+#endif
+}
+
+}
+
+InferenceSnapshot::InferenceSnapshot()
+	: ncalls(0), nsamples(0), latency_sum_ns(0), latency_counts(InferenceStats::nlatency_buckets, 0), batch_counts(InferenceStats::nbatch_buckets, 0), elapsed(0)
+{
+}
+
+/**
+ * Latency in nanoseconds that the given ratio (e.g. 0.99) of the calls did not exceed, within the precision of the buckets (about 6%).
+ * @param ratio in [0, 1]
+ * @return double
+ */
+double InferenceSnapshot::latency_percentile(double ratio) const
+{
+	if (ncalls == 0)
+		return 0;
+	uint64_t rank = static_cast<uint64_t>(ratio * ncalls + 0.5);
+	rank = std::max<uint64_t>(1, std::min(rank, ncalls));
+	uint64_t count = 0;
+	for (size_t b = 0; b < latency_counts.size(); ++b)
+	{
+		count += latency_counts[b];
+		if (count >= rank)
+			return static_cast<double>(InferenceStats::latency_bucket_limit(b));
+	}
+	return static_cast<double>(InferenceStats::latency_bucket_limit(latency_counts.size() - 1));
+}
+
+double InferenceSnapshot::mean_latency() const
+{
+	return ncalls ? static_cast<double>(latency_sum_ns) / ncalls : 0.0;
+}
+
+double InferenceSnapshot::samples_per_sec() const
+{
+	return elapsed > 0 ? nsamples / elapsed : 0.0;
+}
+
+/**
+ * Writes the counters, the mean, p50, p99, p999 and maximum latencies and the batch size distribution as a JSON object.
+ * @param out
+ */
+void InferenceSnapshot::write_json(ostream& out) const
+{
+	out << std::setprecision(8);
+	out << "{\"calls\": " << ncalls << ", \"samples\": " << nsamples << ", \"elapsed\": " << elapsed << ", \"samples_per_sec\": " << samples_per_sec()
+		<< ", \"latency_ns\": {\"mean\": " << mean_latency() << ", \"p50\": " << latency_percentile(0.5) << ", \"p99\": " << latency_percentile(0.99)
+		<< ", \"p999\": " << latency_percentile(0.999) << ", \"max\": " << latency_percentile(1.0) << "}, \"batch_sizes\": {";
+	bool first = true;
+	for (size_t b = 0; b < batch_counts.size(); ++b)
+	{
+		if (batch_counts[b] == 0)
+			continue;
+		// keyed by the largest batch size of the bucket
+		out << (first ? "" : ", ") << "\"" << (b ? (uint64_t(2) << (b - 1)) - 1 : 0) << "\": " << batch_counts[b];
+		first = false;
+	}
+	out << "}}" << std::endl;
+}
+
+/**
+ * Writes the counters in the Prometheus text exposition format: the latency as a summary with 0.5, 0.99 and 0.999 quantiles in seconds,
+ * the batch sizes as a histogram, the calls and samples as counters. Metric names start with the given prefix.
+ * @param out
+ * @param prefix
+ */
+void InferenceSnapshot::write_prometheus(ostream& out, const string& prefix) const
+{
+	out << std::setprecision(8);
+	out << "# HELP " << prefix << "_latency_seconds Latency of inference calls." << std::endl;
+	out << "# TYPE " << prefix << "_latency_seconds summary" << std::endl;
+	const double quantiles[] = { 0.5, 0.99, 0.999 };
+	for (auto q : quantiles)
+		out << prefix << "_latency_seconds{quantile=\"" << q << "\"} " << latency_percentile(q) * 1e-9 << std::endl;
+	out << prefix << "_latency_seconds_sum " << latency_sum_ns * 1e-9 << std::endl;
+	out << prefix << "_latency_seconds_count " << ncalls << std::endl;
+
+	out << "# HELP " << prefix << "_batch_size Samples per inference call." << std::endl;
+	out << "# TYPE " << prefix << "_batch_size histogram" << std::endl;
+	size_t last = 0;
+	for (size_t b = 0; b < batch_counts.size(); ++b)
+		if (batch_counts[b])
+			last = b;
+	uint64_t count = 0;
+	for (size_t b = 0; b <= last; ++b)
+	{
+		count += batch_counts[b];
+		out << prefix << "_batch_size_bucket{le=\"" << (b ? (uint64_t(2) << (b - 1)) - 1 : 0) << "\"} " << count << std::endl;
+	}
+	out << prefix << "_batch_size_bucket{le=\"+Inf\"} " << ncalls << std::endl;
+	out << prefix << "_batch_size_sum " << nsamples << std::endl;
+	out << prefix << "_batch_size_count " << ncalls << std::endl;
+
+	out << "# HELP " << prefix << "_calls_total Inference calls." << std::endl;
+	out << "# TYPE " << prefix << "_calls_total counter" << std::endl;
+	out << prefix << "_calls_total " << ncalls << std::endl;
+	out << "# HELP " << prefix << "_samples_total Samples evaluated by inference calls." << std::endl;
+	out << "# TYPE " << prefix << "_samples_total counter" << std::endl;
+	out << prefix << "_samples_total " << nsamples << std::endl;
+}
+
+InferenceStats::InferenceStats()
+	: id(next_stats_id++), reset_time(std::chrono::steady_clock::now())
+{
+}
+
+InferenceStats::~InferenceStats() {}
+
+/**
+ * Records a call of the given latency that evaluated nsamples samples. Can be called concurrently.
+ * @param latency_ns
+ * @param nsamples
+ */
+void InferenceStats::record(uint64_t latency_ns, size_t nsamples)
+{
+	Shard& shard = thread_shard();
+	bump(shard.ncalls, 1);
+	bump(shard.nsamples, nsamples);
+	bump(shard.latency_sum_ns, latency_ns);
+	bump(shard.latency_counts[latency_bucket(latency_ns)], 1);
+	bump(shard.batch_counts[batch_bucket(nsamples)], 1);
+}
+
+/**
+ * Sums the shards of every thread. Calls recorded concurrently may or may not be included.
+ * @param reset_ starts counting from zero after the snapshot
+ * @return InferenceSnapshot
+ */
+InferenceSnapshot InferenceStats::snapshot(bool reset_)
+{
+	std::lock_guard<std::mutex> lock(shards_mutex);
+	auto now = std::chrono::steady_clock::now();
+	InferenceSnapshot total = sum_shards();
+	InferenceSnapshot result = total;
+	result.ncalls -= baseline.ncalls;
+	result.nsamples -= baseline.nsamples;
+	result.latency_sum_ns -= baseline.latency_sum_ns;
+	for (size_t b = 0; b < nlatency_buckets; ++b)
+		result.latency_counts[b] -= baseline.latency_counts[b];
+	for (size_t b = 0; b < nbatch_buckets; ++b)
+		result.batch_counts[b] -= baseline.batch_counts[b];
+	result.elapsed = std::chrono::duration<double>(now - reset_time).count();
+	if (reset_)
+	{
+		baseline = total;
+		reset_time = now;
+	}
+	return result;
+}
+
+/**
+ * Starts counting from zero.
+ */
+void InferenceStats::reset()
+{
+	snapshot(true);
+}
+
+/**
+ * Bucket of a latency value: values below 16 have their own bucket, larger ones share a bucket with the values of the same
+ * 4 most significant bits.
+ * @param latency_ns
+ * @return size_t
+ */
+size_t InferenceStats::latency_bucket(uint64_t latency_ns)
+{
+	if (latency_ns < 16)
+		return static_cast<size_t>(latency_ns);
+	unsigned shift = msb(latency_ns) - 4;
+	size_t bucket = 16 * (shift + 1) + static_cast<size_t>((latency_ns >> shift) - 16);
+	return std::min(bucket, nlatency_buckets - 1);
+}
+
+/**
+ * Highest latency falling into a bucket.
+ * @param bucket
+ * @return uint64_t
+ */
+uint64_t InferenceStats::latency_bucket_limit(size_t bucket)
+{
+	if (bucket < 16)
+		return bucket;
+	unsigned shift = static_cast<unsigned>(bucket / 16 - 1);
+	return ((16 + bucket % 16 + uint64_t(1)) << shift) - 1;
+}
+
+/**
+ * Bucket of a batch size: the number of bits of the size (1, 2-3, 4-7, ...), 0 for empty batches.
+ * @param nsamples
+ * @return size_t
+ */
+size_t InferenceStats::batch_bucket(size_t nsamples)
+{
+	if (nsamples == 0)
+		return 0;
+	return std::min<size_t>(msb(nsamples) + 1, nbatch_buckets - 1);
+}
+
+/**
+ * Returns the shard of the calling thread, creating it on its first call.
+ * @return Shard&
+ */
+InferenceStats::Shard& InferenceStats::thread_shard()
+{
+	for (size_t c = 0; c < ncached_shards; ++c)
+		if (shard_cache[c].stats_id == id)
+			return *static_cast<Shard*>(shard_cache[c].shard);
+
+	std::lock_guard<std::mutex> lock(shards_mutex);
+	auto thread = std::this_thread::get_id();
+	size_t s = std::find(shard_threads.begin(), shard_threads.end(), thread) - shard_threads.begin();
+	if (s == shards.size())
+	{
+		shards.push_back(std::unique_ptr<Shard>(new Shard()));
+		shard_threads.push_back(thread);
+	}
+	auto& cached = shard_cache[next_cache_slot++ % ncached_shards];
+	cached.stats_id = id;
+	cached.shard = shards[s].get();
+	return *shards[s];
+}
+
+/**
+ * Sums the counters of every shard.
+ * @return InferenceSnapshot
+ */
+InferenceSnapshot InferenceStats::sum_shards() const
+{
+	InferenceSnapshot total;
+	for (auto& shard : shards)
+	{
+		total.ncalls += shard->ncalls.load(std::memory_order_relaxed);
+		total.nsamples += shard->nsamples.load(std::memory_order_relaxed);
+		total.latency_sum_ns += shard->latency_sum_ns.load(std::memory_order_relaxed);
+		for (size_t b = 0; b < nlatency_buckets; ++b)
+			total.latency_counts[b] += shard->latency_counts[b].load(std::memory_order_relaxed);
+		for (size_t b = 0; b < nbatch_buckets; ++b)
+			total.batch_counts[b] += shard->batch_counts[b].load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,192 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _INFERENCESTATS_H
+#define _INFERENCESTATS_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <cstdint>
+
+using std::vector;
+using std::string;
+using std::ostream;
+
+namespace NNlight {
+
+/**
+ * Counters of the inference calls recorded by an InferenceStats since it was last reset.
+ */
+struct InferenceSnapshot
+{
+	InferenceSnapshot();
+
+	/**
+	 * Number of calls and of the samples evaluated by them.
+	 */
+	uint64_t ncalls, nsamples;
+	/**
+	 * Sum of the call latencies in nanoseconds.
+	 */
+	uint64_t latency_sum_ns;
+	/**
+	 * Number of calls per latency bucket (see InferenceStats::latency_bucket) and per batch size bucket (see InferenceStats::batch_bucket).
+	 */
+	vector<uint64_t> latency_counts;
+	vector<uint64_t> batch_counts;
+	/**
+	 * Seconds since the reset.
+	 */
+	double elapsed;
+
+	/**
+	 * Latency in nanoseconds that the given ratio (e.g. 0.99) of the calls did not exceed, within the precision of the buckets (about 6%).
+	 * @param ratio in [0, 1]
+	 */
+	double latency_percentile(double ratio) const;
+
+	double mean_latency() const;
+	double samples_per_sec() const;
+
+	/**
+	 * Writes the counters, the mean, p50, p99, p999 and maximum latencies and the batch size distribution as a JSON object.
+	 * @param out
+	 */
+	void write_json(ostream& out) const;
+
+	/**
+	 * Writes the counters in the Prometheus text exposition format: the latency as a summary with 0.5, 0.99 and 0.999 quantiles in seconds,
+	 * the batch sizes as a histogram, the calls and samples as counters. Metric names start with the given prefix.
+	 * @param out
+	 * @param prefix
+	 */
+	void write_prometheus(ostream& out, const string& prefix = "nnlight_inference") const;
+};
+
+/**
+ * Collects latency histograms, call and sample counters and the batch size distribution of inference calls (see NeuronNetwork::collect_inference_stats
+ * and CompiledNetwork::collect_inference_stats). Every thread records to its own shard, so recording takes no lock; the shards are summed by snapshot().
+ * Latencies are kept in log-linear buckets: 16 buckets per power of two, up to about 18 minutes. The recording is compiled out if NNLIGHT_NO_PROFILING is defined.
+ */
+class InferenceStats
+{
+public:
+	InferenceStats();
+	~InferenceStats();
+
+	/**
+	 * Records a call of the given latency that evaluated nsamples samples. Can be called concurrently.
+	 * @param latency_ns
+	 * @param nsamples
+	 */
+	void record(uint64_t latency_ns, size_t nsamples);
+
+	/**
+	 * Sums the shards of every thread. Calls recorded concurrently may or may not be included.
+	 * @param reset_ starts counting from zero after the snapshot
+	 */
+	InferenceSnapshot snapshot(bool reset_ = false);
+
+	/**
+	 * Starts counting from zero.
+	 */
+	void reset();
+
+	static const size_t nlatency_buckets = 592;
+	static const size_t nbatch_buckets = 32;
+
+	/**
+	 * Bucket of a latency value: values below 16 have their own bucket, larger ones share a bucket with the values of the same
+	 * 4 most significant bits.
+	 * @param latency_ns
+	 */
+	static size_t latency_bucket(uint64_t latency_ns);
+
+	/**
+	 * Highest latency falling into a bucket.
+	 * @param bucket
+	 */
+	static uint64_t latency_bucket_limit(size_t bucket);
+
+	/**
+	 * Bucket of a batch size: the number of bits of the size (1, 2-3, 4-7, ...), 0 for empty batches.
+	 * @param nsamples
+	 */
+	static size_t batch_bucket(size_t nsamples);
+
+private:
+	InferenceStats(const InferenceStats&); // not copyable
+	InferenceStats& operator=(const InferenceStats&);
+
+	struct Shard;
+
+	/**
+	 * Returns the shard of the calling thread, creating it on its first call.
+	 */
+	Shard& thread_shard();
+
+	/**
+	 * Sums the counters of every shard.
+	 */
+	InferenceSnapshot sum_shards() const;
+
+	/**
+	 * Identifies the instance in the per-thread shard caches, never reused.
+	 */
+	uint64_t id;
+	mutable std::mutex shards_mutex;
+	vector<std::unique_ptr<Shard>> shards;
+	vector<std::thread::id> shard_threads;
+	/**
+	 * Sums of the shards at the last reset, subtracted by snapshot().
+	 */
+	InferenceSnapshot baseline;
+	std::chrono::steady_clock::time_point reset_time;
+};
+
+/**
+ * Records the time from its construction to its destruction as an inference call of nsamples samples. Does nothing if the stats are null.
+ */
+class InferenceTimer
+{
+public:
+	InferenceTimer(InferenceStats* stats_, size_t nsamples_)
+		: stats(stats_), nsamples(nsamples_)
+	{
+		if (stats)
+			start = std::chrono::steady_clock::now();
+	}
+
+	~InferenceTimer()
+	{
+		if (stats)
+			stats->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), nsamples);
+	}
+
+private:
+	InferenceTimer(const InferenceTimer&); // not copyable
+	InferenceTimer& operator=(const InferenceTimer&);
+
+	InferenceStats* stats;
+	size_t nsamples;
+	std::chrono::steady_clock::time_point start;
+};
+
+}
+
+/**
+ * Times the rest of the enclosing scope as an inference call of nsamples samples, recorded to stats (InferenceStats*, may be null).
+ */
+#ifndef NNLIGHT_NO_PROFILING
+#define NNLIGHT_TIME_INFERENCE(stats, nsamples) NNlight::InferenceTimer inference_timer(stats, nsamples)
+#else
+#define NNLIGHT_TIME_INFERENCE(stats, nsamples)
+#endif
+
+#endif //_INFERENCESTATS_H
\ No newline at end of file
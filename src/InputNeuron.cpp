@@ -28,8 +28,8 @@ InputNeuron::InputNeuron(double learning_rate_, double regularization_)
 void InputNeuron::feed(double input) 
 {
 	activation = input;
-	for (auto& out : outputs)
-		out->propagate(shared_from_this(), activation);
+	for (auto out : output_neurons)
+		out->receive();
 }
 
 /**
@@ -49,4 +49,25 @@ void InputNeuron::propagate(NeuronPtr from, double act)
  */
 void InputNeuron::backpropagate(NeuronPtr from, double err) {}
 
+/**
+ * Creates an unconnected copy of the neuron with the same weights and learning parameters.
+ * @return NeuronPtr
+ */
+NeuronPtr InputNeuron::clone() const
+{
+	auto copy = clone_as<InputNeuron>();
+	static_cast<InputNeuron&>(*copy).output_slots.clear();
+	return copy;
+}
+
+/**
+ * Feeds the (nonzero) activation to the output neurons that have InputNeurons as their only inputs, without counting the input as arrived.
+ */
+void InputNeuron::propagate_active()
+{
+	for (size_t i = 0; i < output_neurons.size(); ++i)
+		if (output_neurons[i]->has_sparse_inputs())
+			output_neurons[i]->receive_active_input(output_slots[i], activation);
+}
+
 }
\ No newline at end of file
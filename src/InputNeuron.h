@@ -11,6 +11,9 @@ namespace NNlight {
 
 class InputNeuron: public Neuron
 {
+	friend class Neuron;
+	friend class NeuronNetwork;
+
 public: 
     
     /**
@@ -38,6 +41,22 @@ public:
      * @param err
      */
     void backpropagate(NeuronPtr from, double err);
+
+	/**
+	 * Creates an unconnected copy of the neuron with the same weights and learning parameters.
+	 */
+	NeuronPtr clone() const;
+
+private:
+	/**
+	 * Feeds the (nonzero) activation to the output neurons that have InputNeurons as their only inputs, without counting the input as arrived.
+	 */
+	void propagate_active();
+
+	/**
+	 * Index of this neuron among the input neurons of each output neuron, aligned with output_neurons.
+	 */
+	vector<size_t> output_slots;
 };
 
 typedef shared_ptr<InputNeuron> InputNeuronPtr;
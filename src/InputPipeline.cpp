@@ -0,0 +1,185 @@
+/**
+ * Project NNlight
+ */
+
+#include "InputPipeline.h"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+/**
+ * InputPipeline implementation
+ *
+ * The ring indices and counters are guarded by the mutex, the buffers themselves are not: a buffer is written by the producer only while it is
+ * not among the nfilled ones, and read by the consumer only while it is. A condition variable is only notified if the other thread waits on it,
+ * and the clock is only read when a thread has to wait, and around gathering.
+ */
+
+namespace NNlight {
+
+PipelineStats::PipelineStats()
+	: nbatches(0), nconsumer_stalls(0), nproducer_stalls(0), consumer_wait_ms(0), producer_wait_ms(0), gather_ms(0)
+{
+}
+
+/**
+ * Allocates the buffers and starts the producer thread. The samples have to outlive the pipeline.
+ * @param input_
+ * @param desired_output_
+ * @param ninputs_ number of values per input sample
+ * @param noutputs_ number of values per desired output sample
+ * @param nbuffers number of batch buffers, at least 2
+ * @param batch_size_ samples per batch
+ */
+InputPipeline::InputPipeline(const vector<vector<double>>& input_, const vector<vector<double>>& desired_output_, size_t ninputs_, size_t noutputs_,
+	size_t nbuffers, size_t batch_size_)
+	: input(input_), desired_output(desired_output_), ninputs(ninputs_), noutputs(noutputs_), batch_size(batch_size_),
+	read_index(0), write_index(0), nfilled(0), holding(false), samples(nullptr), nsamples(0), nbatches(0), nproduced(0), nconsumed(0), stopping(false),
+	producer_waiting(false), consumer_waiting(false)
+{
+	if (nbuffers < 2)
+		throw std::runtime_error("Input pipeline needs at least 2 buffers!");
+	if (batch_size == 0)
+		throw std::runtime_error("Batch size of the input pipeline has to be positive!");
+	buffers.resize(nbuffers);
+	for (auto& buffer : buffers)
+	{
+		buffer.input.resize(batch_size * ninputs);
+		buffer.desired_output.resize(batch_size * noutputs);
+		buffer.nsamples = 0;
+	}
+	producer = std::thread(&InputPipeline::produce, this);
+}
+
+/**
+ * Stops the producer thread, also in the middle of an epoch.
+ */
+InputPipeline::~InputPipeline()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	producer_cond.notify_one();
+	producer.join();
+}
+
+/**
+ * Starts gathering the batches of an epoch. The previous epoch has to be consumed up to its end, and the order has to stay unchanged
+ * until the end of this epoch.
+ * @param samples_ indices of the samples in the order of the epoch
+ * @param nsamples_
+ */
+void InputPipeline::start_epoch(const size_t* samples_, size_t nsamples_)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (nconsumed != nbatches || holding)
+			throw std::runtime_error("Previous epoch of the input pipeline is not consumed!");
+		samples = samples_;
+		nsamples = nsamples_;
+		nbatches = (nsamples + batch_size - 1) / batch_size;
+		nproduced = nconsumed = 0;
+	}
+	producer_cond.notify_one();
+}
+
+/**
+ * Releases the batch returned by the previous call and waits for the next batch of the epoch.
+ * @param batch valid until the next call
+ * @return false at the end of the epoch
+ */
+bool InputPipeline::next(InputBatch& batch)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (holding)
+	{
+		holding = false;
+		read_index = (read_index + 1) % buffers.size();
+		--nfilled;
+		if (producer_waiting)
+			producer_cond.notify_one();
+	}
+	if (nconsumed == nbatches)
+		return false;
+	if (nfilled == 0)
+	{
+		++stats.nconsumer_stalls;
+		auto wait_start = std::chrono::steady_clock::now();
+		consumer_waiting = true;
+		consumer_cond.wait(lock, [this] { return nfilled > 0; });
+		consumer_waiting = false;
+		stats.consumer_wait_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wait_start).count();
+	}
+	const Buffer& buffer = buffers[read_index];
+	batch.nsamples = buffer.nsamples;
+	batch.input = buffer.input.data();
+	batch.desired_output = buffer.desired_output.data();
+	holding = true;
+	++nconsumed;
+	return true;
+}
+
+/**
+ * Returns the counters since the pipeline was created.
+ * @return PipelineStats
+ */
+PipelineStats InputPipeline::get_stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+/**
+ * Body of the producer thread.
+ */
+void InputPipeline::produce()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		producer_waiting = true;
+		producer_cond.wait(lock, [this] { return stopping || nproduced < nbatches; });
+		producer_waiting = false;
+		if (stopping)
+			return;
+		if (nfilled == buffers.size())
+		{
+			++stats.nproducer_stalls;
+			auto wait_start = std::chrono::steady_clock::now();
+			producer_waiting = true;
+			producer_cond.wait(lock, [this] { return stopping || nfilled < buffers.size(); });
+			producer_waiting = false;
+			stats.producer_wait_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wait_start).count();
+			if (stopping)
+				return;
+		}
+		Buffer& buffer = buffers[write_index];
+		const size_t* batch_samples = samples + nproduced * batch_size;
+		const size_t batch_nsamples = std::min(batch_size, nsamples - nproduced * batch_size);
+		lock.unlock();
+
+		// gather the samples into the buffer, out of the lock
+		auto gather_start = std::chrono::steady_clock::now();
+		double* in = buffer.input.data();
+		double* dout = buffer.desired_output.data();
+		for (size_t s = 0; s < batch_nsamples; ++s, in += ninputs, dout += noutputs)
+		{
+			std::copy(input[batch_samples[s]].begin(), input[batch_samples[s]].begin() + ninputs, in);
+			std::copy(desired_output[batch_samples[s]].begin(), desired_output[batch_samples[s]].begin() + noutputs, dout);
+		}
+		buffer.nsamples = batch_nsamples;
+		auto gather_end = std::chrono::steady_clock::now();
+
+		lock.lock();
+		stats.gather_ms += std::chrono::duration<double, std::milli>(gather_end - gather_start).count();
+		++stats.nbatches;
+		write_index = (write_index + 1) % buffers.size();
+		++nfilled;
+		++nproduced;
+		if (consumer_waiting)
+			consumer_cond.notify_one();
+	}
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _INPUTPIPELINE_H
+#define _INPUTPIPELINE_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+using std::vector;
+
+namespace NNlight {
+
+/**
+ * Counters of an InputPipeline. A consumer stall is a batch the trainer had to wait for: the training is input-bound. A producer stall
+ * is a batch the producer could not start because all buffers were in use (back-pressure): the training is compute-bound.
+ */
+struct PipelineStats
+{
+	PipelineStats();
+
+	/**
+	 * Number of batches gathered.
+	 */
+	uint64_t nbatches;
+	uint64_t nconsumer_stalls, nproducer_stalls;
+	/**
+	 * Milliseconds spent waiting by the consumer and by the producer, and spent gathering by the producer.
+	 */
+	double consumer_wait_ms, producer_wait_ms, gather_ms;
+};
+
+/**
+ * Samples of a batch gathered by an InputPipeline, each sample contiguous: nsamples x ninputs input values and nsamples x noutputs desired outputs.
+ */
+struct InputBatch
+{
+	size_t nsamples;
+	const double* input;
+	const double* desired_output;
+};
+
+/**
+ * Gathers the train samples of an epoch, in the order of the epoch, into contiguous batches on a background thread, while the trainer consumes
+ * the previous batches (see NeuronNetwork::NNSettings::set_input_pipeline). The batches are kept in a ring of buffers allocated up front,
+ * so the producer is at most nbuffers - 1 batches ahead of the consumer, and waits for a buffer to be released otherwise.
+ */
+class InputPipeline
+{
+public:
+	/**
+	 * Allocates the buffers and starts the producer thread. The samples have to outlive the pipeline.
+	 * @param input_
+	 * @param desired_output_
+	 * @param ninputs_ number of values per input sample
+	 * @param noutputs_ number of values per desired output sample
+	 * @param nbuffers number of batch buffers, at least 2
+	 * @param batch_size_ samples per batch
+	 */
+	InputPipeline(const vector<vector<double>>& input_, const vector<vector<double>>& desired_output_, size_t ninputs_, size_t noutputs_,
+		size_t nbuffers, size_t batch_size_);
+
+	/**
+	 * Stops the producer thread, also in the middle of an epoch.
+	 */
+	~InputPipeline();
+
+	/**
+	 * Starts gathering the batches of an epoch. The previous epoch has to be consumed up to its end, and the order has to stay unchanged
+	 * until the end of this epoch.
+	 * @param samples_ indices of the samples in the order of the epoch
+	 * @param nsamples_
+	 */
+	void start_epoch(const size_t* samples_, size_t nsamples_);
+
+	/**
+	 * Releases the batch returned by the previous call and waits for the next batch of the epoch.
+	 * @param batch valid until the next call
+	 * @return false at the end of the epoch
+	 */
+	bool next(InputBatch& batch);
+
+	/**
+	 * Returns the counters since the pipeline was created.
+	 */
+	PipelineStats get_stats() const;
+
+private:
+	InputPipeline(const InputPipeline&); // not copyable
+	InputPipeline& operator=(const InputPipeline&);
+
+	/**
+	 * Body of the producer thread.
+	 */
+	void produce();
+
+	struct Buffer
+	{
+		vector<double> input, desired_output;
+		size_t nsamples;
+	};
+
+	const vector<vector<double>>& input;
+	const vector<vector<double>>& desired_output;
+	size_t ninputs, noutputs, batch_size;
+
+	/**
+	 * Ring of buffers: nfilled buffers from read_index are ready or held by the consumer, the producer writes write_index next.
+	 */
+	vector<Buffer> buffers;
+	size_t read_index, write_index, nfilled;
+	bool holding;
+
+	/**
+	 * Order of the current epoch, and the number of its batches, produced and consumed so far.
+	 */
+	const size_t* samples;
+	size_t nsamples, nbatches, nproduced, nconsumed;
+
+	bool stopping;
+	bool producer_waiting, consumer_waiting;
+	PipelineStats stats;
+	mutable std::mutex mutex;
+	std::condition_variable producer_cond, consumer_cond;
+	std::thread producer;
+};
+
+}
+
+#endif //_INPUTPIPELINE_H
\ No newline at end of file
@@ -0,0 +1,71 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _MODELFORMAT_H
+#define _MODELFORMAT_H
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Layout of the binary model file written by NeuronNetwork::save() and mapped by CompiledNetwork.
+ *
+ * [Header][NeuronRecord x nneurons][input ids][output ids][sources][weights]
+ *
+ * Neurons are stored in topological order, so one pass over the records evaluates the network. The input weights of each
+ * neuron form a contiguous block starting at NeuronRecord::first_weight, and the source ids of the same slots tell which
+ * neuron each weight belongs to. Weight blocks start on block_alignment byte boundaries (padding slots have no_source as
+ * source id and zero weight), so a mapped file is used as it is, without any parsing or copying.
+ * Values are stored in the byte order of the saving machine, endian_tag detects a mismatch.
+ */
+
+namespace NNlight {
+namespace ModelFormat {
+
+const char magic[8] = { 'N', 'N', 'L', 'I', 'G', 'H', 'T', '\0' };
+const uint32_t version = 2; // written by save(), version 2 added the SOFTMAX activation
+const uint32_t min_version = 1; // oldest version read
+const uint32_t endian_tag = 0x01020304;
+const size_t block_alignment = 64;
+const uint32_t no_source = 0xFFFFFFFF;
+
+enum NeuronKind { INPUT_NEURON = 0, HIDDEN_NEURON = 1, OUTPUT_NEURON = 2 };
+enum Activation { IDENTITY = 0, SIGMOID = 1, SOFTMAX = 2 }; // SOFTMAX: the sums of all output neurons are normalized together, output neurons only
+
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t endian_tag;
+	uint32_t nneurons;
+	uint32_t ninputs;
+	uint32_t noutputs;
+	uint32_t reserved;
+	uint64_t nweights; // number of weight slots, including padding
+	uint64_t neurons_offset;
+	uint64_t input_ids_offset;
+	uint64_t output_ids_offset;
+	uint64_t sources_offset;
+	uint64_t weights_offset;
+	uint64_t file_size;
+	uint64_t reserved_[5];
+};
+
+struct NeuronRecord
+{
+	uint32_t kind; // NeuronKind
+	uint32_t activation; // Activation
+	uint32_t ninputs;
+	uint32_t reserved;
+	uint64_t first_weight;
+	double biasweight;
+};
+
+static_assert(sizeof(Header) == 128, "Unexpected model header size!");
+static_assert(sizeof(NeuronRecord) == 32, "Unexpected model neuron record size!");
+
+}
+}
+
+#endif //_MODELFORMAT_H
@@ -3,6 +3,8 @@
  */
 
 #include "Neuron.h"
+#include "InputNeuron.h"
+#include <algorithm>
 #include <iostream> // TODO rm
 
 /**
@@ -17,6 +19,7 @@ double Neuron::def_learning_rate = 0.01;
 double Neuron::def_regularization = 0.05;
 double Neuron::def_weight_lower_bound = -1.0;
 double Neuron::def_weight_upper_bound = 1.0;
+std::atomic<uint64_t> Neuron::generation(1);
 
 const double Neuron::Rprop::def_delta0 = 0.1;
 const double Neuron::Rprop::def_deltamax = 50.0;
@@ -29,50 +32,91 @@ const double Neuron::Rprop::def_decr_factor = 0.5;
  */
 
 Neuron::Neuron(double learning_rate_, double regularization_)
-	: learning_rate(learning_rate_), regularization(regularization_), activation(0.0), use_rprop(false)
+	: ninputs_received(0), ninput_neurons(0), sparse_pass(false), active_inputs_stale(false), error_sum(0.0), nerrors_received(0), activation(0.0),
+	learning_rate(learning_rate_), regularization(regularization_), use_rprop(false), linear_activation(false), tied_weights(false)
 {
 	// rand biasweight
-	std::uniform_real_distribution<double> distr(def_weight_lower_bound, def_weight_upper_bound);
-	std::random_device rand_dev;
-	biasweight = distr(rand_dev);
+	biasweight = RandomGenerator::shared_uniform(def_weight_lower_bound, def_weight_upper_bound);
 }
 Neuron::~Neuron() {}
 
 /**
- * Induces input, activating the neuron.
+ * Induces input, activating the neuron when all input neurons have propagated. The activations are read from the input neurons, act has to be the activation of 'from'.
  * @param from
  * @param act
  */
 void Neuron::propagate(NeuronPtr from, double act)
 {
-	if (input_weights.find(from) == input_weights.end())
-		throw std::exception("Neuron that propagated potential is not connected as input!");
-	if (inputs.find(from) != inputs.end())
-		throw std::exception("Activation is already propagated from given neuron!");
+	auto input = std::find(input_neurons.begin(), input_neurons.end(), from);
+	if (input == input_neurons.end())
+		throw std::runtime_error("Neuron that propagated potential is not connected as input!");
 
-	inputs.insert(std::make_pair(from, act));
-	if (inputs.size() == input_weights.size()) // all input neuron propagated their activation
-	{
-		// calculate activation
-		auto& tmp_weights = input_weights;
-		activation = std::accumulate(inputs.begin(), inputs.end(), biasweight,
-			[&tmp_weights] (double acc, const std::pair<NeuronPtr, double>& in) {
-				return acc + tmp_weights[in.first] * in.second;
-		});
-		activation = 1.0 / (1.0 + std::exp(-activation)); // sigmoid nonlinear function
+	receive();
+}
 
-		// remove all inputs
-		inputs.clear();
+/**
+ * Counts input neurons that propagated their activation. Activates the neuron from the activations of its input neurons and propagates further when all of them have arrived.
+ * @param ninputs number of input neurons arrived
+ */
+void Neuron::receive(size_t ninputs)
+{
+	if (active_inputs_stale)
+	{
+		active_inputs.clear();
+		sparse_pass = false;
+		active_inputs_stale = false;
+	}
 
-		if (_isnan(activation))
+	ninputs_received += ninputs;
+	if (ninputs_received == input_neurons.size()) // all input neuron propagated their activation
+	{
+		// calculate activation
+		activation = biasweight;
+		if (sparse_pass) // zero inputs are not stored
+			for (auto& in : active_inputs)
+				activation += input_weights[in.first] * in.second;
+		else
+			for (size_t i = 0; i < input_weights.size(); ++i)
+				activation += input_weights[i] * input_neurons[i]->activation;
+		if (!linear_activation)
+			activation = 1.0 / (1.0 + std::exp(-activation)); // sigmoid nonlinear function
+		ninputs_received = 0;
+		active_inputs_stale = true;
+
+		if (activation != activation) // NaN
 			throw ActivationOutOfBoundsException();
 
 		// propage activation further
-		for (auto& out : outputs)
-			out->propagate(shared_from_this(), activation);
+		for (auto out : output_neurons)
+			out->receive();
 	}
 }
 
+/**
+ * Stores a nonzero input fed to the neuron by an InputNeuron, called before the input neuron is counted by receive().
+ * @param input_index
+ * @param act
+ */
+void Neuron::receive_active_input(size_t input_index, double act)
+{
+	if (active_inputs_stale)
+	{
+		active_inputs.clear();
+		active_inputs_stale = false;
+	}
+	active_inputs.push_back(std::make_pair(input_index, act));
+	sparse_pass = true;
+}
+
+/**
+ * True if all input neurons are InputNeurons, so the neuron can be fed sparsely.
+ * @return bool
+ */
+bool Neuron::has_sparse_inputs() const
+{
+	return ninput_neurons > 0 && ninput_neurons == input_neurons.size();
+}
+
 /**
  * Forces the neuron to alter its weight (that is connects this to the 'from' neuron) if necessary.
  * @param from
@@ -80,56 +124,79 @@ void Neuron::propagate(NeuronPtr from, double act)
  */
 void Neuron::backpropagate(NeuronPtr from, double err)
 {
-	if (outputs.find(from) == outputs.end())
-		throw std::exception("Neuron that backpropagated potential is not connected as output!");
-	if (errors.find(from) != errors.end())
-		throw std::exception("Activation is already backpropagated from given neuron!");
-
-	errors.insert(std::make_pair(from, err));
-	if (errors.size() == outputs.size()) // all output neuron backpropagated their activation
+	error_sum += err; // already multiplied by output weight
+	if (++nerrors_received == output_neurons.size()) // all output neuron backpropagated their activation
 	{
 		// calculate delta value
-		double delta = std::accumulate(errors.begin(), errors.end(), 0.0,
-			[] (double acc, const std::pair<NeuronPtr, double>& err) {
-				return acc + err.second; // already multiplied by output weight
-		});
-
-		// adjust bias & input weights
-		if (use_rprop) biasweight += rprop(delta);
-		else biasweight -= learning_rate * delta;
-		for (auto& in : input_weights)
-		{
-			auto grad = in.first->activation * delta * activation * (1.0 - activation) - regularization * in.second;
-			if (use_rprop) in.second += rprop(in.first, grad);
-			else in.second -= learning_rate * grad;
-		}
+		double delta = error_sum;
+		error_sum = 0;
+		nerrors_received = 0;
 
-		// remove all errors
-		errors.clear();
+		learn(delta);
+	}
+}
 
-		// bacpropage error further
-		for (auto& in : input_weights)
-			in.first->backpropagate(shared_from_this(), delta * in.second); // multiplied by input weight
+/**
+ * Adjusts the bias and input weights by the delta value of the neuron and backpropagates the error to the input neurons.
+ * Only the weights of the nonzero inputs get the gradient of the error if the neuron was fed sparsely (the regularization term applies to every weight).
+ * @param delta
+ */
+void Neuron::learn(double delta)
+{
+	// adjust bias & input weights
+	if (use_rprop) biasweight += rprop(delta);
+	else biasweight -= learning_rate * delta;
+	const double sum_delta = linear_activation ? delta : delta * activation * (1.0 - activation); // derivative of the sigmoid
+	if (sparse_pass && !use_rprop) // Rprop steps every weight, even by a zero gradient
+	{
+		if (regularization != 0.0)
+			for (auto& weight : input_weights)
+				weight += learning_rate * regularization * weight;
+		for (auto& in : active_inputs)
+			input_weights[in.first] -= learning_rate * in.second * sum_delta;
+		return; // InputNeurons do not learn
+	}
+	for (size_t i = 0; i < input_weights.size(); ++i)
+	{
+		auto grad = input_neurons[i]->activation * sum_delta - regularization * input_weights[i];
+		if (use_rprop) input_weights[i] += rprop(i, grad);
+		else input_weights[i] -= learning_rate * grad;
 	}
+	if (has_sparse_inputs())
+		return;
+
+	// bacpropage error further
+	auto self = shared_from_this();
+	for (size_t i = 0; i < input_weights.size(); ++i)
+		input_neurons[i]->backpropagate(self, delta * input_weights[i]); // multiplied by input weight
 }
 
 /**
- * Randomize a new value for all weights (including the bias) in the range of [lower_bound, upper_bound). Also clears inputs, and errors.
+ * Randomize a new value for all weights (including the bias) in the range of [lower_bound, upper_bound), seeded from RandomGenerator::shared_next(). Also clears inputs, and errors.
  * @param lower_bound
  * @param upper_bound
  */
 void Neuron::reset(double lower_bound, double upper_bound)
+{
+	RandomGenerator gen(RandomGenerator::shared_next());
+	reset(gen, lower_bound, upper_bound);
+}
+
+/**
+ * Randomize a new value for all weights (including the bias) in the range of [lower_bound, upper_bound), drawn from the given generator. Also clears inputs, and errors.
+ * @param gen
+ * @param lower_bound
+ * @param upper_bound
+ */
+void Neuron::reset(RandomGenerator& gen, double lower_bound, double upper_bound)
 {
 	if (upper_bound <= lower_bound)
-		throw std::exception("Upper bound must be greater than lower bound!");
+		throw std::runtime_error("Upper bound must be greater than lower bound!");
 	
-	std::uniform_real_distribution<double> distr(lower_bound, upper_bound);
-	std::random_device rand_dev;
-	biasweight = distr(rand_dev);
-	for (auto& in : input_weights)
-		in.second = distr(rand_dev);
-	inputs.clear();
-	errors.clear();
+	biasweight = gen.uniform(lower_bound, upper_bound);
+	if (!input_weights.empty())
+		gen.fill_uniform(input_weights.data(), input_weights.size(), lower_bound, upper_bound);
+	clear_propagation();
 	activation = 0;
 	rprop.reset();
 }
@@ -156,34 +223,276 @@ void Neuron::use_default_backpropation(double learning_rate_, double regularizat
  */
 void Neuron::use_resilient_backpropagation(double delta0, double deltamax, double incr_factor, double decr_factor)
 {
-	rprop = Rprop(input_weights, delta0, deltamax, incr_factor, decr_factor);
+	rprop = Rprop(input_weights.size(), delta0, deltamax, incr_factor, decr_factor);
 	use_rprop = true;
 }
 
 /**
- * Connects the given 'neuro' neuron as an input of this neuron.
- * @param neuro
+ * Connects two given neurons: from --> to. Throws if they are already connected.
+ * @param from
+ * @param to
+ */
+void Neuron::connect_neurons(const NeuronPtr& from, const NeuronPtr& to)
+{
+	// hash lookup, so connecting the inputs one by one is linear in their number
+	auto& index = to->input_index;
+	if (index.size() != to->input_neurons.size())
+	{
+		index.clear();
+		for (auto& in : to->input_neurons)
+			index.insert(in.get());
+	}
+	if (!index.insert(from.get()).second)
+		throw std::runtime_error("Neuron is already connected as input!");
+	topology_changed();
+
+	auto input = dynamic_cast<InputNeuron*>(from.get());
+	if (input)
+	{
+		input->output_slots.push_back(to->input_neurons.size());
+		++to->ninput_neurons;
+	}
+	from->output_neurons.push_back(to.get());
+	to->input_neurons.push_back(from);
+	to->input_weights.push_back(RandomGenerator::shared_uniform(def_weight_lower_bound, def_weight_upper_bound));
+}
+
+/**
+ * Connects two given layers of neurons in one pass: each neuron from layer_from is connected to each neuron of layer_to. Storage is sized once
+ * and the weights of each neuron in layer_to are drawn together from the shared random stream (see RandomGenerator::seed_shared).
+ * @param layer_from
+ * @param layer_to
+ * @param init scheme of the initial weights
+ */
+void Neuron::connect_layers(const vector<NeuronPtr>& layer_from, const vector<NeuronPtr>& layer_to, WeightInit init)
+{
+	if (layer_from.empty() || layer_to.empty())
+		return;
+
+	// no pair of neurons may be connected twice
+	unordered_set<const Neuron*> from_set;
+	for (auto& from : layer_from)
+		if (!from_set.insert(from.get()).second)
+			throw std::runtime_error("Neuron is listed twice in a layer!");
+	unordered_set<const Neuron*> to_set;
+	for (auto& to : layer_to)
+	{
+		if (!to_set.insert(to.get()).second)
+			throw std::runtime_error("Neuron is listed twice in a layer!");
+		for (auto& in : to->input_neurons)
+			if (from_set.count(in.get()))
+				throw std::runtime_error("Neuron is already connected as input!");
+	}
+
+	double lower_bound = def_weight_lower_bound;
+	double upper_bound = def_weight_upper_bound;
+	if (init == XAVIER_INIT)
+	{
+		upper_bound = std::sqrt(6.0 / (layer_from.size() + layer_to.size()));
+		lower_bound = -upper_bound;
+	}
+	else if (init == HE_INIT)
+	{
+		upper_bound = std::sqrt(6.0 / layer_from.size());
+		lower_bound = -upper_bound;
+	}
+
+	size_t ninput_neurons = 0;
+	for (auto& from : layer_from)
+		if (dynamic_cast<InputNeuron*>(from.get()))
+			++ninput_neurons;
+
+	topology_changed();
+	RandomGenerator gen(RandomGenerator::shared_next());
+	vector<size_t> first_slots(layer_to.size());
+	for (size_t j = 0; j < layer_to.size(); ++j)
+	{
+		auto& to = layer_to[j];
+		size_t ninputs = to->input_neurons.size();
+		first_slots[j] = ninputs;
+		to->input_neurons.insert(to->input_neurons.end(), layer_from.begin(), layer_from.end());
+		to->input_index.clear();
+		to->input_weights.resize(ninputs + layer_from.size());
+		gen.fill_uniform(&to->input_weights[ninputs], layer_from.size(), lower_bound, upper_bound);
+		to->ninput_neurons += ninput_neurons;
+	}
+	for (size_t i = 0; i < layer_from.size(); ++i)
+	{
+		auto& from = layer_from[i];
+		from->output_neurons.reserve(from->output_neurons.size() + layer_to.size());
+		for (auto& to : layer_to)
+			from->output_neurons.push_back(to.get());
+
+		auto input = dynamic_cast<InputNeuron*>(from.get());
+		if (input)
+		{
+			input->output_slots.reserve(input->output_slots.size() + layer_to.size());
+			for (size_t j = 0; j < layer_to.size(); ++j)
+				input->output_slots.push_back(first_slots[j] + i);
+		}
+	}
+}
+
+/**
+ * Creates an unconnected copy of the neuron with the same weights, learning parameters and Rprop state.
+ * Connect the copy by replace_inputs().
+ * @return NeuronPtr
+ */
+NeuronPtr Neuron::clone() const
+{
+	return clone_as<Neuron>();
+}
+
+/**
+ * Connects the given neurons as inputs of a copy made by clone(), in place of the inputs of the original neuron.
+ * The i-th neuron gets the i-th input weight.
+ * @param inputs_
+ */
+void Neuron::replace_inputs(const vector<NeuronPtr>& inputs_)
+{
+	if (inputs_.size() != input_weights.size())
+		throw std::runtime_error("Number of inputs does not match the number of input weights!");
+
+	input_neurons = inputs_;
+	input_index.clear();
+	topology_changed();
+	ninputs_received = 0;
+	ninput_neurons = 0;
+	for (size_t i = 0; i < input_neurons.size(); ++i)
+	{
+		auto input = dynamic_cast<InputNeuron*>(input_neurons[i].get());
+		if (input)
+		{
+			input->output_slots.push_back(i);
+			++ninput_neurons;
+		}
+		input_neurons[i]->output_neurons.push_back(this);
+	}
+}
+
+/**
+ * Links a copy made by clone() to the copies of the neurons it shares state with, after all copies are connected. Nothing to link by default.
+ * @param copies copy of each neuron of the network
+ */
+void Neuron::replace_shared(const unordered_map<const Neuron*, NeuronPtr>& copies)
+{
+}
+
+/**
+ * Returns the weight of the bias input.
+ * @return double
+ */
+double Neuron::get_biasweight() const
+{
+	return biasweight;
+}
+
+/**
+ * Sets the weight of the bias input.
+ * @param biasweight_
+ */
+void Neuron::set_biasweight(double biasweight_)
+{
+	biasweight = biasweight_;
+}
+
+/**
+ * Returns the input neurons in the order they were connected.
+ * @return const vector<NeuronPtr>&
+ */
+const vector<NeuronPtr>& Neuron::get_input_neurons() const
+{
+	return input_neurons;
+}
+
+/**
+ * Returns the input weights, aligned with the neurons returned by get_input_neurons().
+ * @return const vector<double>&
+ */
+const vector<double>& Neuron::get_input_weights() const
+{
+	return input_weights;
+}
+
+/**
+ * Overwrites all input weights. Reads as many values as the number of input neurons, in the order of get_input_neurons().
+ * @param weights
+ */
+void Neuron::set_input_weights(const double* weights)
+{
+	std::copy(weights, weights + input_weights.size(), input_weights.begin());
+}
+
+/**
+ * Returns the Rprop weight update predicate of the neuron, holding the adaptive state of the resilient backpropagation.
+ * @return const Rprop&
  */
-void Neuron::connect_input(NeuronPtr& neuro)
+const Neuron::Rprop& Neuron::get_rprop() const
 {
-	if (input_weights.find(neuro) != input_weights.end())
-		throw std::exception("Neuron is already connected as input!");
+	return rprop;
+}
 
-	std::uniform_real_distribution<double> distr(def_weight_lower_bound, def_weight_upper_bound);
-	std::random_device rand_dev;
-	input_weights.insert(std::make_pair(neuro, distr(rand_dev)));
+Neuron::Rprop& Neuron::get_rprop()
+{
+	return rprop;
 }
 
 /**
- * Connects the given 'neuro' neuron as an output of this neuron.
- * @param neuro
+ * Forgets the propagated input values and errors.
  */
-void Neuron::connect_output(NeuronPtr& neuro)
+void Neuron::clear_propagation()
 {
-	if (outputs.find(neuro) != outputs.end())
-		throw std::exception("Neuron is already connected as output!");
+	ninputs_received = 0;
+	active_inputs.clear();
+	sparse_pass = false;
+	active_inputs_stale = false;
+	error_sum = 0.0;
+	nerrors_received = 0;
+}
+
+/**
+ * Removes the flagged input connections, keeping the weights and the Rprop state of the other inputs in order. The output connections
+ * of the removed input neurons are not updated, see NeuronNetwork::relink_outputs.
+ * @param removed flag of each input, aligned with input_neurons
+ */
+void Neuron::remove_inputs(const vector<bool>& removed)
+{
+	size_t nkept = 0;
+	ninput_neurons = 0;
+	for (size_t i = 0; i < input_neurons.size(); ++i)
+	{
+		if (removed[i])
+			continue;
+		if (dynamic_cast<InputNeuron*>(input_neurons[i].get()))
+			++ninput_neurons;
+		input_neurons[nkept] = input_neurons[i];
+		input_weights[nkept] = input_weights[i];
+		++nkept;
+	}
+	rprop.remove_inputs(removed);
+	input_neurons.resize(nkept);
+	input_weights.resize(nkept);
+	input_index.clear();
+	topology_changed();
+	clear_propagation();
+}
+
+/**
+ * Returns the generation of the connections of all neurons: changes whenever neurons are connected, disconnected or replaced, so the structures
+ * collected from the connections (e.g. the first layer of a network) can tell if they are out of date. Never 0.
+ * @return uint64_t
+ */
+uint64_t Neuron::topology_generation()
+{
+	return generation;
+}
 
-	outputs.insert(neuro);
+/**
+ * Starts a new generation of the connections, see topology_generation(). Called by every change of the connections.
+ */
+void Neuron::topology_changed()
+{
+	++generation;
 }
 
 /**
@@ -194,43 +503,37 @@ void Neuron::connect_output(NeuronPtr& neuro)
 void Neuron::set_initial_weight_bounds(double lower_bound, double upper_bound)
 {
 	if (upper_bound <= lower_bound)
-		throw std::exception("Upper bound must be greater than lower bound!");
+		throw std::runtime_error("Upper bound must be greater than lower bound!");
 
 	def_weight_lower_bound = lower_bound;
 	def_weight_upper_bound = upper_bound;
 }
 
-Neuron::Rprop::Rprop(const unordered_map<NeuronPtr, double>& inputs, double delta0_, double deltamax_, double incr_factor_, double decr_factor_)
-	: delta0(delta0_), deltamax(deltamax_), incr_factor(incr_factor_), decr_factor(decr_factor_)
+Neuron::Rprop::Rprop(size_t ninputs, double delta0_, double deltamax_, double incr_factor_, double decr_factor_)
+	: delta0(delta0_), deltamax(deltamax_), incr_factor(incr_factor_), decr_factor(decr_factor_),
+	deltas(ninputs, delta0_), prev_grads(ninputs, 0.0)
 {
-	prev_grads.reserve(inputs.size());
-	deltas.reserve(inputs.size());
-	for (const auto& in : inputs)
-	{
-		prev_grads[in.first] = 0;
-		deltas[in.first] = delta0;
-	}
 	bias_prev_grad = 0;
 	bias_delta = delta0;
 }
 
-double Neuron::Rprop::operator()(const NeuronPtr& weight_of_input, double grad)
+double Neuron::Rprop::operator()(size_t input_index, double grad)
 {
 	// calculate new delta value from previous
-	if (prev_grads[weight_of_input] * grad > 0)
-		deltas[weight_of_input] *= incr_factor;
-	else if (prev_grads[weight_of_input] * grad < 0)
-		deltas[weight_of_input] *= decr_factor;
-	prev_grads[weight_of_input] = grad;
+	if (prev_grads[input_index] * grad > 0)
+		deltas[input_index] *= incr_factor;
+	else if (prev_grads[input_index] * grad < 0)
+		deltas[input_index] *= decr_factor;
+	prev_grads[input_index] = grad;
 
-	if (deltas[weight_of_input] > deltamax)
-		deltas[weight_of_input] = deltamax;
+	if (deltas[input_index] > deltamax)
+		deltas[input_index] = deltamax;
 
 	// calculate weight update
 	if (grad > 0)
-		return -deltas[weight_of_input];
+		return -deltas[input_index];
 	else if (grad < 0)
-		return deltas[weight_of_input];
+		return deltas[input_index];
 	return 0; // reached a platoo
 }
 
@@ -258,10 +561,46 @@ void Neuron::Rprop::reset()
 {
 	bias_prev_grad = 0;
 	bias_delta = delta0;
-	for (auto& prev_grad : prev_grads)
-		prev_grad.second = 0;
-	for (auto& delta : deltas)
-		delta.second = delta0;
+	std::fill(prev_grads.begin(), prev_grads.end(), 0.0);
+	std::fill(deltas.begin(), deltas.end(), delta0);
+}
+
+size_t Neuron::Rprop::state_size() const
+{
+	return 2 + deltas.size() + prev_grads.size();
+}
+
+void Neuron::Rprop::get_state(double* state) const
+{
+	*state++ = bias_prev_grad;
+	*state++ = bias_delta;
+	state = std::copy(deltas.begin(), deltas.end(), state);
+	std::copy(prev_grads.begin(), prev_grads.end(), state);
+}
+
+void Neuron::Rprop::set_state(const double* state)
+{
+	bias_prev_grad = *state++;
+	bias_delta = *state++;
+	std::copy(state, state + deltas.size(), deltas.begin());
+	state += deltas.size();
+	std::copy(state, state + prev_grads.size(), prev_grads.begin());
+}
+
+void Neuron::Rprop::remove_inputs(const vector<bool>& removed)
+{
+	if (deltas.size() != removed.size()) // not in use
+		return;
+	size_t nkept = 0;
+	for (size_t i = 0; i < deltas.size(); ++i)
+		if (!removed[i])
+		{
+			deltas[nkept] = deltas[i];
+			prev_grads[nkept] = prev_grads[i];
+			++nkept;
+		}
+	deltas.resize(nkept);
+	prev_grads.resize(nkept);
 }
 
 }
\ No newline at end of file
@@ -7,17 +7,20 @@
 
 #include <unordered_set>
 #include <unordered_map>
+#include <vector>
 #include <memory>
-#include <random>
 #include <numeric>
 #include <array>
 #include <cmath>
 #include <functional>
+#include <atomic>
 #include "ActivationOutOfBoundsException.h"
+#include "RandomGenerator.h"
 
 using std::unordered_set;
 using std::unordered_map;
 using std::shared_ptr;
+using std::vector;
 
 namespace NNlight {
 
@@ -35,21 +38,52 @@ public:
 	public:
 		const static double def_delta0, def_deltamax, def_incr_factor, def_decr_factor;
 
-		Rprop() {}
-		Rprop(const unordered_map<NeuronPtr, double>& inputs, double delta0_ = def_delta0, double deltamax_ = def_deltamax, double incr_factor_ = def_incr_factor, double decr_factor_ = def_decr_factor);
-		double operator()(const NeuronPtr& weight_of_input, double grad);
+		Rprop(size_t ninputs = 0, double delta0_ = def_delta0, double deltamax_ = def_deltamax, double incr_factor_ = def_incr_factor, double decr_factor_ = def_decr_factor);
+		double operator()(size_t input_index, double grad);
 		double operator()(double bias_grad);
 		void reset();
 
+		/**
+		 * Number of values describing the adaptive state (deltas and previous gradients, including the bias ones).
+		 */
+		size_t state_size() const;
+		/**
+		 * Copies state_size() values of the adaptive state to the given buffer.
+		 * @param state
+		 */
+		void get_state(double* state) const;
+		/**
+		 * Restores the adaptive state from state_size() values written by get_state().
+		 * @param state
+		 */
+		void set_state(const double* state);
+		/**
+		 * Drops the adaptive state of the removed inputs, see Neuron::remove_inputs.
+		 * @param removed flag of each input
+		 */
+		void remove_inputs(const vector<bool>& removed);
+
 	private:
 		double delta0, deltamax;
 		double incr_factor, decr_factor;
 		double bias_prev_grad, bias_delta;
-		unordered_map<NeuronPtr, double> deltas;
-		unordered_map<NeuronPtr, double> prev_grads;
+		vector<double> deltas; // aligned with Neuron::input_neurons
+		vector<double> prev_grads;
 	};
 
 	friend class OutputNeuron;
+	friend class InputNeuron;
+	friend class ConvNeuron;
+	friend class PoolNeuron;
+	friend class NeuronNetwork;
+	friend class FullBatchTrainer;
+	friend class CompiledNetwork;
+
+	/**
+	 * Initialization schemes of the weights of connect_layers(). UNIFORM_INIT draws from the initial weight bounds (see set_initial_weight_bounds),
+	 * XAVIER_INIT from [-sqrt(6/(fan_in+fan_out)), sqrt(6/(fan_in+fan_out))) (Glorot & Bengio), HE_INIT from [-sqrt(6/fan_in), sqrt(6/fan_in)) (He et al.).
+	 */
+	enum WeightInit { UNIFORM_INIT, XAVIER_INIT, HE_INIT };
 
 	/**
 	 * Connects two given neurons: from --> to.
@@ -59,23 +93,53 @@ public:
 	template <typename FromPtr, typename ToPtr>
 	static void connect(FromPtr from, ToPtr to)
 	{
-		from->connect_output(std::dynamic_pointer_cast<Neuron>(to));
-		to->connect_input(std::dynamic_pointer_cast<Neuron>(from));
+		connect_neurons(from, to);
 	}
 
 	/**
 	 * Connects two given layers of neurons. Each neuron from layer_from is connected to each neuron of layer_to.
 	 * @param layer_from
 	 * @param layer_to
+	 * @param init scheme of the initial weights
 	 */
 	template <typename NeuronPtrTypeFrom, typename NeuronPtrTypeTo, size_t N, size_t M>
-	static void connect_layers(std::array<NeuronPtrTypeFrom, N>& layer_from, std::array<NeuronPtrTypeTo, M>& layer_to)
+	static void connect_layers(std::array<NeuronPtrTypeFrom, N>& layer_from, std::array<NeuronPtrTypeTo, M>& layer_to, WeightInit init = UNIFORM_INIT)
 	{
-		for (auto& from : layer_from)
-			for (auto& to : layer_to)
-				connect(from, to);
+		connect_layers(vector<NeuronPtr>(layer_from.begin(), layer_from.end()), vector<NeuronPtr>(layer_to.begin(), layer_to.end()), init);
 	}
 
+	/**
+	 * Connects two given layers of neurons in one pass: each neuron from layer_from is connected to each neuron of layer_to. Storage is sized once
+	 * and the weights of each neuron in layer_to are drawn together from the shared random stream (see RandomGenerator::seed_shared).
+	 * @param layer_from
+	 * @param layer_to
+	 * @param init scheme of the initial weights
+	 */
+	static void connect_layers(const vector<NeuronPtr>& layer_from, const vector<NeuronPtr>& layer_to, WeightInit init = UNIFORM_INIT);
+
+	/**
+	 * Connects two given layers of neurons made by make_layer(n). Each neuron from layer_from is connected to each neuron of layer_to.
+	 * @param layer_from
+	 * @param layer_to
+	 * @param init scheme of the initial weights
+	 */
+	template <typename NeuronPtrTypeFrom, typename NeuronPtrTypeTo>
+	static void connect_layers(const vector<NeuronPtrTypeFrom>& layer_from, const vector<NeuronPtrTypeTo>& layer_to, WeightInit init = UNIFORM_INIT)
+	{
+		connect_layers(vector<NeuronPtr>(layer_from.begin(), layer_from.end()), vector<NeuronPtr>(layer_to.begin(), layer_to.end()), init);
+	}
+
+	/**
+	 * Returns the generation of the connections of all neurons: changes whenever neurons are connected, disconnected or replaced, so the structures
+	 * collected from the connections (e.g. the first layer of a network) can tell if they are out of date. Never 0.
+	 */
+	static uint64_t topology_generation();
+
+	/**
+	 * Starts a new generation of the connections, see topology_generation(). Called by every change of the connections.
+	 */
+	static void topology_changed();
+
 	/**
 	 * Sets the lower and upper bounds of randomized initial weight values.
 	 * @param lower_bound
@@ -91,7 +155,7 @@ public:
 	virtual ~Neuron();
     
     /**
-     * Induces input, activating the neuron.
+     * Induces input, activating the neuron when all input neurons have propagated. The activations are read from the input neurons, act has to be the activation of 'from'.
      * @param from
      * @param act
      */
@@ -105,12 +169,20 @@ public:
     virtual void backpropagate(NeuronPtr from, double err);
 
 	/**
-	 * Randomize a new value for all weights (including the bias) in the range of [lower_bound, upper_bound). Also clears inputs, and errors.
+	 * Randomize a new value for all weights (including the bias) in the range of [lower_bound, upper_bound), seeded from RandomGenerator::shared_next(). Also clears inputs, and errors.
 	 * @param lower_bound
 	 * @param upper_bound
 	 */
 	void reset(double lower_bound = def_weight_lower_bound, double upper_bound = def_weight_upper_bound);
 
+	/**
+	 * Randomize a new value for all weights (including the bias) in the range of [lower_bound, upper_bound), drawn from the given generator. Also clears inputs, and errors.
+	 * @param gen
+	 * @param lower_bound
+	 * @param upper_bound
+	 */
+	virtual void reset(RandomGenerator& gen, double lower_bound = def_weight_lower_bound, double upper_bound = def_weight_upper_bound);
+
 	/**
 	 * Activates the use of the default gradient-descent weight update method. Set by default.
 	 * @param learning_rate_
@@ -129,6 +201,58 @@ public:
 	void use_resilient_backpropagation(double delta0 = Rprop::def_delta0, double deltamax = Rprop::def_deltamax,
 		double incr_factor = Rprop::def_incr_factor, double decr_factor = Rprop::def_decr_factor);
 
+	/**
+	 * Creates an unconnected copy of the neuron with the same weights, learning parameters and Rprop state.
+	 * Connect the copy by replace_inputs().
+	 */
+	virtual NeuronPtr clone() const;
+
+	/**
+	 * Connects the given neurons as inputs of a copy made by clone(), in place of the inputs of the original neuron.
+	 * The i-th neuron gets the i-th input weight.
+	 * @param inputs_
+	 */
+	void replace_inputs(const vector<NeuronPtr>& inputs_);
+
+	/**
+	 * Links a copy made by clone() to the copies of the neurons it shares state with, after all copies are connected. Nothing to link by default.
+	 * @param copies copy of each neuron of the network
+	 */
+	virtual void replace_shared(const unordered_map<const Neuron*, NeuronPtr>& copies);
+
+	/**
+	 * Returns the weight of the bias input.
+	 */
+	double get_biasweight() const;
+
+	/**
+	 * Sets the weight of the bias input.
+	 * @param biasweight_
+	 */
+	void set_biasweight(double biasweight_);
+
+	/**
+	 * Returns the input neurons in the order they were connected.
+	 */
+	const vector<NeuronPtr>& get_input_neurons() const;
+
+	/**
+	 * Returns the input weights, aligned with the neurons returned by get_input_neurons().
+	 */
+	const vector<double>& get_input_weights() const;
+
+	/**
+	 * Overwrites all input weights. Reads as many values as the number of input neurons, in the order of get_input_neurons().
+	 * @param weights
+	 */
+	void set_input_weights(const double* weights);
+
+	/**
+	 * Returns the Rprop weight update predicate of the neuron, holding the adaptive state of the resilient backpropagation.
+	 */
+	const Rprop& get_rprop() const;
+	Rprop& get_rprop();
+
 	/**
      * Default learning rate.
      */
@@ -140,26 +264,76 @@ public:
 	static double def_regularization;
 
 protected:
+	/**
+	 * Set of the input neurons for the duplicate check of connect_neurons. Not copied with the neuron: a copy starts empty, so cloning a neuron
+	 * does not copy a hash set only to drop it.
+	 */
+	struct InputIndex : public unordered_set<const Neuron*>
+	{
+		InputIndex() {}
+		InputIndex(const InputIndex&) : unordered_set<const Neuron*>() {}
+		InputIndex& operator=(const InputIndex&) { clear(); return *this; }
+	};
+
+	/**
+	 * Copies the neuron as the given type, without the output connections and the propagated values. Used to implement clone().
+	 */
+	template <typename NeuronType>
+	NeuronPtr clone_as() const
+	{
+		NeuronPtr copy = std::make_shared<NeuronType>(static_cast<const NeuronType&>(*this));
+		copy->output_neurons.clear();
+		copy->active_inputs.clear();
+		copy->clear_propagation();
+		return copy;
+	}
+
     /**
      * Weight of the bias input neuron.
      */
     double biasweight;
     /**
-     * Weights mapped to each input neuron.
+     * Input neurons in the order they were connected.
+     */
+    vector<NeuronPtr> input_neurons;
+    /**
+     * Set of the input neurons for the duplicate check of connect_neurons, built on its first use. Cleared wherever the inputs are changed otherwise,
+     * and rebuilt if its size does not match input_neurons.
      */
-    unordered_map<NeuronPtr, double> input_weights;
+    InputIndex input_index;
     /**
-     * Propagated input values mapped to each input neuron.
+     * Weights of the input neurons, stored contiguously in the same order as input_neurons.
      */
-    unordered_map<NeuronPtr, double> inputs;
+    vector<double> input_weights;
     /**
-     * Set of output neurons.
+     * Number of input neurons propagated their activation since the last activation of this neuron.
      */
-    unordered_set<NeuronPtr> outputs;
+    size_t ninputs_received;
     /**
-     * Error (or delta) value is mapped to each output neuron.
+     * Number of input neurons that are InputNeurons. If all input neurons are, only the nonzero inputs are propagated to the neuron and learnt from.
      */
-    unordered_map<NeuronPtr, double> errors;
+    size_t ninput_neurons;
+    /**
+     * Index and value of the nonzero inputs of the latest forward propagation, if all input neurons are InputNeurons and the network fed them sparsely.
+     */
+    vector<std::pair<size_t, double>> active_inputs;
+    /**
+     * Set if the latest forward propagation was fed sparsely, that is the neuron was activated from active_inputs.
+     */
+    bool sparse_pass;
+    /**
+     * Set when the neuron activated, active_inputs are cleared by the next forward propagation.
+     */
+    bool active_inputs_stale;
+    /**
+     * Output neurons in the order they were connected. Not owned: output neurons keep their input neurons alive, not the other way around.
+     */
+    vector<Neuron*> output_neurons;
+    /**
+     * Sum of the errors (or deltas) backpropagated from the output neurons, and the number of them.
+     */
+    double error_sum;
+    size_t nerrors_received;
     /**
      * Activation of the neuron caused by the latest forward propagation.
      */
@@ -183,6 +357,25 @@ protected:
 	 */
 	bool use_rprop;
 
+	/**
+	 * Set if the neuron outputs the weighted sum of its inputs as it is, without the sigmoid nonlinear function: the output neurons of a network
+	 * normalized by softmax (see NeuronNetwork::use_softmax_output). The error backpropagated to such a neuron is taken as the gradient of its sum.
+	 */
+	bool linear_activation;
+
+	/**
+	 * Set if the input weights are not free parameters of the neuron: shared by the neurons of a convolution filter (ConvNeuron) or fixed (PoolNeuron).
+	 * Such neurons are not pruned, and cannot be trained by full-batch trainers.
+	 */
+	bool tied_weights;
+
+	/**
+	 * Adjusts the bias and input weights by the delta value of the neuron and backpropagates the error to the input neurons.
+	 * Only the weights of the nonzero inputs get the gradient of the error if the neuron was fed sparsely (the regularization term applies to every weight).
+	 * @param delta
+	 */
+	void learn(double delta);
+
 private:
 	/**
      * Default value of weights initial lower bound.
@@ -193,21 +386,50 @@ private:
      */
 	static double def_weight_upper_bound;
 	/**
+	 * Generation of the connections of all neurons, see topology_generation().
+	 */
+	static std::atomic<uint64_t> generation;
+	/**
      * Default activation function - sigmoid logistic function.
      */
 	static std::function<double(double)> def_activation_fun;
 
 	/**
-     * Connects the given 'neuro' neuron as an input of this neuron.
-     * @param neuro
-     */
-    virtual void connect_input(NeuronPtr& neuro);
+	 * Connects two given neurons: from --> to. Throws if they are already connected.
+	 * @param from
+	 * @param to
+	 */
+	static void connect_neurons(const NeuronPtr& from, const NeuronPtr& to);
 
 	/**
-     * Connects the given 'neuro' neuron as an output of this neuron.
-     * @param neuro
-     */
-	void Neuron::connect_output(NeuronPtr& neuro);
+	 * Counts input neurons that propagated their activation. Activates the neuron from the activations of its input neurons and propagates further when all of them have arrived.
+	 * @param ninputs number of input neurons arrived
+	 */
+	void receive(size_t ninputs = 1);
+
+	/**
+	 * Stores a nonzero input fed to the neuron by an InputNeuron, called before the input neuron is counted by receive().
+	 * @param input_index
+	 * @param act
+	 */
+	void receive_active_input(size_t input_index, double act);
+
+	/**
+	 * True if all input neurons are InputNeurons, so the neuron can be fed sparsely.
+	 */
+	bool has_sparse_inputs() const;
+
+	/**
+	 * Forgets the propagated input values and errors.
+	 */
+	void clear_propagation();
+
+	/**
+	 * Removes the flagged input connections, keeping the weights and the Rprop state of the other inputs in order. The output connections
+	 * of the removed input neurons are not updated, see NeuronNetwork::relink_outputs.
+	 * @param removed flag of each input, aligned with input_neurons
+	 */
+	void remove_inputs(const vector<bool>& removed);
 };
 
 /**
@@ -235,6 +457,21 @@ std::array<std::shared_ptr<NeuronType>, N> make_layer(double learning_rate_ = Ne
 	return layer;
 }
 
+/**
+ * Creates a neuron layer of the given size and a (shared) pointer to each neuron in it. Use it for layers too large for std::array.
+ * @param n number of neurons
+ * @param learning_rate_
+ * @param regularization_ regularization parameter, propotional to the generalization of the network
+ */
+template <typename NeuronType>
+vector<std::shared_ptr<NeuronType>> make_layer(size_t n, double learning_rate_ = Neuron::def_learning_rate, double regularization_ = Neuron::def_regularization)
+{
+	vector<std::shared_ptr<NeuronType>> layer(n);
+	for (auto& neur : layer)
+		neur = make_neuron<NeuronType>(learning_rate_, regularization_);
+	return layer;
+}
+
 }
 
 #endif //_NEURON_H
\ No newline at end of file
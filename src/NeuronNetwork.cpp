@@ -3,6 +3,15 @@
  */
 
 #include "NeuronNetwork.h"
+#include "CompiledNetwork.h"
+#include "Checkpoint.h"
+#include "AllocationCounter.h"
+#include <thread>
+#include <mutex>
+#include <sstream>
+#include <chrono>
+#include <cmath>
+#include <random>
 
 /**
  * NeuronNetwork implementation
@@ -16,11 +25,15 @@ double NeuronNetwork::def_train_test_ratio = 0.8;
 size_t NeuronNetwork::def_max_epoch = 2000;
 double NeuronNetwork::err_eps = 1e-8;
 size_t NeuronNetwork::test_err_increase_threshold = 10;
+double NeuronNetwork::sparse_input_ratio = 0.25;
+const size_t NeuronNetwork::NNSettings::def_input_batch_size;
 
 /**
  * Creates a network of neurons, initially without the neurons. Neurons can be added after creation.
  */
-NeuronNetwork::NeuronNetwork() {}
+NeuronNetwork::NeuronNetwork()
+	: first_layer_generation(0), inference_stats(nullptr), softmax_output(false)
+{}
 
 /**
  * Adds an input neuron to the network. The more input neurons are added, the more input values are needed for training and testing. The number of input neurons determines the dimension of the input data.
@@ -28,11 +41,14 @@ NeuronNetwork::NeuronNetwork() {}
  */
 void NeuronNetwork::add_neuron(InputNeuron& neuro)
 {
-	auto ins = neurons.insert(std::make_shared<InputNeuron>(neuro));
+	auto neuroptr = std::make_shared<InputNeuron>(neuro);
+	auto ins = neuron_set.insert(neuroptr);
 	if (!ins.second)
-		throw std::exception("Input neuron is already added!");
+		throw std::runtime_error("Input neuron is already added!");
+	neurons.push_back(neuroptr);
 
-	inputs.insert(std::make_shared<InputNeuron>(neuro));
+	inputs.push_back(neuroptr);
+	Neuron::topology_changed();
 }
 
 /**
@@ -41,11 +57,13 @@ void NeuronNetwork::add_neuron(InputNeuron& neuro)
  */
 void NeuronNetwork::add_neuron(OutputNeuron& neuro)
 {
-	auto ins = neurons.insert(std::make_shared<OutputNeuron>(neuro));
+	auto neuroptr = std::make_shared<OutputNeuron>(neuro);
+	auto ins = neuron_set.insert(neuroptr);
 	if (!ins.second)
-		throw std::exception("Output neuron is already added!");
+		throw std::runtime_error("Output neuron is already added!");
+	neurons.push_back(neuroptr);
 
-	outputs.insert(std::make_shared<OutputNeuron>(neuro));
+	outputs.push_back(neuroptr);
 }
 
 /**
@@ -54,9 +72,11 @@ void NeuronNetwork::add_neuron(OutputNeuron& neuro)
  */
 void NeuronNetwork::add_neuron(Neuron& neuro)
 {
-	auto ins = neurons.insert(std::make_shared<Neuron>(neuro));
+	auto neuroptr = std::make_shared<Neuron>(neuro);
+	auto ins = neuron_set.insert(neuroptr);
 	if (!ins.second)
-		throw std::exception("Hidden neuron is already added!");
+		throw std::runtime_error("Hidden neuron is already added!");
+	neurons.push_back(neuroptr);
 }
 
 /**
@@ -65,11 +85,13 @@ void NeuronNetwork::add_neuron(Neuron& neuro)
  */
 void NeuronNetwork::add_neuron(InputNeuronPtr neuroptr)
 {
-	auto ins = neurons.insert(neuroptr);
+	auto ins = neuron_set.insert(neuroptr);
 	if (!ins.second)
-		throw std::exception("Input neuron is already added!");
+		throw std::runtime_error("Input neuron is already added!");
+	neurons.push_back(neuroptr);
 
-	inputs.insert(neuroptr);
+	inputs.push_back(neuroptr);
+	Neuron::topology_changed();
 }
 
 /**
@@ -78,11 +100,12 @@ void NeuronNetwork::add_neuron(InputNeuronPtr neuroptr)
  */
 void NeuronNetwork::add_neuron(OutputNeuronPtr neuroptr)
 {
-	auto ins = neurons.insert(neuroptr);
+	auto ins = neuron_set.insert(neuroptr);
 	if (!ins.second)
-		throw std::exception("Output neuron is already added!");
-	
-	outputs.insert(neuroptr);
+		throw std::runtime_error("Output neuron is already added!");
+	neurons.push_back(neuroptr);
+
+	outputs.push_back(neuroptr);
 }
 
 /**
@@ -91,9 +114,10 @@ void NeuronNetwork::add_neuron(OutputNeuronPtr neuroptr)
  */
 void NeuronNetwork::add_neuron(NeuronPtr neuroptr)
 {
-	auto ins = neurons.insert(neuroptr);
+	auto ins = neuron_set.insert(neuroptr);
 	if (!ins.second)
-		throw std::exception("Hidden neuron is already added!");
+		throw std::runtime_error("Hidden neuron is already added!");
+	neurons.push_back(neuroptr);
 }
 
 /**
@@ -102,156 +126,751 @@ void NeuronNetwork::add_neuron(NeuronPtr neuroptr)
  * @param desired_output
  * @param log_stream
  * @param train_ratio
+ * @return errors, epochs, sessions and time of the training
  */
-void NeuronNetwork::train(vector<vector<double>> input, vector<vector<double>> desired_output, ostream& log_stream, double train_ratio, bool batch_mode)
-{
-	deque<bool> test_err_is_increasing;
-	double prev_train_err = std::numeric_limits<double>::max(); // averaged training error
-	double prev_test_err = std::numeric_limits<double>::max(); // averaged test error
-	double delta_train_err = std::numeric_limits<double>::max(); // accuracy change iteration by iteration
-	double delta_test_err = std::numeric_limits<double>::max();
-	// create performance vectors to be able to average over errors of a training set
-	vector<double> train_perf(static_cast<size_t>(input.size() * train_ratio));
-	vector<double> test_perf(static_cast<size_t>(input.size() - input.size() * train_ratio + 1));
-	// random stuff for shuffling
-	std::random_device rand_dev;
-	std::mt19937 gen(rand_dev());
-
+TrainingResult NeuronNetwork::train(vector<vector<double>> input, vector<vector<double>> desired_output, ostream& log_stream, double train_ratio, bool batch_mode)
+{
 	if (static_cast<size_t>(input.size() * train_ratio) == 0)
-		throw std::exception("Cannot train network, no training data provided - either train_ratio is too close to zero or the input is empty!");
-	
+		throw std::runtime_error("Cannot train network, no training data provided - either train_ratio is too close to zero or the input is empty!");
+
+	TrainingState state;
+	state.train_ratio = train_ratio;
+	state.batch_mode = batch_mode;
+	state.ntrain = static_cast<size_t>(input.size() * train_ratio);
+	state.order.resize(input.size());
+	std::iota(state.order.begin(), state.order.end(), 0);
+	// random stuff for shuffling, and for the weights
+	state.gen = make_random();
+	state.init_gen = state.gen.split();
+	if (settings.checkpoint_interval)
+		state.data_fingerprint = fingerprint(input, desired_output);
+
 	log_stream << "Training initiated ..." << std::endl;
-	size_t nrestart = 0;
-	while (nrestart == 0 || (settings.restart_if_high_error && settings.restart_threshold < prev_train_err && nrestart < settings.max_nrestart))
-	{
-		log_stream << "Training session #" << nrestart << std::endl;
-		// shuffle all inputs & desired outputs
-		vector<size_t> shuffle_indices(input.size());
-		std::iota(shuffle_indices.begin(), shuffle_indices.end(), 0);
-		std::shuffle(shuffle_indices.begin(), shuffle_indices.end(), gen);
-		reorder(shuffle_indices.begin(), shuffle_indices.end(), input.begin());
-		reorder(shuffle_indices.begin(), shuffle_indices.end(), desired_output.begin());
-		// separate train and test, input and desired output vectors so shuffling them possible without extra vectors
-		auto train_in_beg = input.begin();
-		auto train_in_end = input.begin() + static_cast<size_t>(input.size() * train_ratio);
-		auto train_dout_beg = desired_output.begin();
-		auto train_dout_end = desired_output.begin() + static_cast<size_t>(desired_output.size() * train_ratio);
-		auto test_in_beg = train_in_end;
-		auto test_in_end = input.end();
-		auto test_dout_beg = train_dout_end;
-		auto test_dout_end = desired_output.end();
-		// reset error values, test increse checker deque and neurons
-		prev_train_err = prev_test_err = delta_train_err = delta_test_err = std::numeric_limits<double>::max();
-		test_err_is_increasing.assign(test_err_increase_threshold, false);
-		reset_neurons(); // resets inputs, errors and weights of neurons
-		size_t epoch = 0;
-		try {
-			while (epoch < settings.max_nepoch // has not reached max_nepoch
-				&& std::abs(delta_train_err) > err_eps // change is significant
-				&& !std::all_of(test_err_is_increasing.begin(), test_err_is_increasing.end(), [] (bool inc) { return inc; } )) // no previous consecutive test error increase
+	return run_training(state, input, desired_output, log_stream, false);
+}
+
+/**
+ * Continues a training from a checkpoint file written during train(). The same training data has to be given as for the interrupted training,
+ * and the network has to have the same neurons and backpropagation settings. The training continues exactly as the interrupted one would have.
+ * @param checkpoint_filename
+ * @param input
+ * @param desired_output
+ * @param log_stream
+ * @return errors, epochs, sessions and time of the resumed part of the training
+ */
+TrainingResult NeuronNetwork::resume_training(const string& checkpoint_filename, vector<vector<double>> input, vector<vector<double>> desired_output, ostream& log_stream)
+{
+	TrainingState state;
+	read_checkpoint(checkpoint_filename, state);
+	if (state.order.size() != input.size() || state.data_fingerprint != fingerprint(input, desired_output))
+		throw std::runtime_error("Checkpoint was written for other training data!");
+	for (auto index : state.order)
+		if (index >= input.size())
+			throw std::runtime_error("Checkpoint file is corrupt, invalid sample index!");
+	if (state.weights.size() != num_of_weights())
+		throw std::runtime_error("Checkpoint was written for a network of other topology!");
+	size_t rprop_state_size = 0;
+	for (auto& neur : neurons)
+		rprop_state_size += neur->get_rprop().state_size();
+	if (state.rprop_state.size() != rprop_state_size)
+		throw std::runtime_error("Checkpoint was written with other backpropagation settings!");
+	if (full_batch_trainer)
+	{
+		// validated here, restored when the session starts
+		full_batch_trainer->start(*this);
+		full_batch_trainer->set_state(state.trainer_state);
+	}
+	else if (!state.trainer_state.empty())
+		throw std::runtime_error("Checkpoint was written with other backpropagation settings!");
+	if (state.best_weights.size() != state.weights.size())
+		throw std::runtime_error("Checkpoint file is corrupt, invalid number of best weights!");
+
+	// restore weights & adaptive states
+	set_weights(state.weights.data());
+	const double* rprop_state = state.rprop_state.data();
+	for (auto& neur : neurons)
+	{
+		neur->get_rprop().set_state(rprop_state);
+		rprop_state += neur->get_rprop().state_size();
+	}
+	state.weights.clear();
+	state.rprop_state.clear();
+
+	log_stream << "Training resumed from " << checkpoint_filename << " ..." << std::endl;
+	return run_training(state, input, desired_output, log_stream, true);
+}
+
+/**
+ * Continues a training from a checkpoint file written during train(). Reads the same training data from the stream as train() does.
+ * @param checkpoint_filename
+ * @param train_stream
+ * @param log_stream
+ * @return errors, epochs, sessions and time of the resumed part of the training
+ */
+TrainingResult NeuronNetwork::resume_training(const string& checkpoint_filename, istream& train_stream, ostream& log_stream)
+{
+	vector<vector<double>> input;
+	vector<vector<double>> desired_output;
+	read_samples(train_stream, input, desired_output, log_stream);
+	return resume_training(checkpoint_filename, input, desired_output, log_stream);
+}
+
+/**
+ * Runs training sessions (restarts) and their epochs from the given state until a stopping criterion is met.
+ * @param state
+ * @param input
+ * @param desired_output
+ * @param log_stream
+ * @param resumed true if the state is in the middle of a session, loaded from a checkpoint
+ * @return errors, epochs, sessions and time of the training
+ */
+TrainingResult NeuronNetwork::run_training(TrainingState& state, const vector<vector<double>>& input, const vector<vector<double>>& desired_output, ostream& log_stream, bool resumed)
+{
+	auto start = std::chrono::steady_clock::now();
+	size_t first_session = state.nrestart;
+	if (!resumed && settings.nthreads != 1 && settings.restart_if_high_error && settings.max_nrestart > 1)
+		run_parallel_restarts(state, input, desired_output, log_stream);
+	else
+	{
+		CheckpointWriter checkpoints(settings.checkpoint_filename);
+		bool stopped = false;
+		while (!stopped && (resumed || state.nrestart == 0 || needs_restart(state)))
+		{
+			stopped = !run_session(state, input, desired_output, log_stream, resumed, &checkpoints, nullptr);
+			resumed = false;
+			++state.nrestart;
+			stopped = notify_restart(state.nrestart - 1, state, !stopped && needs_restart(state)) || stopped;
+		}
+
+		string checkpoint_error = checkpoints.wait();
+		if (!checkpoint_error.empty())
+			log_stream << "Checkpoint is not written: " << checkpoint_error << std::endl;
+	}
+
+	TrainingResult result;
+	result.train_err = state.prev_train_err;
+	result.test_err = state.prev_test_err;
+	result.nepoch = state.epoch;
+	result.nsession = state.nrestart - first_session;
+	result.target_reached = reached_target_error(state);
+	result.wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
+
+/**
+ * Runs the training sessions on clones of the network, on several threads. Sessions are started until one of them reaches the
+ * restart threshold, which cancels the others, or until max_nrestart sessions are run. The weights of the session with the lowest
+ * train error are installed in the network. An exception thrown by a session cancels the others, and is rethrown.
+ * @param state
+ * @param input
+ * @param desired_output
+ * @param log_stream
+ */
+void NeuronNetwork::run_parallel_restarts(TrainingState& state, const vector<vector<double>>& input, const vector<vector<double>>& desired_output, ostream& log_stream)
+{
+	size_t nsessions = settings.max_nrestart;
+	size_t nthreads = settings.nthreads ? settings.nthreads : std::thread::hardware_concurrency();
+	nthreads = std::max<size_t>(1, std::min(nthreads, nsessions));
+
+	// every session gets its own random stream, independent of which thread runs it
+	vector<RandomGenerator> streams;
+	for (size_t s = 0; s < nsessions; ++s)
+		streams.push_back(state.gen.split());
+
+	std::atomic<size_t> next_session(0);
+	std::atomic<bool> solved(false);
+	std::mutex best_mutex;
+	size_t nrun = 0;
+	TrainingState best;
+	best.prev_train_err = std::numeric_limits<double>::max();
+	vector<double> best_weights(num_of_weights());
+	bool has_best = false;
+	std::exception_ptr error;
+
+	vector<std::thread> workers;
+	for (size_t t = 0; t < nthreads; ++t)
+	{
+		auto worker_network = clone();
+		worker_network->settings.nthreads = 1;
+		workers.push_back(std::thread([&, worker_network] () {
+			for (size_t s = next_session++; s < nsessions && !solved; s = next_session++)
 			{
-				// shuffle train inputs & desired outputs
-				// create and fill shuffle indices, so input and desired output can be shuffled at the same time
-				vector<size_t> shuffle_train_indices(static_cast<size_t>(input.size() * train_ratio));
-				std::iota(shuffle_train_indices.begin(), shuffle_train_indices.end(), 0);
-				std::shuffle(shuffle_train_indices.begin(), shuffle_train_indices.end(), gen);
-				reorder(shuffle_train_indices.begin(), shuffle_train_indices.end(), train_in_beg);
-				reorder(shuffle_train_indices.begin(), shuffle_train_indices.end(), train_dout_beg);
-
-				// check performance on test data
-				size_t sample_index = 0;
-				vector<double> err(outputs.size());
-				vector<double> mse_err(outputs.size());
-				if (std::distance(test_in_beg, test_in_end))
-				{
-					for (auto iit = test_in_beg, oit = test_dout_beg;
-						iit != test_in_end && oit != test_dout_end;
-						++iit, ++oit)
+				try {
+					// a fresh copy of the state, so the split of the session does not depend on the sessions run before on the thread
+					TrainingState session(state);
+					std::ostringstream session_log;
+					session.nrestart = s;
+					session.gen = streams[s];
+					session.init_gen = session.gen.split();
+					bool stopped = !worker_network->run_session(session, input, desired_output, session_log, false, nullptr, &solved);
+
+					std::lock_guard<std::mutex> lock(best_mutex);
+					log_stream << session_log.str();
+					++nrun;
+					// sessions reaching the target error are preferred, then the lower train error
+					bool session_reached = worker_network->reached_target_error(session);
+					bool best_reached = has_best && reached_target_error(best);
+					if (!has_best || (session_reached && !best_reached) || (session_reached == best_reached && session.prev_train_err < best.prev_train_err))
 					{
-						// forward propagation
-						size_t neur_index = 0;
-						for (auto& in : inputs) in->feed((*iit)[neur_index++]);
-			
-						// update test performance by averaging over errors
-						std::transform(outputs.begin(), outputs.end(), oit->begin(), mse_err.begin(),
-							[] (const OutputNeuronPtr& neur, const double& d_out) {
-								return std::pow(neur->get_activation() - d_out, 2.0); // MSE
-						});
-						test_perf[sample_index] = std::accumulate(mse_err.begin(), mse_err.end(), 0.0);
-						test_perf[sample_index] /= mse_err.size();
-						++sample_index;
+						best = session;
+						worker_network->get_weights(best_weights.data());
+						has_best = true;
 					}
-					double avg_test_err = std::accumulate(test_perf.begin(), test_perf.end(), 0.0);
-					avg_test_err /= test_perf.size();
-					test_err_is_increasing.push_back( avg_test_err > prev_test_err );
-					if (test_err_is_increasing.size() > test_err_increase_threshold)
-						test_err_is_increasing.pop_front();
-					delta_test_err = prev_test_err - avg_test_err;
-					prev_test_err = avg_test_err;
+					if (stopped || session.prev_train_err <= settings.restart_threshold || worker_network->reached_target_error(session))
+						solved = true;
+					if (worker_network->notify_restart(s, session, !solved && next_session < nsessions))
+						solved = true;
 				}
-		
-				// iterate over all train samples, forward- & backpropagation
-				sample_index = 0;
-				for (auto iit = train_in_beg, oit = train_dout_beg;
-					iit != train_in_end && oit != train_dout_end;
-					++iit, ++oit)
+				catch (...)
 				{
+					// stops the other sessions, the first error is rethrown once all threads are joined
+					std::lock_guard<std::mutex> lock(best_mutex);
+					if (!error)
+						error = std::current_exception();
+					solved = true;
+				}
+			}
+		}));
+	}
+	for (auto& worker : workers)
+		worker.join();
+	if (error)
+		std::rethrow_exception(error);
+
+	// install the weights of the best session
+	set_weights(best_weights.data());
+	log_stream << "Weights of training session #" << best.nrestart << " are kept" << std::endl;
+	best.nrestart = nrun;
+	best.gen = state.gen;
+	best.init_gen = state.init_gen;
+	state = best;
+}
+
+/**
+ * Estimates the error of the network by k-fold cross-validation. The samples are shuffled and split into k folds; each fold is the test set of one training session,
+ * the rest of the samples are its training samples. Folds are index views into the given data, the data is not copied. Sessions run on clones of the network,
+ * settings.set_num_of_threads() of them at once. Restarts are not used, every fold is trained in a single session. The network itself is not modified.
+ * @param k number of folds, at least 2
+ * @param input
+ * @param desired_output
+ * @param log_stream
+ * @param batch_mode
+ * @param keep_best_model keeps the trained clone of the fold with the lowest test error in the result
+ */
+CrossValidationResult NeuronNetwork::cross_validate(size_t k, const vector<vector<double>>& input, const vector<vector<double>>& desired_output, ostream& log_stream,
+	bool batch_mode, bool keep_best_model) const
+{
+	if (k < 2 || k > input.size())
+		throw std::runtime_error("Cannot cross-validate, the number of folds has to be at least 2 and at most the number of samples!");
+	if (desired_output.size() != input.size())
+		throw std::runtime_error("Number of inputs and desired outputs differ!");
+
+	auto start = std::chrono::steady_clock::now();
+	log_stream << "Cross-validation of " << k << " folds initiated ..." << std::endl;
+
+	// one shuffle for all folds, fold f is [bounds[f], bounds[f+1]) of the shuffled indices
+	vector<size_t> shuffled(input.size());
+	std::iota(shuffled.begin(), shuffled.end(), 0);
+	RandomGenerator gen = make_random();
+	gen.shuffle(shuffled.begin(), shuffled.end());
+	vector<size_t> bounds(k + 1);
+	for (size_t f = 0; f <= k; ++f)
+		bounds[f] = f * input.size() / k;
+	vector<RandomGenerator> streams;
+	for (size_t f = 0; f < k; ++f)
+		streams.push_back(gen.split());
+
+	CrossValidationResult result;
+	result.folds.resize(k);
+	vector<shared_ptr<NeuronNetwork>> models(k);
+	size_t nthreads = settings.nthreads ? settings.nthreads : std::thread::hardware_concurrency();
+	nthreads = std::max<size_t>(1, std::min(nthreads, k));
+	std::atomic<size_t> next_fold(0);
+	std::mutex log_mutex;
+	std::exception_ptr error;
+
+	auto work = [&] () {
+		for (size_t f = next_fold++; f < k; f = next_fold++)
+		{
+			try {
+				auto fold_start = std::chrono::steady_clock::now();
+				auto model = clone();
+				model->settings.nthreads = 1;
+
+				// training samples first, then the samples of the fold
+				TrainingState state;
+				state.batch_mode = batch_mode;
+				state.nrestart = f;
+				state.order.reserve(input.size());
+				state.order.insert(state.order.end(), shuffled.begin(), shuffled.begin() + bounds[f]);
+				state.order.insert(state.order.end(), shuffled.begin() + bounds[f + 1], shuffled.end());
+				state.order.insert(state.order.end(), shuffled.begin() + bounds[f], shuffled.begin() + bounds[f + 1]);
+				state.ntrain = input.size() - (bounds[f + 1] - bounds[f]);
+				state.train_ratio = static_cast<double>(state.ntrain) / input.size();
+				state.gen = streams[f];
+				state.init_gen = state.gen.split();
+				state.best_weights.resize(model->num_of_weights());
+				model->start_session(state, false, settings.warm_start);
+
+				std::ostringstream fold_log;
+				fold_log << "Fold #" << f << std::endl;
+				model->run_session(state, input, desired_output, fold_log, true, nullptr, nullptr);
+
+				auto& fold = result.folds[f];
+				fold.train_err = state.prev_train_err;
+				fold.test_err = state.prev_test_err;
+				fold.nepoch = state.epoch;
+				fold.wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - fold_start).count();
+				if (keep_best_model)
+					models[f] = model;
+
+				std::lock_guard<std::mutex> lock(log_mutex);
+				log_stream << fold_log.str();
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(log_mutex);
+				if (!error)
+					error = std::current_exception();
+			}
+		}
+	};
+	vector<std::thread> workers;
+	for (size_t t = 1; t < nthreads; ++t)
+		workers.push_back(std::thread(work));
+	work();
+	for (auto& worker : workers)
+		worker.join();
+	if (error)
+		std::rethrow_exception(error);
+
+	// aggregate
+	result.mean_train_err = result.mean_test_err = result.stddev_test_err = 0;
+	result.best_fold = 0;
+	for (size_t f = 0; f < k; ++f)
+	{
+		result.mean_train_err += result.folds[f].train_err / k;
+		result.mean_test_err += result.folds[f].test_err / k;
+		if (result.folds[f].test_err < result.folds[result.best_fold].test_err)
+			result.best_fold = f;
+	}
+	for (auto& fold : result.folds)
+		result.stddev_test_err += std::pow(fold.test_err - result.mean_test_err, 2.0) / k;
+	result.stddev_test_err = std::sqrt(result.stddev_test_err);
+	result.best_model = models[result.best_fold];
+	result.wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	log_stream << "Mean train error: " << result.mean_train_err << std::endl;
+	log_stream << "Mean test error: " << result.mean_test_err << " (standard deviation " << result.stddev_test_err << ")" << std::endl;
+	return result;
+}
+
+/**
+ * Runs a single training session: shuffles and splits the samples, resets the weights, then runs epochs until a stopping criterion is met.
+ * Continues the session of the state instead, if resumed is set.
+ * @param state
+ * @param input
+ * @param desired_output
+ * @param log_stream
+ * @param resumed true if the state is in the middle of a session, loaded from a checkpoint
+ * @param checkpoints writes checkpoints if given
+ * @param cancel stops the session if given and set
+ * @return false if an observer stopped the training (see TrainingControl::stop_training)
+ */
+bool NeuronNetwork::run_session(TrainingState& state, const vector<vector<double>>& input, const vector<vector<double>>& desired_output, ostream& log_stream, bool resumed,
+	CheckpointWriter* checkpoints, const std::atomic<bool>* cancel)
+{
+	// create performance vectors to be able to average over errors of a training set, and the error buffer of the output neurons;
+	// all scratch memory of the session is allocated here, so the epochs do not allocate
+	vector<double> train_perf(state.ntrain);
+	vector<double> test_perf(input.size() - state.ntrain);
+	vector<double> err(outputs.size());
+	state.best_weights.resize(num_of_weights());
+	// the input pipeline gathers the train samples of an epoch on its own thread, from when they are shuffled
+	std::unique_ptr<InputPipeline> pipeline;
+	if (settings.input_nbuffers)
+		pipeline.reset(new InputPipeline(input, desired_output, inputs.size(), outputs.size(), settings.input_nbuffers, settings.input_batch_size));
+
+	if (!resumed)
+	{
+		log_stream << "Training session #" << state.nrestart << std::endl;
+		start_session(state, true, settings.warm_start && state.nrestart == 0);
+	}
+	else if (state.epoch > 0)
+		log_stream << "Training session #" << state.nrestart << " resumed at epoch " << state.epoch << std::endl;
+	auto train_beg = state.order.begin();
+	auto train_end = state.order.begin() + state.ntrain;
+	auto test_beg = train_end;
+	auto test_end = state.order.end();
+	bool stop_session = false, stop_training = false;
+	// a full-batch trainer takes the place of backpropagation, it learns once per epoch like batch mode
+	const bool learn_online = !state.batch_mode && !full_batch_trainer;
+	const bool learn_by_batch = state.batch_mode && !full_batch_trainer;
+	if (full_batch_trainer)
+	{
+		full_batch_trainer->start(*this);
+		// a resumed session continues the optimizer where the checkpoint left it
+		if (resumed)
+			full_batch_trainer->set_state(state.trainer_state);
+	}
+	state.trainer_state.clear();
+	auto apply_learning_rate = [&] (TrainingControl& control) {
+		if (control.learning_rate > 0)
+			for (auto& neur : neurons)
+				neur->learning_rate = control.learning_rate;
+		control.learning_rate = 0;
+	};
+	try {
+		while ((!cancel || !*cancel) // no other session reached the restart threshold
+			&& !stop_session // no observer stopped the session
+			&& state.epoch < settings.max_nepoch // has not reached max_nepoch
+			&& std::abs(state.delta_train_err) > err_eps // change is significant
+			&& !std::all_of(state.test_err_is_increasing.begin(), state.test_err_is_increasing.end(), [] (bool inc) { return inc; } ) // no previous consecutive test error increase
+			&& !(settings.early_stopping_patience && test_beg != test_end && state.epoch - state.best_epoch > settings.early_stopping_patience) // test error improved lately
+			&& !reached_target_error(state)) // target error is not reached
+		{
+			TrainingControl control;
+			EpochProfile epoch_profile(state.nrestart, state.epoch);
+			EpochProfile* profile = settings.profiler ? &epoch_profile : nullptr;
+			std::chrono::steady_clock::time_point epoch_start;
+			uint64_t epoch_allocs = 0;
+			PipelineStats epoch_pipeline_stats;
+			if (profile)
+			{
+				epoch_start = std::chrono::steady_clock::now();
+				epoch_allocs = AllocationCounter::thread_count();
+				if (pipeline)
+					epoch_pipeline_stats = pipeline->get_stats();
+			}
+
+			// shuffle train samples
+			{
+				NNLIGHT_PROFILE_PHASE(profile, SHUFFLE_PHASE);
+				state.gen.shuffle(train_beg, train_end);
+			}
+			if (pipeline)
+				pipeline->start_epoch(state.order.data(), state.ntrain); // gathers while testing
+
+			// check performance on test data
+			size_t sample_index = 0;
+			size_t ntrain_correct = 0, ntest_correct = 0;
+			std::fill(err.begin(), err.end(), 0.0); // errors are accumulated in batch mode
+			if (test_beg != test_end)
+			{
+				NNLIGHT_PROFILE_PHASE(profile, TEST_PHASE);
+				for (auto it = test_beg; it != test_end; ++it)
+				{
+					const auto& in_sample = input[*it];
+					const auto& dout_sample = desired_output[*it];
+
 					// forward propagation
+					feed(in_sample.data());
+
+					// update test performance by averaging over errors
+					test_perf[sample_index] = sample_error(dout_sample.data());
+					if (classified_correctly(dout_sample.data()))
+						++ntest_correct;
+					++sample_index;
+				}
+				double avg_test_err = std::accumulate(test_perf.begin(), test_perf.end(), 0.0);
+				avg_test_err /= test_perf.size();
+				auto& increasing = state.test_err_is_increasing;
+				if (increasing.size() < test_err_increase_threshold)
+					increasing.push_back( avg_test_err > state.prev_test_err );
+				else if (!increasing.empty())
+				{
+					// shift the full window in place, pushing and popping would make the deque allocate blocks now and then
+					std::copy(increasing.begin() + 1, increasing.end(), increasing.begin());
+					increasing.back() = avg_test_err > state.prev_test_err;
+				}
+				state.delta_test_err = state.prev_test_err - avg_test_err;
+				state.prev_test_err = avg_test_err;
+
+				// keep the weights of the lowest test error, test performance is measured before training in the epoch
+				if (state.epoch > 0 && avg_test_err < state.best_test_err)
+				{
+					state.best_test_err = avg_test_err;
+					state.best_train_err = state.prev_train_err;
+					state.best_epoch = state.epoch;
+					get_weights(state.best_weights.data());
+				}
+			}
+
+			// iterate over all train samples, forward- & backpropagation
+			sample_index = 0;
+			auto train_sample = [&] (const double* in_sample, const double* dout_sample) {
+				// forward propagation
+				{
+					NNLIGHT_PROFILE_PHASE(profile, FORWARD_PHASE);
+					feed(in_sample);
+				}
+
+				// backward propagation
+				if (learn_online)
+				{
+					NNLIGHT_PROFILE_PHASE(profile, BACKWARD_PHASE);
+					std::transform(outputs.begin(), outputs.end(), dout_sample, err.begin(),
+						[] (const OutputNeuronPtr& neur, const double& d_out) {
+							return neur->get_activation() - d_out;
+					});
 					size_t neur_index = 0;
-					for (auto& in : inputs) in->feed((*iit)[neur_index++]);
-			
-					// backward propagation
-					if (!batch_mode)
-					{
-						std::transform(outputs.begin(), outputs.end(), oit->begin(), err.begin(),
-							[] (const OutputNeuronPtr& neur, const double& d_out) {
-								return neur->get_activation() - d_out;
-						});
-						neur_index = 0;
-						for (auto& out : outputs) out->backpropagate(nullptr, err[neur_index++]);
-					}
-					else // batch learning
+					for (auto& out : outputs) out->backpropagate(nullptr, err[neur_index++]);
+				}
+				else if (learn_by_batch)
+				{
+					NNLIGHT_PROFILE_PHASE(profile, BACKWARD_PHASE);
+					auto outneurit = outputs.begin(); // output neurons
+					auto doutit = dout_sample; // desired outputs
+					for (auto errit = err.begin(); errit != err.end(); ++errit, ++outneurit, ++doutit)
+						*errit += (*outneurit)->get_activation() - *doutit; // accumulate errors
+				}
+
+				// update training performance by averaging over errors
+				{
+					NNLIGHT_PROFILE_PHASE(profile, ERROR_PHASE);
+					train_perf[sample_index] = sample_error(dout_sample);
+					if (classified_correctly(dout_sample))
+						++ntrain_correct;
+				}
+
+				if (settings.observer && learn_online)
+				{
+					BatchMetrics metrics;
+					metrics.session = state.nrestart;
+					metrics.epoch = state.epoch;
+					metrics.batch = sample_index;
+					metrics.nsamples = 1;
+					metrics.train_err = train_perf[sample_index];
+					settings.observer->on_batch(metrics, control);
+					apply_learning_rate(control);
+				}
+
+				++sample_index;
+			};
+			if (pipeline)
+			{
+				InputBatch batch;
+				for (;;)
+				{
 					{
-						auto outneurit = outputs.begin(); // output neurons
-						auto doutit = oit->begin(); // desired outputs
-						for (auto errit = err.begin(); errit != err.end(); ++errit)
-							*errit += (*outneurit)->get_activation() - *doutit; // accumulate errors
+						NNLIGHT_PROFILE_PHASE(profile, INPUT_WAIT_PHASE);
+						if (!pipeline->next(batch))
+							break;
 					}
+					for (size_t s = 0; s < batch.nsamples; ++s)
+						train_sample(batch.input + s * inputs.size(), batch.desired_output + s * outputs.size());
+				}
+			}
+			else
+				for (auto it = train_beg; it != train_end; ++it)
+					train_sample(input[*it].data(), desired_output[*it].data());
+			if (full_batch_trainer)
+			{
+				NNLIGHT_PROFILE_PHASE(profile, BACKWARD_PHASE);
+				full_batch_trainer->step(input, desired_output, state.order.data(), state.ntrain);
+			}
+			else if (learn_by_batch)
+			{
+				NNLIGHT_PROFILE_PHASE(profile, BACKWARD_PHASE);
+				size_t neur_index = 0;
+				for (auto& out : outputs) out->backpropagate(nullptr, err[neur_index++]);
+			}
+			double avg_train_err = std::accumulate(train_perf.begin(), train_perf.end(), 0.0);
+			avg_train_err /= train_perf.size();
+			double train_accuracy = static_cast<double>(ntrain_correct) / train_perf.size();
+			double test_accuracy = test_perf.empty() ? 0.0 : static_cast<double>(ntest_correct) / test_perf.size();
+			state.delta_train_err = state.prev_train_err - avg_train_err;
+			state.prev_train_err = avg_train_err;
 
-					// update training performance by averaging over errors
-					std::transform(outputs.begin(), outputs.end(), oit->begin(), mse_err.begin(),
-						[] (const OutputNeuronPtr& neur, const double& d_out) {
-							return std::pow(neur->get_activation() - d_out, 2.0); // MSE
-					});
-					train_perf[sample_index] = std::accumulate(mse_err.begin(), mse_err.end(), 0.0);
-					train_perf[sample_index] /= mse_err.size();
+			++state.epoch;
+			if (settings.observer)
+			{
+				if (!learn_online)
+				{
+					BatchMetrics metrics;
+					metrics.session = state.nrestart;
+					metrics.epoch = state.epoch - 1;
+					metrics.batch = 0;
+					metrics.nsamples = train_perf.size();
+					metrics.train_err = avg_train_err;
+					settings.observer->on_batch(metrics, control);
+				}
 
-					++sample_index;
+				EpochMetrics metrics;
+				metrics.session = state.nrestart;
+				metrics.epoch = state.epoch;
+				metrics.train_err = avg_train_err;
+				metrics.delta_train_err = state.delta_train_err;
+				metrics.test_err = state.prev_test_err;
+				metrics.best_test_err = state.best_test_err;
+				metrics.best_epoch = state.best_epoch;
+				metrics.train_accuracy = train_accuracy;
+				metrics.test_accuracy = test_accuracy;
+				settings.observer->on_epoch_end(metrics, control);
+				apply_learning_rate(control);
+				stop_session = control.session_stop_requested;
+				stop_training = control.training_stop_requested;
+			}
+
+			if (checkpoints && !settings.checkpoint_filename.empty()
+				&& ((settings.checkpoint_interval && state.epoch % settings.checkpoint_interval == 0) || control.checkpoint_requested))
+			{
+				NNLIGHT_PROFILE_PHASE(profile, CHECKPOINT_PHASE);
+				write_checkpoint(*checkpoints, state, log_stream);
+			}
+
+			if (profile)
+			{
+				epoch_profile.train_err = avg_train_err;
+				epoch_profile.train_accuracy = train_accuracy;
+				if (test_beg != test_end)
+				{
+					epoch_profile.test_err = state.prev_test_err;
+					epoch_profile.test_accuracy = test_accuracy;
 				}
-				if (batch_mode)
+				epoch_profile.ntrain = train_perf.size();
+				epoch_profile.ntest = test_perf.size();
+				epoch_profile.total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - epoch_start).count();
+				epoch_profile.nallocs = AllocationCounter::thread_count() - epoch_allocs;
+				if (pipeline)
 				{
-					size_t neur_index = 0;
-					for (auto& out : outputs) out->backpropagate(nullptr, err[neur_index++]);
+					PipelineStats pipeline_stats = pipeline->get_stats();
+					epoch_profile.ninput_stalls = pipeline_stats.nconsumer_stalls - epoch_pipeline_stats.nconsumer_stalls;
+					epoch_profile.nbackpressure_stalls = pipeline_stats.nproducer_stalls - epoch_pipeline_stats.nproducer_stalls;
 				}
-				double avg_train_err = std::accumulate(train_perf.begin(), train_perf.end(), 0.0);
-				avg_train_err /= train_perf.size();
-				delta_train_err = prev_train_err - avg_train_err;
-				prev_train_err = avg_train_err;
+				settings.profiler->record(epoch_profile);
+			}
+		}
+		if (test_beg != test_end && state.epoch > 0)
+		{
+			// the test error is measured before training in an epoch, so the weights of the last epoch are tested once more
+			double final_test_err = 0;
+			for (auto it = test_beg; it != test_end; ++it)
+			{
+				feed(input[*it].data());
+				final_test_err += sample_error(desired_output[*it].data());
+			}
+			state.prev_test_err = final_test_err / test_perf.size();
 
-				++epoch;
+			// roll back to the weights of the lowest test error, the Rprop state is not rolled back
+			if (state.best_epoch > 0 && state.best_test_err < state.prev_test_err)
+			{
+				set_weights(state.best_weights.data());
+				state.prev_test_err = state.best_test_err;
+				state.prev_train_err = state.best_train_err;
+				log_stream << "Weights of epoch " << state.best_epoch << " are restored" << std::endl;
 			}
-			log_stream << "Train error: " << prev_train_err << std::endl;
-			if (test_in_beg != test_in_end)
-				log_stream << "Test error: " << prev_test_err << std::endl;
 		}
-		catch (ActivationOutOfBoundsException& e)
+		log_stream << "Train error: " << state.prev_train_err << std::endl;
+		if (test_beg != test_end)
+			log_stream << "Test error: " << state.prev_test_err << std::endl;
+	}
+	catch (ActivationOutOfBoundsException& e)
+	{
+		log_stream << e.what() << std::endl;
+		for (auto& neur : neurons)
+			neur->reset(state.init_gen);
+		log_stream << "Weigths are reset!" << std::endl;
+	}
+	return !stop_training;
+}
+
+/**
+ * Prepares the state and the network for a new training session: resets the error values and randomizes the weights.
+ * @param state
+ * @param shuffle_samples shuffles all samples, so the session gets a new train/test split
+ * @param keep_weights starts from the current weights instead of random ones (see NNSettings::set_warm_start)
+ */
+void NeuronNetwork::start_session(TrainingState& state, bool shuffle_samples, bool keep_weights)
+{
+	// shuffle all samples, the first ntrain of them are used for training, the rest for testing
+	if (shuffle_samples)
+		state.gen.shuffle(state.order.begin(), state.order.end());
+	// reset error values, test increse checker deque and neurons
+	state.prev_train_err = state.prev_test_err = state.delta_train_err = state.delta_test_err = std::numeric_limits<double>::max();
+	state.test_err_is_increasing.assign(test_err_increase_threshold, false);
+	state.best_test_err = state.best_train_err = std::numeric_limits<double>::max();
+	state.best_epoch = 0;
+	for (auto& neur : neurons)
+	{
+		if (!keep_weights)
+			neur->reset(state.init_gen); // resets inputs, errors and weights of neurons
+		else
 		{
-			log_stream << e.what() << std::endl;
-			reset_neurons();
-			log_stream << "Weigths are reset!" << std::endl;
+			neur->clear_propagation();
+			neur->rprop.reset();
 		}
-		++nrestart;
 	}
+	state.epoch = 0;
+}
+
+/**
+ * Tells if the session of the state reached the target error (see NNSettings::set_target_error): the test error, or the train error if there are no test samples.
+ * @param state
+ * @return bool
+ */
+bool NeuronNetwork::reached_target_error(const TrainingState& state) const
+{
+	double err = state.ntrain < state.order.size() ? state.prev_test_err : state.prev_train_err;
+	return settings.target_err > 0 && err <= settings.target_err;
+}
+
+/**
+ * Tells if the session of the state has to be followed by a new session (see NNSettings::restart_training_if_stuck).
+ * @param state
+ * @return bool
+ */
+bool NeuronNetwork::needs_restart(const TrainingState& state) const
+{
+	return settings.restart_if_high_error && settings.restart_threshold < state.prev_train_err && !reached_target_error(state) && state.nrestart < settings.max_nrestart;
+}
+
+/**
+ * Calls the on_restart hook of the observer, if there is one, with the final errors of the session of the state.
+ * @param session index of the session
+ * @param state
+ * @param restarting true if another session follows
+ * @return true if the observer stopped the training
+ */
+bool NeuronNetwork::notify_restart(size_t session, const TrainingState& state, bool restarting)
+{
+	if (!settings.observer)
+		return false;
+
+	SessionMetrics metrics;
+	metrics.session = session;
+	metrics.nepoch = state.epoch;
+	metrics.train_err = state.prev_train_err;
+	metrics.test_err = state.prev_test_err;
+	metrics.restarting = restarting;
+	TrainingControl control;
+	settings.observer->on_restart(metrics, control);
+	return control.training_stop_requested;
+}
+
+/**
+ * Takes a snapshot of the training state and the weights, and hands it to the background checkpoint writer.
+ * @param checkpoints
+ * @param state
+ * @param log_stream
+ */
+void NeuronNetwork::write_checkpoint(CheckpointWriter& checkpoints, const TrainingState& state, ostream& log_stream)
+{
+	TrainingState snapshot(state);
+	snapshot.weights.resize(num_of_weights());
+	get_weights(snapshot.weights.data());
+	for (auto& neur : neurons)
+	{
+		const auto& rprop = neur->get_rprop();
+		size_t offset = snapshot.rprop_state.size();
+		snapshot.rprop_state.resize(offset + rprop.state_size());
+		rprop.get_state(snapshot.rprop_state.data() + offset);
+	}
+	if (full_batch_trainer)
+		full_batch_trainer->get_state(snapshot.trainer_state);
+	string prev_error = checkpoints.write(snapshot);
+	if (!prev_error.empty())
+		log_stream << "Checkpoint is not written: " << prev_error << std::endl;
 }
 
 /**
@@ -259,11 +878,25 @@ void NeuronNetwork::train(vector<vector<double>> input, vector<vector<double>> d
  * @param train_stream
  * @param log_stream
  * @param train_ratio
+ * @return errors, epochs, sessions and time of the training
  */
-void NeuronNetwork::train(istream& train_stream, ostream& log_stream, double train_ratio, bool batch_mode)
+TrainingResult NeuronNetwork::train(istream& train_stream, ostream& log_stream, double train_ratio, bool batch_mode)
 {
 	vector<vector<double>> input;
 	vector<vector<double>> desired_output;
+	read_samples(train_stream, input, desired_output, log_stream);
+	return train(input, desired_output, log_stream, train_ratio, batch_mode);
+}
+
+/**
+ * Reads inputs and desired outputs from a stream until its end. Each sample is made of as many inputs as the number of input neurons, followed by as many desired outputs as the number of output neurons.
+ * @param train_stream
+ * @param input
+ * @param desired_output
+ * @param log_stream
+ */
+void NeuronNetwork::read_samples(istream& train_stream, vector<vector<double>>& input, vector<vector<double>>& desired_output, ostream& log_stream)
+{
 	log_stream << "Reading inputs and desired outputs from stream ..." << std::endl;
 	while (!train_stream.eof())
 	{
@@ -274,7 +907,6 @@ void NeuronNetwork::train(istream& train_stream, ostream& log_stream, double tra
 		for (auto& out : desired_output.back())
 			train_stream >> out;
 	}
-	train(input, desired_output, log_stream, train_ratio, batch_mode);
 }
 
 /**
@@ -284,13 +916,14 @@ void NeuronNetwork::train(istream& train_stream, ostream& log_stream, double tra
  */
 void NeuronNetwork::test(const vector<double>& input, vector<double>& output)
 {
+	NNLIGHT_TIME_INFERENCE(inference_stats, 1);
+
 	// forward propagation
-	size_t neur_index = 0;
-	for (auto& in : inputs) in->feed(input[neur_index++]);
+	feed(input.data());
 
 	// write output
 	output.resize(outputs.size());
-	neur_index = 0;
+	size_t neur_index = 0;
 	for (auto& out : outputs) output[neur_index++] = out->get_activation();
 }
 
@@ -301,9 +934,10 @@ void NeuronNetwork::test(const vector<double>& input, vector<double>& output)
  */
 void NeuronNetwork::test(const vector<double>& input, ostream& output_stream, string delimiter)
 {
+	NNLIGHT_TIME_INFERENCE(inference_stats, 1);
+
 	// forward propagation
-	size_t neur_index = 0;
-	for (auto& in : inputs) in->feed(input[neur_index++]);
+	feed(input.data());
 
 	// write output
 	for (auto& out : outputs) output_stream << out->get_activation() << delimiter;
@@ -316,6 +950,8 @@ void NeuronNetwork::test(const vector<double>& input, ostream& output_stream, st
  */
 void NeuronNetwork::test(istream& input_stream, vector<double>& output)
 {
+	NNLIGHT_TIME_INFERENCE(inference_stats, 1);
+
 	// forward propagation
 	double in_val;
 	for (auto& in : inputs)
@@ -323,6 +959,8 @@ void NeuronNetwork::test(istream& input_stream, vector<double>& output)
 		input_stream >> in_val;
 		in->feed(in_val);
 	}
+	if (softmax_output)
+		apply_softmax();
 
 	// write output
 	output.resize(outputs.size());
@@ -337,6 +975,8 @@ void NeuronNetwork::test(istream& input_stream, vector<double>& output)
  */
 void NeuronNetwork::test(istream& input_stream, ostream& output_stream, string delimiter)
 {
+	NNLIGHT_TIME_INFERENCE(inference_stats, 1);
+
 	// forward propagation
 	double in_val;
 	for (auto& in : inputs)
@@ -344,18 +984,253 @@ void NeuronNetwork::test(istream& input_stream, ostream& output_stream, string d
 		input_stream >> in_val;
 		in->feed(in_val);
 	}
+	if (softmax_output)
+		apply_softmax();
 
 	// write output
 	for (auto& out : outputs) output_stream << out->get_activation() << delimiter;
 }
 
 /**
- * Randomize a new value for all weights (including the bias) in the range of [Neuron::def_lower_bound, Neuron::def_upper_bound) for the whole network. Also clears Neuron::inputs and Neuron::errors.
+ * Activates the input neurons of the network with the given sparse input and reads the output of the output neurons. Only the listed inputs are propagated
+ * to the neurons having InputNeurons as their only inputs, so their cost is proportional to the number of nonzero inputs. Each input index may be listed once.
+ * The output vector is filled with as many elements as the number of output neurons in the network.
+ * @param input
+ * @param output
+ */
+void NeuronNetwork::test(const SparseSample& input, vector<double>& output)
+{
+	NNLIGHT_TIME_INFERENCE(inference_stats, 1);
+
+	// forward propagation
+	feed(input);
+
+	// write output
+	output.resize(outputs.size());
+	size_t neur_index = 0;
+	for (auto& out : outputs) output[neur_index++] = out->get_activation();
+}
+
+/**
+ * Activates the input neurons of the network with each of the given inputs in turn and reads the outputs of the output neurons. The outputs are resized to the
+ * number of inputs, each filled with as many elements as the number of output neurons in the network. Recorded as a single call of a batch by the inference statistics.
+ * @param input
+ * @param output
+ */
+void NeuronNetwork::test(const vector<vector<double>>& input, vector<vector<double>>& output)
+{
+	NNLIGHT_TIME_INFERENCE(inference_stats, input.size());
+
+	output.resize(input.size());
+	for (size_t s = 0; s < input.size(); ++s)
+	{
+		// forward propagation
+		feed(input[s].data());
+
+		// write output
+		output[s].resize(outputs.size());
+		size_t neur_index = 0;
+		for (auto& out : outputs) output[s][neur_index++] = out->get_activation();
+	}
+}
+
+/**
+ * Records the latency and batch size of every test() call to the given statistics. Clones of the network do not record to them.
+ * The statistics are not owned and have to outlive the calls. Set them to nullptr (default) to turn collecting off.
+ * Nothing is recorded if NNLIGHT_NO_PROFILING is defined.
+ * @param stats_
+ */
+void NeuronNetwork::collect_inference_stats(InferenceStats* stats_)
+{
+	inference_stats = stats_;
+}
+
+/**
+ * Randomize a new value for all weights (including the bias) in the range of [Neuron::def_lower_bound, Neuron::def_upper_bound) for the whole network. Also clears the propagated input values and errors of the neurons.
+ * The weights only depend on the seed if one is set by NNSettings::set_seed.
  */
 void NeuronNetwork::reset_neurons()
 {
+	RandomGenerator gen = make_random();
+	for (auto& neur : neurons)
+		neur->reset(gen);
+}
+
+/**
+ * Creates a random generator seeded by NNSettings::set_seed, or by std::random_device if no seed is set.
+ */
+RandomGenerator NeuronNetwork::make_random() const
+{
+	if (settings.seed)
+		return RandomGenerator(settings.seed);
+	std::random_device rand_dev;
+	return RandomGenerator((static_cast<uint64_t>(rand_dev()) << 32) ^ rand_dev());
+}
+
+/**
+ * Feeds a sample to the input neurons and propagates it through the network. If the sample is sparse enough (see sparse_input_ratio), zero inputs are not propagated
+ * to the neurons having InputNeurons as their only inputs.
+ * @param sample as many values as the number of input neurons
+ */
+void NeuronNetwork::feed(const double* sample)
+{
+	update_first_layer();
+	size_t nnonzero = 0;
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		inputs[i]->activation = sample[i];
+		if (sample[i] != 0.0)
+			++nnonzero;
+	}
+	if (nnonzero <= sparse_input_ratio * inputs.size())
+		for (auto& in : inputs)
+			if (in->activation != 0.0)
+				in->propagate_active();
+
+	// each neuron counts its input neurons at once
+	for (auto neur : first_layer)
+		neur->receive(neur->ninput_neurons);
+	if (softmax_output)
+		apply_softmax();
+}
+
+/**
+ * Feeds a sparse sample to the input neurons and propagates it through the network.
+ * @param sample
+ */
+void NeuronNetwork::feed(const SparseSample& sample)
+{
+	update_first_layer();
+	for (auto& in : inputs)
+		in->activation = 0.0;
+	for (auto& in : sample)
+	{
+		if (in.first >= inputs.size())
+			throw std::runtime_error("Input index is out of range!");
+		inputs[in.first]->activation = in.second;
+		if (in.second != 0.0)
+			inputs[in.first]->propagate_active();
+	}
+
+	for (auto neur : first_layer)
+		neur->receive(neur->ninput_neurons);
+	if (softmax_output)
+		apply_softmax();
+}
+
+/**
+ * Normalizes the weighted input sums of the output neurons by softmax, keeping the log of the outputs in output_log_probs. Called at the end of every
+ * forward propagation if softmax_output is set. The largest sum is subtracted before exponentiating (log-sum-exp), so large sums do not overflow.
+ */
+void NeuronNetwork::apply_softmax()
+{
+	double max_sum = -std::numeric_limits<double>::max();
+	for (auto& out : outputs)
+		max_sum = std::max(max_sum, out->activation);
+	double exp_sum = 0;
+	for (size_t o = 0; o < outputs.size(); ++o)
+	{
+		output_log_probs[o] = outputs[o]->activation - max_sum;
+		exp_sum += std::exp(output_log_probs[o]);
+	}
+	const double log_exp_sum = std::log(exp_sum);
+	for (size_t o = 0; o < outputs.size(); ++o)
+	{
+		output_log_probs[o] -= log_exp_sum;
+		outputs[o]->activation = std::exp(output_log_probs[o]);
+	}
+}
+
+/**
+ * Error of the output activations for the desired output of a sample: the mean squared error, or the cross-entropy if the outputs are normalized by softmax.
+ * @param desired_output
+ * @return double
+ */
+double NeuronNetwork::sample_error(const double* desired_output) const
+{
+	double err = 0;
+	if (softmax_output)
+	{
+		// the gradient of the cross-entropy by the sums of the output neurons is output - desired output, as backpropagated for the squared error
+		for (size_t o = 0; o < outputs.size(); ++o)
+			err -= desired_output[o] * output_log_probs[o];
+		return err;
+	}
+	for (size_t o = 0; o < outputs.size(); ++o)
+		err += std::pow(outputs[o]->activation - desired_output[o], 2.0); // MSE
+	return err / outputs.size();
+}
+
+/**
+ * Tells if the output activations pick the same class as the desired output: the largest output, or the output above 0.5 if there is a single output neuron.
+ * @param desired_output
+ * @return bool
+ */
+bool NeuronNetwork::classified_correctly(const double* desired_output) const
+{
+	if (outputs.size() == 1)
+		return (outputs[0]->activation > 0.5) == (desired_output[0] > 0.5);
+	size_t predicted = 0, desired = 0;
+	for (size_t o = 1; o < outputs.size(); ++o)
+	{
+		if (outputs[o]->activation > outputs[predicted]->activation)
+			predicted = o;
+		if (desired_output[o] > desired_output[desired])
+			desired = o;
+	}
+	return predicted == desired;
+}
+
+/**
+ * Collects the output neurons of the input neurons into first_layer, if the connections of the neurons changed since it was last collected.
+ */
+void NeuronNetwork::update_first_layer()
+{
+	const uint64_t generation = Neuron::topology_generation();
+	if (generation == first_layer_generation)
+		return;
+
+	first_layer.clear();
+	unordered_set<Neuron*> first_layer_set;
+	for (auto& in : inputs)
+		for (auto out : in->output_neurons)
+			if (first_layer_set.insert(out).second)
+				first_layer.push_back(out);
+	// sparse passes store at most one value per input neuron, reserved so feeding does not allocate
+	for (auto neur : first_layer)
+		if (neur->has_sparse_inputs())
+			neur->active_inputs.reserve(neur->ninput_neurons);
+	first_layer_generation = generation;
+}
+
+/**
+ * Rebuilds the output connections of the neurons from the input connections of the neurons of the network, after connections were removed.
+ */
+void NeuronNetwork::relink_outputs()
+{
+	auto unlink = [] (Neuron* neur) {
+		neur->output_neurons.clear();
+		auto input = dynamic_cast<InputNeuron*>(neur);
+		if (input)
+			input->output_slots.clear();
+	};
+	for (auto& neur : neurons)
+	{
+		unlink(neur.get());
+		for (auto& in : neur->input_neurons)
+			unlink(in.get());
+	}
 	for (auto& neur : neurons)
-		neur->reset();
+		for (size_t i = 0; i < neur->input_neurons.size(); ++i)
+		{
+			auto& in = neur->input_neurons[i];
+			in->output_neurons.push_back(neur.get());
+			auto input = dynamic_cast<InputNeuron*>(in.get());
+			if (input)
+				input->output_slots.push_back(i);
+		}
+	// collected again by the next forward propagation
+	Neuron::topology_changed();
 }
 
 /**
@@ -368,6 +1243,7 @@ void NeuronNetwork::use_default_backpropation(double learning_rate_, double regu
 {
 	for (auto& neur : neurons)
 		neur->use_default_backpropation(learning_rate_, regularization_);
+	full_batch_trainer.reset();
 }
 
 /**
@@ -382,18 +1258,472 @@ void NeuronNetwork::use_resilient_backpropagation(double delta0, double deltamax
 {
 	for (auto& neur : neurons)
 		neur->use_resilient_backpropagation(delta0, deltamax, incr_factor, decr_factor);
-	
+	full_batch_trainer.reset();
+}
+
+/**
+ * Trains the network by L-BFGS, a quasi-Newton method: every epoch is one iteration on all the train samples, along the direction given by
+ * the gradient and an approximation of the inverse Hessian from the latest iterations. Batch mode, learning rates and regularization are not used.
+ * Turned off by use_default_backpropation() and use_resilient_backpropagation().
+ * @param history number of iterations kept for approximating the inverse Hessian
+ * @param precision precision of the forward and backward passes, the weights and the state of L-BFGS are kept in double (mixed precision)
+ */
+void NeuronNetwork::use_lbfgs(size_t history, FullBatchTrainer::Precision precision)
+{
+	full_batch_trainer = std::make_shared<LbfgsTrainer>(history, precision);
+}
+
+/**
+ * Trains the network by Levenberg-Marquardt: every epoch is one damped Gauss-Newton iteration on all the train samples. Converges in few epochs
+ * on small networks, but the memory and time of an epoch grow with the square of the number of weights. Batch mode, learning rates and
+ * regularization are not used, softmax outputs are not supported. Turned off by use_default_backpropation() and use_resilient_backpropagation().
+ * @param damping initial damping, relative to the diagonal of the normal equations
+ * @param precision precision of the forward and backward passes, the weights and the normal equations are kept in double (mixed precision)
+ */
+void NeuronNetwork::use_levenberg_marquardt(double damping, FullBatchTrainer::Precision precision)
+{
+	if (softmax_output)
+		throw std::runtime_error("Levenberg-Marquardt needs squared error outputs, turn off softmax output first!");
+	full_batch_trainer = std::make_shared<LevenbergMarquardtTrainer>(damping, precision);
+}
+
+/**
+ * Turns the output neurons into a softmax layer trained on cross-entropy: the outputs are the exponentials of the weighted input sums of the output neurons
+ * normalized to sum to 1, and the train and test errors are the cross-entropy of the outputs and the desired outputs instead of the mean squared error.
+ * Desired outputs are expected to be one-hot vectors (or class probabilities). Call only after the output neurons are added to the network.
+ * @param softmax false turns back to independent sigmoid outputs trained on squared error
+ */
+void NeuronNetwork::use_softmax_output(bool softmax)
+{
+	softmax_output = softmax;
+	for (auto& out : outputs)
+		out->linear_activation = softmax;
+	output_log_probs.assign(softmax ? outputs.size() : 0, 0.0);
+}
+
+/**
+ * Creates a deep copy of the network: new neurons with the same connections, weights and learning parameters, and the same settings.
+ * The copy can be trained independently of the original network.
+ * @return shared_ptr<NeuronNetwork>
+ */
+shared_ptr<NeuronNetwork> NeuronNetwork::clone() const
+{
+	auto copy = std::make_shared<NeuronNetwork>();
+	copy->settings = settings;
+
+	// copy neurons first, then connect the copies the same way as the originals
+	unordered_map<const Neuron*, NeuronPtr> copies;
+	copies.reserve(neurons.size());
+	for (auto& neur : neurons)
+		copies[neur.get()] = neur->clone();
+	for (auto& neur : neurons)
+	{
+		vector<NeuronPtr> copied_inputs;
+		copied_inputs.reserve(neur->get_input_neurons().size());
+		for (auto& in : neur->get_input_neurons())
+		{
+			auto it = copies.find(in.get());
+			if (it == copies.end())
+				throw std::runtime_error("Neuron is connected to a neuron that is not added to the network!");
+			copied_inputs.push_back(it->second);
+		}
+		copies[neur.get()]->replace_inputs(copied_inputs);
+	}
+	for (auto& neur : neurons)
+		copies[neur.get()]->replace_shared(copies);
+
+	for (auto& neur : neurons)
+		copy->neurons.push_back(copies[neur.get()]);
+	copy->neuron_set.insert(copy->neurons.begin(), copy->neurons.end());
+	for (auto& in : inputs)
+		copy->inputs.push_back(std::static_pointer_cast<InputNeuron>(copies[in.get()]));
+	for (auto& out : outputs)
+		copy->outputs.push_back(std::static_pointer_cast<OutputNeuron>(copies[out.get()]));
+	copy->use_softmax_output(softmax_output);
+	if (full_batch_trainer)
+		copy->full_batch_trainer = full_batch_trainer->clone();
+	return copy;
+}
+
+/**
+ * Returns the number of weights in the network, including the bias weights.
+ * @return size_t
+ */
+size_t NeuronNetwork::num_of_weights() const
+{
+	size_t nweights = 0;
+	for (auto& neur : neurons)
+		nweights += 1 + neur->get_input_weights().size();
+	return nweights;
+}
+
+/**
+ * Returns the number of connections between the neurons of the network, that is the number of weights without the bias weights.
+ * @return size_t
+ */
+size_t NeuronNetwork::num_of_connections() const
+{
+	size_t nconnections = 0;
+	for (auto& neur : neurons)
+		nconnections += neur->input_neurons.size();
+	return nconnections;
+}
+
+/**
+ * Removes the given ratio of the connections of the network, the ones of the smallest absolute weights over the whole network (magnitude pruning),
+ * then removes the hidden neurons left without output connections. Every neuron keeps its largest input weight, so it is still activated.
+ * Convolution and pooling neurons (see make_conv1d_layer) are not pruned, neither are the connections from them.
+ * The remaining weights are not changed; retrain the network with NNSettings::set_warm_start to recover the accuracy (see prune_iteratively).
+ * Removed neurons are disconnected from the network, but stay alive while they are referenced. Compile or save the pruned network to get a model
+ * evaluating the remaining connections only.
+ * @param ratio ratio of the current connections to remove, in [0, 1]
+ * @return number of connections removed
+ */
+size_t NeuronNetwork::prune(double ratio)
+{
+	if (ratio < 0 || ratio > 1)
+		throw std::runtime_error("Pruning ratio has to be in [0, 1]!");
+
+	// every neuron keeps its largest input weight, the magnitudes of the other weights are the candidates, except for the tied weights
+	// and the inputs from neurons of tied weights: the neurons of a filter have to keep the same inputs, and stay connected
+	const size_t nconnections = num_of_connections();
+	vector<size_t> kept(neurons.size());
+	vector<double> magnitudes;
+	magnitudes.reserve(nconnections);
+	for (size_t n = 0; n < neurons.size(); ++n)
+	{
+		const auto& weights = neurons[n]->input_weights;
+		for (size_t i = 1; i < weights.size(); ++i)
+			if (std::abs(weights[i]) > std::abs(weights[kept[n]]))
+				kept[n] = i;
+		for (size_t i = 0; i < weights.size(); ++i)
+			if (i != kept[n] && !neurons[n]->tied_weights && !neurons[n]->input_neurons[i]->tied_weights)
+				magnitudes.push_back(std::abs(weights[i]));
+	}
+	const size_t nremoved = std::min(static_cast<size_t>(ratio * nconnections + 0.5), magnitudes.size());
+	if (nremoved == 0)
+		return 0;
+
+	// the nremoved smallest magnitudes are the ones below the threshold and as many as needed of the ones equal to it
+	std::nth_element(magnitudes.begin(), magnitudes.begin() + (nremoved - 1), magnitudes.end());
+	const double threshold = magnitudes[nremoved - 1];
+	size_t nequal = nremoved;
+	for (auto magnitude : magnitudes)
+		if (magnitude < threshold)
+			--nequal;
+	vector<bool> removed;
+	for (size_t n = 0; n < neurons.size(); ++n)
+	{
+		const auto& weights = neurons[n]->input_weights;
+		removed.assign(weights.size(), false);
+		for (size_t i = 0; i < weights.size(); ++i)
+		{
+			if (i == kept[n] || neurons[n]->tied_weights || neurons[n]->input_neurons[i]->tied_weights)
+				continue;
+			const double magnitude = std::abs(weights[i]);
+			if (magnitude < threshold)
+				removed[i] = true;
+			else if (magnitude == threshold && nequal > 0)
+			{
+				removed[i] = true;
+				--nequal;
+			}
+		}
+		neurons[n]->remove_inputs(removed);
+	}
+	relink_outputs();
+
+	// hidden neurons without outputs do not affect the outputs, removing them may leave their input neurons without outputs
+	for (;;)
+	{
+		size_t nremaining = 0;
+		for (size_t n = 0; n < neurons.size(); ++n)
+		{
+			auto& neur = neurons[n];
+			if (neur->output_neurons.empty() && !neur->tied_weights && !dynamic_cast<InputNeuron*>(neur.get()) && !dynamic_cast<OutputNeuron*>(neur.get()))
+			{
+				neur->remove_inputs(vector<bool>(neur->input_neurons.size(), true));
+				neuron_set.erase(neur);
+			}
+			else
+				neurons[nremaining++] = neur;
+		}
+		if (nremaining == neurons.size())
+			break;
+		neurons.resize(nremaining);
+		relink_outputs();
+	}
+	return nconnections - num_of_connections();
+}
+
+static void log_pruning_step(ostream& log_stream, const PruningStep& step)
+{
+	log_stream << "Sparsity " << step.sparsity << ": " << step.nconnections << " connections, " << step.nneurons << " neurons, error " << step.error
+		<< ", accuracy " << step.accuracy << ", " << step.latency_ns << " ns per sample";
+	if (step.nepoch > 0)
+		log_stream << ", retrained for " << step.nepoch << " epochs";
+	log_stream << std::endl;
+}
+
+/**
+ * Prunes the network to the target sparsity in nsteps steps, retraining it by train() from its pruned weights after each step, with warm start
+ * and without restarts, other settings as set. The number of connections shrinks by the same factor every step. Reports the unpruned network
+ * and every sparsity level, also to the log stream.
+ * @param target_sparsity ratio of the connections to remove in the end, relative to the connections before pruning, in [0, 1)
+ * @param nsteps number of pruning and retraining steps
+ * @param input
+ * @param desired_output
+ * @param log_stream
+ * @param train_ratio
+ * @param batch_mode
+ * @return vector<PruningStep>
+ */
+vector<PruningStep> NeuronNetwork::prune_iteratively(double target_sparsity, size_t nsteps, const vector<vector<double>>& input,
+	const vector<vector<double>>& desired_output, ostream& log_stream, double train_ratio, bool batch_mode)
+{
+	if (target_sparsity < 0 || target_sparsity >= 1)
+		throw std::runtime_error("Target sparsity has to be in [0, 1)!");
+	if (nsteps == 0)
+		throw std::runtime_error("Number of pruning steps has to be positive!");
+	if (input.size() != desired_output.size())
+		throw std::runtime_error("Number of inputs and desired outputs differ!");
+
+	vector<PruningStep> steps;
+	steps.push_back(measure_pruning_step(input, desired_output));
+	log_pruning_step(log_stream, steps.back());
+	const double initial_nconnections = static_cast<double>(steps.back().nconnections);
+
+	// retraining continues from the pruned weights, a restart would randomize them
+	NNSettings saved_settings;
+	saved_settings = settings;
+	settings.warm_start = true;
+	settings.restart_if_high_error = false;
+	try
+	{
+		for (size_t k = 1; k <= nsteps; ++k)
+		{
+			// the number of connections shrinks by the same factor every step, down to 1 - target_sparsity of the initial ones
+			const double target_nconnections = initial_nconnections * std::pow(1.0 - target_sparsity, static_cast<double>(k) / nsteps);
+			const double nconnections = static_cast<double>(num_of_connections());
+			prune(nconnections > target_nconnections ? 1.0 - target_nconnections / nconnections : 0.0);
+
+			TrainingResult result = train(input, desired_output, log_stream, train_ratio, batch_mode);
+			PruningStep step = measure_pruning_step(input, desired_output);
+			step.sparsity = initial_nconnections > 0 ? 1.0 - step.nconnections / initial_nconnections : 0.0;
+			step.nepoch = result.nepoch;
+			steps.push_back(step);
+			log_pruning_step(log_stream, step);
+		}
+	}
+	catch (...)
+	{
+		settings = saved_settings;
+		throw;
+	}
+	settings = saved_settings;
+	return steps;
+}
+
+/**
+ * Measures the network for prune_iteratively: its size, its error and accuracy on all the samples, and the latency of its compiled model.
+ * @param input
+ * @param desired_output
+ * @return PruningStep
+ */
+PruningStep NeuronNetwork::measure_pruning_step(const vector<vector<double>>& input, const vector<vector<double>>& desired_output)
+{
+	PruningStep step;
+	step.sparsity = 0;
+	step.nconnections = num_of_connections();
+	step.nneurons = neurons.size();
+	step.nepoch = 0;
+
+	double err_sum = 0;
+	size_t ncorrect = 0;
+	for (size_t s = 0; s < input.size(); ++s)
+	{
+		feed(input[s].data());
+		err_sum += sample_error(desired_output[s].data());
+		if (classified_correctly(desired_output[s].data()))
+			++ncorrect;
+	}
+	step.error = input.empty() ? 0.0 : err_sum / input.size();
+	step.accuracy = input.empty() ? 0.0 : static_cast<double>(ncorrect) / input.size();
+
+	// the compiled model evaluates the remaining connections only, batches of all the samples are timed for at least min_time seconds
+	const double min_time = 0.05;
+	CompiledNetwork model(*this);
+	vector<double> flat_input;
+	flat_input.reserve(input.size() * inputs.size());
+	for (auto& sample : input)
+		flat_input.insert(flat_input.end(), sample.begin(), sample.begin() + inputs.size());
+	vector<double> output(input.size() * outputs.size());
+	vector<double> activations(model.num_of_neurons());
+	size_t nevaluated = 0;
+	double elapsed = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (!input.empty() && elapsed < min_time)
+	{
+		model.test(flat_input.data(), input.size(), output.data(), activations.data());
+		nevaluated += input.size();
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	step.latency_ns = nevaluated > 0 ? elapsed * 1e9 / nevaluated : 0.0;
+	return step;
+}
+
+/**
+ * Copies all weights of the network to the given buffer of num_of_weights() elements. Neurons follow each other in the order they were added, each with its bias weight first, then its input weights in connection order.
+ * @param weights
+ */
+void NeuronNetwork::get_weights(double* weights) const
+{
+	for (auto& neur : neurons)
+	{
+		*weights++ = neur->get_biasweight();
+		weights = std::copy(neur->get_input_weights().begin(), neur->get_input_weights().end(), weights);
+	}
+}
+
+/**
+ * Overwrites all weights of the network from a buffer of num_of_weights() elements, in the order used by get_weights().
+ * @param weights
+ */
+void NeuronNetwork::set_weights(const double* weights)
+{
+	for (auto& neur : neurons)
+	{
+		neur->set_biasweight(*weights++);
+		neur->set_input_weights(weights);
+		weights += neur->get_input_weights().size();
+	}
+}
+
+/**
+ * Writes the topology, activation types and weights of the network to a binary model file. See CompiledNetwork for the format.
+ * @param filename
+ */
+void NeuronNetwork::save(const string& filename) const
+{
+	CompiledNetwork(*this).save(filename);
+}
+
+/**
+ * Writes the network as a self-contained C++ header with the weights compiled in, to be evaluated without NNlight. See CompiledNetwork::export_header.
+ * @param filename
+ * @param name namespace of the generated code, a C++ identifier
+ */
+void NeuronNetwork::export_header(const string& filename, const string& name) const
+{
+	CompiledNetwork(*this).export_header(filename, name);
+}
+
+/**
+ * Replaces all neurons of the network with the ones described by a binary model file written by save(), so training can be continued.
+ * Learning parameters are not stored in the file, set them again after loading. Use CompiledNetwork directly if only inference is needed.
+ * The neurons of a convolution layer are loaded as independent neurons, their weights are no longer shared.
+ * @param filename
+ */
+void NeuronNetwork::load(const string& filename)
+{
+	CompiledNetwork model(filename);
+	model.verify();
+
+	// create neurons in the stored (topological) order
+	const auto* records = model.neuron_records();
+	vector<NeuronPtr> loaded(model.num_of_neurons());
+	for (size_t n = 0; n < loaded.size(); ++n)
+	{
+		switch (records[n].kind)
+		{
+		case ModelFormat::INPUT_NEURON: loaded[n] = make_neuron<InputNeuron>(); break;
+		case ModelFormat::OUTPUT_NEURON: loaded[n] = make_neuron<OutputNeuron>(); break;
+		default: loaded[n] = make_neuron<Neuron>(); break;
+		}
+	}
+
+	// the model is verified, so its connections are appended in bulk without the checks of Neuron::connect, storage sized once
+	vector<size_t> noutputs(loaded.size(), 0);
+	for (size_t n = 0; n < loaded.size(); ++n)
+	{
+		const uint32_t* src = model.sources() + records[n].first_weight;
+		for (uint32_t k = 0; k < records[n].ninputs; ++k)
+			++noutputs[src[k]];
+	}
+	for (size_t n = 0; n < loaded.size(); ++n)
+	{
+		loaded[n]->output_neurons.reserve(noutputs[n]);
+		if (records[n].kind == ModelFormat::INPUT_NEURON)
+			std::static_pointer_cast<InputNeuron>(loaded[n])->output_slots.reserve(noutputs[n]);
+	}
+
+	// connect neurons & copy weight blocks
+	for (size_t n = 0; n < loaded.size(); ++n)
+	{
+		auto& to = loaded[n];
+		const uint32_t* src = model.sources() + records[n].first_weight;
+		const double* weights = model.weights() + records[n].first_weight;
+		to->input_neurons.reserve(records[n].ninputs);
+		to->input_weights.assign(weights, weights + records[n].ninputs);
+		for (uint32_t k = 0; k < records[n].ninputs; ++k)
+		{
+			auto& from = loaded[src[k]];
+			if (records[src[k]].kind == ModelFormat::INPUT_NEURON)
+			{
+				std::static_pointer_cast<InputNeuron>(from)->output_slots.push_back(k);
+				++to->ninput_neurons;
+			}
+			from->output_neurons.push_back(to.get());
+			to->input_neurons.push_back(from);
+		}
+		to->set_biasweight(records[n].biasweight);
+		if (records[n].kind == ModelFormat::HIDDEN_NEURON && records[n].activation == ModelFormat::IDENTITY)
+			loaded[n]->linear_activation = true; // pooling neurons are loaded as trainable linear neurons
+	}
+
+	neurons = loaded;
+	Neuron::topology_changed(); // the first layer is collected again, also if the loaded network has the same shape
+	neuron_set.clear();
+	neuron_set.insert(loaded.begin(), loaded.end());
+	inputs.clear();
+	for (size_t i = 0; i < model.num_of_inputs(); ++i)
+		inputs.push_back(std::static_pointer_cast<InputNeuron>(loaded[model.input_ids()[i]]));
+	outputs.clear();
+	for (size_t o = 0; o < model.num_of_outputs(); ++o)
+		outputs.push_back(std::static_pointer_cast<OutputNeuron>(loaded[model.output_ids()[o]]));
+	use_softmax_output(model.has_softmax_output());
 }
 
 NeuronNetwork::NNSettings::NNSettings()
 	: restart_if_high_error(false), restart_threshold(0), max_nrestart(0),
-	max_nepoch(def_max_epoch)
+	max_nepoch(def_max_epoch), checkpoint_interval(0), early_stopping_patience(0), target_err(0), nthreads(1), seed(0), profiler(nullptr), observer(nullptr),
+	input_nbuffers(0), input_batch_size(def_input_batch_size), warm_start(false)
 {}
 
+NeuronNetwork::NNSettings& NeuronNetwork::NNSettings::operator=(const NNSettings& other)
+{
+	restart_if_high_error = other.restart_if_high_error;
+	restart_threshold = other.restart_threshold;
+	max_nrestart = other.max_nrestart;
+	max_nepoch = other.max_nepoch;
+	checkpoint_filename = other.checkpoint_filename;
+	checkpoint_interval = other.checkpoint_interval;
+	early_stopping_patience = other.early_stopping_patience;
+	target_err = other.target_err;
+	profiler = other.profiler;
+	observer = other.observer;
+	nthreads = other.nthreads;
+	seed = other.seed;
+	input_nbuffers = other.input_nbuffers;
+	input_batch_size = other.input_batch_size;
+	warm_start = other.warm_start;
+	return *this;
+}
+
 void NeuronNetwork::NNSettings::restart_training_if_stuck(bool do_restart, double restart_threshold_, size_t max_nrestart_)
 {
 	if (restart_threshold < 0)
-		throw std::exception("Invalid restart_threshold value!");
+		throw std::runtime_error("Invalid restart_threshold value!");
 
 	restart_if_high_error = do_restart;
 	restart_threshold = restart_threshold_;
@@ -405,29 +1735,66 @@ void NeuronNetwork::NNSettings::set_max_num_of_epochs(size_t max_nepoch_)
 	max_nepoch = max_nepoch_;
 }
 
-template <typename order_iterator, typename value_iterator>
-void reorder(order_iterator order_begin, order_iterator order_end, value_iterator v)
+void NeuronNetwork::NNSettings::save_checkpoints(const string& filename, size_t interval_nepoch)
 {
-    typedef typename std::iterator_traits<value_iterator>::value_type value_t;
-    typedef typename std::iterator_traits<order_iterator>::value_type index_t;
-    typedef typename std::iterator_traits<order_iterator>::difference_type diff_t;
+	if (interval_nepoch && filename.empty())
+		throw std::runtime_error("Checkpoint file name is empty!");
 
-    diff_t remaining = order_end - 1 - order_begin;
-    for (index_t s = index_t(), d; remaining > 0; ++s)
-	{
-    	for (d = order_begin[s]; d > s; d = order_begin[d]);
-    	if (d == s)
-		{
-    		--remaining;
-    		value_t temp = v[s];
-    		while (d = order_begin[d], d != s)
-			{
-    			swap(temp, v[d]);
-    			--remaining;
-    		}
-    		v[s] = temp;
-    	}
-    }
+	checkpoint_filename = filename;
+	checkpoint_interval = interval_nepoch;
+}
+
+void NeuronNetwork::NNSettings::set_early_stopping(size_t patience_nepoch)
+{
+	early_stopping_patience = patience_nepoch;
+}
+
+void NeuronNetwork::NNSettings::set_target_error(double target_err_)
+{
+	if (target_err_ < 0)
+		throw std::runtime_error("Invalid target error value!");
+
+	target_err = target_err_;
+}
+
+void NeuronNetwork::NNSettings::set_num_of_threads(size_t nthreads_)
+{
+	nthreads = nthreads_;
+}
+
+void NeuronNetwork::NNSettings::set_seed(uint64_t seed_)
+{
+	seed = seed_;
+}
+
+void NeuronNetwork::NNSettings::set_profiler(TrainingProfiler* profiler_)
+{
+#ifdef NNLIGHT_NO_PROFILING
+	if (profiler_)
+		throw std::runtime_error("Profiling is compiled out, NNLIGHT_NO_PROFILING is defined!");
+#endif
+	profiler = profiler_;
+}
+
+void NeuronNetwork::NNSettings::set_observer(TrainingObserver* observer_)
+{
+	observer = observer_;
+}
+
+void NeuronNetwork::NNSettings::set_input_pipeline(size_t nbuffers, size_t batch_size)
+{
+	if (nbuffers == 1)
+		throw std::runtime_error("Input pipeline needs at least 2 buffers!");
+	if (batch_size == 0)
+		throw std::runtime_error("Batch size of the input pipeline has to be positive!");
+
+	input_nbuffers = nbuffers;
+	input_batch_size = batch_size;
+}
+
+void NeuronNetwork::NNSettings::set_warm_start(bool warm_start_)
+{
+	warm_start = warm_start_;
 }
 
 }
\ No newline at end of file
@@ -14,10 +14,16 @@
 #include <deque>
 #include <string>
 #include <array>
+#include <atomic>
 #include "Neuron.h"
 #include "OutputNeuron.h"
 #include "InputNeuron.h"
 #include "ActivationOutOfBoundsException.h"
+#include "TrainingProfiler.h"
+#include "TrainingObserver.h"
+#include "InferenceStats.h"
+#include "FullBatchTrainer.h"
+#include "InputPipeline.h"
 
 using std::vector;
 using std::istream;
@@ -28,6 +34,101 @@ using std::string;
 
 namespace NNlight {
 
+struct TrainingState;
+class CheckpointWriter;
+class NeuronNetwork;
+
+/**
+ * Sparse input sample: index of the input neuron and its value, for each nonzero input. Inputs not listed are zero.
+ */
+typedef vector<std::pair<size_t, double>> SparseSample;
+
+/**
+ * Outcome of NeuronNetwork::train and NeuronNetwork::resume_training.
+ */
+struct TrainingResult
+{
+	/**
+	 * Train and test error of the network after training. The test error is the maximum double value if there are no test samples.
+	 */
+	double train_err, test_err;
+	/**
+	 * Number of epochs trained in the kept session, and the number of sessions run (restarts included).
+	 */
+	size_t nepoch, nsession;
+	/**
+	 * True if the target error (see NNSettings::set_target_error) is reached.
+	 */
+	bool target_reached;
+	/**
+	 * Time spent on training, in seconds.
+	 */
+	double wall_time;
+};
+
+/**
+ * Outcome of a cross-validation fold.
+ */
+struct FoldResult
+{
+	double train_err, test_err;
+	/**
+	 * Number of epochs trained.
+	 */
+	size_t nepoch;
+	/**
+	 * Time spent on training the fold, in seconds.
+	 */
+	double wall_time;
+};
+
+/**
+ * Outcome of NeuronNetwork::cross_validate: errors of every fold and their aggregates.
+ */
+struct CrossValidationResult
+{
+	vector<FoldResult> folds;
+	double mean_train_err, mean_test_err;
+	double stddev_test_err;
+	/**
+	 * Index of the fold with the lowest test error.
+	 */
+	size_t best_fold;
+	/**
+	 * Network trained on the best fold, only if it was asked for.
+	 */
+	std::shared_ptr<NeuronNetwork> best_model;
+	/**
+	 * Time spent on the whole cross-validation, in seconds.
+	 */
+	double wall_time;
+};
+
+/**
+ * A sparsity level of NeuronNetwork::prune_iteratively: the size of the network after pruning and retraining, its error and accuracy on all the
+ * given samples, and the latency of its compiled model.
+ */
+struct PruningStep
+{
+	/**
+	 * Ratio of the connections removed, relative to the connections before pruning.
+	 */
+	double sparsity;
+	size_t nconnections, nneurons;
+	/**
+	 * Mean error (see NeuronNetwork::train) and ratio of correctly classified samples, measured on all the samples.
+	 */
+	double error, accuracy;
+	/**
+	 * Mean latency of a sample evaluated by a batch test() of the CompiledNetwork of the network, in nanoseconds.
+	 */
+	double latency_ns;
+	/**
+	 * Number of epochs retrained after pruning, 0 for the unpruned network.
+	 */
+	size_t nepoch;
+};
+
 class NeuronNetwork
 {
 	class NNSettings // TODO doc
@@ -37,13 +138,87 @@ class NeuronNetwork
 		NNSettings();
 		void restart_training_if_stuck(bool do_restart, double restart_threshold_ = 0.1, size_t max_nrestart = 10);
 		void set_max_num_of_epochs(size_t max_nepoch_);
+		/**
+		 * Writes the whole training state to the given file every interval_nepoch epochs, so the training can be continued by NeuronNetwork::resume_training.
+		 * The file is written on a background thread and replaced atomically. Set interval_nepoch to 0 to turn checkpoints off.
+		 * @param filename
+		 * @param interval_nepoch
+		 */
+		void save_checkpoints(const string& filename, size_t interval_nepoch = 100);
+		/**
+		 * Stops a training session if the test error has not improved for patience_nepoch epochs. Whenever a session stops, the weights after the last
+		 * epoch are tested too, and the weights with the lowest test error are kept, so stopping early loses nothing. The Rprop state is not rolled back
+		 * with the weights. Set patience_nepoch to 0 to only stop on consecutive test error increases.
+		 * @param patience_nepoch
+		 */
+		void set_early_stopping(size_t patience_nepoch);
+		/**
+		 * Stops a training session when the test error (the train error if there are no test samples) reaches target_err_. Set it to 0 (default) to train until another criterion is met.
+		 * @param target_err_
+		 */
+		void set_target_error(double target_err_);
+		/**
+		 * Sets the number of threads used to run restarted training sessions (see restart_training_if_stuck) and cross-validation folds in parallel, each on its own clone of the network.
+		 * The first session reaching the restart threshold or the target error cancels the others, otherwise the session with the lowest train error is kept. 0 means one thread per core.
+		 * Checkpoints are only written by sequential trainings (1 thread, the default).
+		 * @param nthreads_
+		 */
+		void set_num_of_threads(size_t nthreads_);
+		/**
+		 * Seeds the random generator of trainings, used for weight initialization, shuffling and the random streams of parallel sessions, so trainings
+		 * are reproducible. 0 (default) means a new seed from std::random_device for every training. See RandomGenerator::seed_shared for the weights of new neurons.
+		 * @param seed_
+		 */
+		void set_seed(uint64_t seed_);
+		/**
+		 * Records the errors and the time spent in each phase of every epoch to the given profiler, also for sessions running on clones of the network.
+		 * The profiler is not owned and has to outlive the trainings. Set it to nullptr (default) to turn profiling off.
+		 * @param profiler_
+		 */
+		void set_profiler(TrainingProfiler* profiler_);
+		/**
+		 * Calls the hooks of the given observer with the metrics of every batch, epoch and session, also for sessions running on clones of the network.
+		 * The hooks can stop the training, change the learning rate or request checkpoints. The observer is not owned and has to outlive the trainings.
+		 * Set it to nullptr (default) to turn it off.
+		 * @param observer_
+		 */
+		void set_observer(TrainingObserver* observer_);
+		/**
+		 * Gathers the train samples of every epoch into contiguous batches on a background thread, into a ring of nbuffers buffers of batch_size samples,
+		 * while the training consumes the previous batches. The producer waits if all buffers are full (back-pressure). The stalls of both sides are
+		 * recorded by the profiler (see EpochProfile::ninput_stalls). Set nbuffers to 0 (default) to read the samples directly.
+		 * @param nbuffers 0, or at least 2
+		 * @param batch_size
+		 */
+		void set_input_pipeline(size_t nbuffers, size_t batch_size = def_input_batch_size);
+		/**
+		 * Starts the first training session, and every cross-validation fold, from the current weights of the network instead of random ones,
+		 * to fine-tune a trained network (e.g. after NeuronNetwork::prune). Restarted sessions are randomized. Off by default.
+		 * @param warm_start_
+		 */
+		void set_warm_start(bool warm_start_);
+
+		/**
+		 * Default number of samples per batch of the input pipeline.
+		 */
+		static const size_t def_input_batch_size = 64;
 
 	private:
-		NNSettings& operator=(const NNSettings& _) {}
+		NNSettings& operator=(const NNSettings& other);
 		bool restart_if_high_error;
 		double restart_threshold;
 		size_t max_nrestart;
 		size_t max_nepoch;
+		string checkpoint_filename;
+		size_t checkpoint_interval;
+		size_t early_stopping_patience;
+		double target_err;
+		size_t nthreads;
+		uint64_t seed;
+		TrainingProfiler* profiler;
+		TrainingObserver* observer;
+		size_t input_nbuffers, input_batch_size;
+		bool warm_start;
 		// TODO
 	};
 
@@ -102,6 +277,17 @@ public:
 		for (auto& neur : layer)
 			add_neuron(neur);
 	}
+
+	/**
+     * Adds all the elements of the NeuronPtr vector to the monitored neurons.
+     * @param layer
+     */
+	template <typename NeuronPtrType>
+    void add_layer(const vector<NeuronPtrType>& layer)
+	{
+		for (auto& neur : layer)
+			add_neuron(neur);
+	}
     
     /**
      * Force the interconnected neurons to learn in a supervised way by the given input and desired output. Use this overload if the input is already separated from the output.
@@ -109,16 +295,52 @@ public:
      * @param desired_output
      * @param log_stream
      * @param train_ratio
+     * @return errors, epochs, sessions and time of the training
      */
-    void train(vector<vector<double>> input, vector<vector<double>> desired_output, ostream& log_stream, double train_ratio, bool batch_mode = false);
+    TrainingResult train(vector<vector<double>> input, vector<vector<double>> desired_output, ostream& log_stream, double train_ratio, bool batch_mode = false);
     
     /**
      * Force the interconnected neurons to learn in a supervised way by the given input and desired output. Use this overload if both the input and desired output values are contained in a stream (file, console, etc.). 
      * @param train_stream
      * @param log_stream
      * @param train_ratio
+     * @return errors, epochs, sessions and time of the training
      */
-    void train(istream& train_stream, ostream& log_stream, double train_ratio, bool batch_mode = false);
+    TrainingResult train(istream& train_stream, ostream& log_stream, double train_ratio, bool batch_mode = false);
+
+	/**
+	 * Estimates the error of the network by k-fold cross-validation. The samples are shuffled and split into k folds; each fold is the test set of one training session,
+	 * the rest of the samples are its training samples. Folds are index views into the given data, the data is not copied. Sessions run on clones of the network,
+	 * settings.set_num_of_threads() of them at once. Restarts are not used, every fold is trained in a single session. The network itself is not modified.
+	 * @param k number of folds, at least 2
+	 * @param input
+	 * @param desired_output
+	 * @param log_stream
+	 * @param batch_mode
+	 * @param keep_best_model keeps the trained clone of the fold with the lowest test error in the result
+	 */
+	CrossValidationResult cross_validate(size_t k, const vector<vector<double>>& input, const vector<vector<double>>& desired_output, ostream& log_stream,
+		bool batch_mode = false, bool keep_best_model = false) const;
+
+	/**
+	 * Continues a training from a checkpoint file written during train(). The same training data has to be given as for the interrupted training,
+	 * and the network has to have the same neurons and backpropagation settings. The training continues exactly as the interrupted one would have.
+	 * @param checkpoint_filename
+	 * @param input
+	 * @param desired_output
+	 * @param log_stream
+	 * @return errors, epochs, sessions and time of the resumed part of the training
+	 */
+	TrainingResult resume_training(const string& checkpoint_filename, vector<vector<double>> input, vector<vector<double>> desired_output, ostream& log_stream);
+
+	/**
+	 * Continues a training from a checkpoint file written during train(). Reads the same training data from the stream as train() does.
+	 * @param checkpoint_filename
+	 * @param train_stream
+	 * @param log_stream
+	 * @return errors, epochs, sessions and time of the resumed part of the training
+	 */
+	TrainingResult resume_training(const string& checkpoint_filename, istream& train_stream, ostream& log_stream);
     
     /**
      * Activates the input neurons of the network with the given input and reads the output of the output neurons. Use this overload if the input is already put in a vector and the output is expected in a vector. The output vector is filled with as many elements as the number of output neurons in the network.
@@ -149,7 +371,33 @@ public:
     void test(istream& input_stream, ostream& output_stream, string delimiter = " ");
 
 	/**
-	 * Randomize a new value for all weights (including the bias) in the range of [Neuron::def_lower_bound, Neuron::def_upper_bound) for the whole network. Also clears Neuron::inputs and Neuron::errors.
+	 * Activates the input neurons of the network with the given sparse input and reads the output of the output neurons. Only the listed inputs are propagated
+	 * to the neurons having InputNeurons as their only inputs, so their cost is proportional to the number of nonzero inputs. Each input index may be listed once.
+	 * The output vector is filled with as many elements as the number of output neurons in the network.
+	 * @param input
+	 * @param output
+	 */
+	void test(const SparseSample& input, vector<double>& output);
+
+	/**
+	 * Activates the input neurons of the network with each of the given inputs in turn and reads the outputs of the output neurons. The outputs are resized to the
+	 * number of inputs, each filled with as many elements as the number of output neurons in the network. Recorded as a single call of a batch by the inference statistics.
+	 * @param input
+	 * @param output
+	 */
+	void test(const vector<vector<double>>& input, vector<vector<double>>& output);
+
+	/**
+	 * Records the latency and batch size of every test() call to the given statistics. Clones of the network do not record to them.
+	 * The statistics are not owned and have to outlive the calls. Set them to nullptr (default) to turn collecting off.
+	 * Nothing is recorded if NNLIGHT_NO_PROFILING is defined.
+	 * @param stats_
+	 */
+	void collect_inference_stats(InferenceStats* stats_);
+
+	/**
+	 * Randomize a new value for all weights (including the bias) in the range of [Neuron::def_lower_bound, Neuron::def_upper_bound) for the whole network. Also clears the propagated input values and errors of the neurons.
+	 * The weights only depend on the seed if one is set by NNSettings::set_seed.
 	 */
 	void reset_neurons();
 
@@ -172,6 +420,113 @@ public:
 	void use_resilient_backpropagation(double delta0 = Neuron::Rprop::def_delta0, double deltamax = Neuron::Rprop::def_deltamax,
 		double incr_factor = Neuron::Rprop::def_incr_factor, double decr_factor = Neuron::Rprop::def_decr_factor);
 
+	/**
+	 * Trains the network by L-BFGS, a quasi-Newton method: every epoch is one iteration on all the train samples, along the direction given by
+	 * the gradient and an approximation of the inverse Hessian from the latest iterations. Batch mode, learning rates and regularization are not used.
+	 * Turned off by use_default_backpropation() and use_resilient_backpropagation().
+	 * @param history number of iterations kept for approximating the inverse Hessian
+	 * @param precision precision of the forward and backward passes, the weights and the state of L-BFGS are kept in double (mixed precision)
+	 */
+	void use_lbfgs(size_t history = LbfgsTrainer::def_history, FullBatchTrainer::Precision precision = FullBatchTrainer::DOUBLE_PRECISION);
+
+	/**
+	 * Trains the network by Levenberg-Marquardt: every epoch is one damped Gauss-Newton iteration on all the train samples. Converges in few epochs
+	 * on small networks, but the memory and time of an epoch grow with the square of the number of weights. Batch mode, learning rates and
+	 * regularization are not used, softmax outputs are not supported. Turned off by use_default_backpropation() and use_resilient_backpropagation().
+	 * @param damping initial damping, relative to the diagonal of the normal equations
+	 * @param precision precision of the forward and backward passes, the weights and the normal equations are kept in double (mixed precision)
+	 */
+	void use_levenberg_marquardt(double damping = LevenbergMarquardtTrainer::def_damping,
+		FullBatchTrainer::Precision precision = FullBatchTrainer::DOUBLE_PRECISION);
+
+	/**
+	 * Turns the output neurons into a softmax layer trained on cross-entropy: the outputs are the exponentials of the weighted input sums of the output neurons
+	 * normalized to sum to 1, and the train and test errors are the cross-entropy of the outputs and the desired outputs instead of the mean squared error.
+	 * Desired outputs are expected to be one-hot vectors (or class probabilities). Call only after the output neurons are added to the network.
+	 * @param softmax false turns back to independent sigmoid outputs trained on squared error
+	 */
+	void use_softmax_output(bool softmax = true);
+
+	/**
+	 * Creates a deep copy of the network: new neurons with the same connections, weights and learning parameters, and the same settings.
+	 * The copy can be trained independently of the original network.
+	 */
+	shared_ptr<NeuronNetwork> clone() const;
+
+	/**
+	 * Returns the number of weights in the network, including the bias weights.
+	 */
+	size_t num_of_weights() const;
+
+	/**
+	 * Returns the number of connections between the neurons of the network, that is the number of weights without the bias weights.
+	 */
+	size_t num_of_connections() const;
+
+	/**
+	 * Removes the given ratio of the connections of the network, the ones of the smallest absolute weights over the whole network (magnitude pruning),
+	 * then removes the hidden neurons left without output connections. Every neuron keeps its largest input weight, so it is still activated.
+	 * Convolution and pooling neurons (see make_conv1d_layer) are not pruned, neither are the connections from them.
+	 * The remaining weights are not changed; retrain the network with NNSettings::set_warm_start to recover the accuracy (see prune_iteratively).
+	 * Removed neurons are disconnected from the network, but stay alive while they are referenced. Compile or save the pruned network to get a model
+	 * evaluating the remaining connections only.
+	 * @param ratio ratio of the current connections to remove, in [0, 1]
+	 * @return number of connections removed
+	 */
+	size_t prune(double ratio);
+
+	/**
+	 * Prunes the network to the target sparsity in nsteps steps, retraining it by train() from its pruned weights after each step, with warm start
+	 * and without restarts, other settings as set. The number of connections shrinks by the same factor every step. Reports the unpruned network
+	 * and every sparsity level, also to the log stream.
+	 * @param target_sparsity ratio of the connections to remove in the end, relative to the connections before pruning, in [0, 1)
+	 * @param nsteps number of pruning and retraining steps
+	 * @param input
+	 * @param desired_output
+	 * @param log_stream
+	 * @param train_ratio
+	 * @param batch_mode
+	 */
+	vector<PruningStep> prune_iteratively(double target_sparsity, size_t nsteps, const vector<vector<double>>& input, const vector<vector<double>>& desired_output,
+		ostream& log_stream, double train_ratio, bool batch_mode = false);
+
+	/**
+	 * Copies all weights of the network to the given buffer of num_of_weights() elements. Neurons follow each other in the order they were added, each with its bias weight first, then its input weights in connection order.
+	 * @param weights
+	 */
+	void get_weights(double* weights) const;
+
+	/**
+	 * Overwrites all weights of the network from a buffer of num_of_weights() elements, in the order used by get_weights().
+	 * @param weights
+	 */
+	void set_weights(const double* weights);
+
+	/**
+	 * Writes the topology, activation types and weights of the network to a binary model file. See CompiledNetwork for the format.
+	 * @param filename
+	 */
+	void save(const string& filename) const;
+
+	/**
+	 * Writes the network as a self-contained C++ header with the weights compiled in, to be evaluated without NNlight. See CompiledNetwork::export_header.
+	 * @param filename
+	 * @param name namespace of the generated code, a C++ identifier
+	 */
+	void export_header(const string& filename, const string& name) const;
+
+	/**
+	 * Replaces all neurons of the network with the ones described by a binary model file written by save(), so training can be continued.
+	 * Learning parameters are not stored in the file, set them again after loading. Use CompiledNetwork directly if only inference is needed.
+	 * The neurons of a convolution layer are loaded as independent neurons, their weights are no longer shared.
+	 * @param filename
+	 */
+	void load(const string& filename);
+
+	friend class CompiledNetwork;
+	friend class HyperparameterSearch;
+	friend class FullBatchTrainer;
+
 private: 
     /**
      * Default value of the ratio of training samples to all the samples. 1-<this> means the test ratio.
@@ -186,26 +541,185 @@ private:
 	 */
 	static double err_eps;
 	/**
-	 * After test_err_increase_threshold number of test error increase iteration by iteration, the network is restored to the state when it started increasing.
+	 * After test_err_increase_threshold number of test error increase iteration by iteration, the training session stops and the weights with the lowest test error are restored.
 	 */
 	static size_t test_err_increase_threshold;
+	/**
+	 * Samples with at most this ratio of nonzero inputs are fed sparsely, denser samples are cheaper to read by the neurons from every input.
+	 */
+	static double sparse_input_ratio;
+
+	/**
+	 * Reads inputs and desired outputs from a stream until its end. Each sample is made of as many inputs as the number of input neurons, followed by as many desired outputs as the number of output neurons.
+	 * @param train_stream
+	 * @param input
+	 * @param desired_output
+	 * @param log_stream
+	 */
+	void read_samples(istream& train_stream, vector<vector<double>>& input, vector<vector<double>>& desired_output, ostream& log_stream);
+
+	/**
+	 * Runs training sessions (restarts) and their epochs from the given state until a stopping criterion is met.
+	 * @param state
+	 * @param input
+	 * @param desired_output
+	 * @param log_stream
+	 * @param resumed true if the state is in the middle of a session, loaded from a checkpoint
+	 * @return errors, epochs, sessions and time of the training
+	 */
+	TrainingResult run_training(TrainingState& state, const vector<vector<double>>& input, const vector<vector<double>>& desired_output, ostream& log_stream, bool resumed);
+
+	/**
+	 * Runs the training sessions on clones of the network, on several threads. Sessions are started until one of them reaches the
+	 * restart threshold, which cancels the others, or until max_nrestart sessions are run. The weights of the session with the lowest
+	 * train error are installed in the network. An exception thrown by a session cancels the others, and is rethrown.
+	 * @param state
+	 * @param input
+	 * @param desired_output
+	 * @param log_stream
+	 */
+	void run_parallel_restarts(TrainingState& state, const vector<vector<double>>& input, const vector<vector<double>>& desired_output, ostream& log_stream);
+
+	/**
+	 * Runs a single training session: shuffles and splits the samples, resets the weights, then runs epochs until a stopping criterion is met.
+	 * Continues the session of the state instead, if resumed is set.
+	 * @param state
+	 * @param input
+	 * @param desired_output
+	 * @param log_stream
+	 * @param resumed true if the state is in the middle of a session, loaded from a checkpoint
+	 * @param checkpoints writes checkpoints if given
+	 * @param cancel stops the session if given and set
+	 * @return false if an observer stopped the training (see TrainingControl::stop_training)
+	 */
+	bool run_session(TrainingState& state, const vector<vector<double>>& input, const vector<vector<double>>& desired_output, ostream& log_stream, bool resumed,
+		CheckpointWriter* checkpoints, const std::atomic<bool>* cancel);
+
+	/**
+	 * Creates a random generator seeded by NNSettings::set_seed, or by std::random_device if no seed is set.
+	 */
+	RandomGenerator make_random() const;
+
+	/**
+	 * Feeds a sample to the input neurons and propagates it through the network. If the sample is sparse enough (see sparse_input_ratio), zero inputs are not propagated
+	 * to the neurons having InputNeurons as their only inputs.
+	 * @param sample as many values as the number of input neurons
+	 */
+	void feed(const double* sample);
+
+	/**
+	 * Feeds a sparse sample to the input neurons and propagates it through the network.
+	 * @param sample
+	 */
+	void feed(const SparseSample& sample);
+
+	/**
+	 * Collects the output neurons of the input neurons into first_layer, if the connections of the neurons changed since it was last collected.
+	 */
+	void update_first_layer();
+
+	/**
+	 * Rebuilds the output connections of the neurons from the input connections of the neurons of the network, after connections were removed.
+	 */
+	void relink_outputs();
+
+	/**
+	 * Measures the network for prune_iteratively: its size, its error and accuracy on all the samples, and the latency of its compiled model.
+	 * @param input
+	 * @param desired_output
+	 */
+	PruningStep measure_pruning_step(const vector<vector<double>>& input, const vector<vector<double>>& desired_output);
+
+	/**
+	 * Normalizes the weighted input sums of the output neurons by softmax, keeping the log of the outputs in output_log_probs. Called at the end of every
+	 * forward propagation if softmax_output is set. The largest sum is subtracted before exponentiating (log-sum-exp), so large sums do not overflow.
+	 */
+	void apply_softmax();
+
+	/**
+	 * Error of the output activations for the desired output of a sample: the mean squared error, or the cross-entropy if the outputs are normalized by softmax.
+	 * @param desired_output
+	 */
+	double sample_error(const double* desired_output) const;
+
+	/**
+	 * Tells if the output activations pick the same class as the desired output: the largest output, or the output above 0.5 if there is a single output neuron.
+	 * @param desired_output
+	 */
+	bool classified_correctly(const double* desired_output) const;
+
+	/**
+	 * Prepares the state and the network for a new training session: resets the error values and randomizes the weights.
+	 * @param state
+	 * @param shuffle_samples shuffles all samples, so the session gets a new train/test split
+	 * @param keep_weights starts from the current weights instead of random ones (see NNSettings::set_warm_start)
+	 */
+	void start_session(TrainingState& state, bool shuffle_samples, bool keep_weights);
+
+	/**
+	 * Tells if the session of the state reached the target error (see NNSettings::set_target_error): the test error, or the train error if there are no test samples.
+	 * @param state
+	 */
+	bool reached_target_error(const TrainingState& state) const;
+
+	/**
+	 * Tells if the session of the state has to be followed by a new session (see NNSettings::restart_training_if_stuck).
+	 * @param state
+	 */
+	bool needs_restart(const TrainingState& state) const;
+
+	/**
+	 * Calls the on_restart hook of the observer, if there is one, with the final errors of the session of the state.
+	 * @param session index of the session
+	 * @param state
+	 * @param restarting true if another session follows
+	 * @return true if the observer stopped the training
+	 */
+	bool notify_restart(size_t session, const TrainingState& state, bool restarting);
+
+	/**
+	 * Takes a snapshot of the training state and the weights, and hands it to the background checkpoint writer.
+	 * @param checkpoints
+	 * @param state
+	 * @param log_stream
+	 */
+	void write_checkpoint(CheckpointWriter& checkpoints, const TrainingState& state, ostream& log_stream);
     /**
-     * All neurons in network.
+     * All neurons in network, in the order they were added.
      */
-    set<NeuronPtr> neurons;
+    vector<NeuronPtr> neurons;
     /**
-     * Output neurons in network.
+     * All neurons in network, to check for duplicates.
      */
-    set<OutputNeuronPtr> outputs;
+    set<NeuronPtr> neuron_set;
     /**
-     * Input neurons in network.
+     * Output neurons in network, in the order they were added. Determines the order of the output values.
      */
-    set<InputNeuronPtr> inputs;
+    vector<OutputNeuronPtr> outputs;
+    /**
+     * Input neurons in network, in the order they were added. Determines the order of the input values.
+     */
+    vector<InputNeuronPtr> inputs;
+	/**
+	 * Output neurons of the input neurons, each once, and the generation of the connections they were collected from (see Neuron::topology_generation).
+	 */
+	vector<Neuron*> first_layer;
+	uint64_t first_layer_generation;
+	/**
+	 * Statistics of the test() calls, not owned. Null if not collected.
+	 */
+	InferenceStats* inference_stats;
+	/**
+	 * Set if the outputs are normalized by softmax (see use_softmax_output), and the log of the outputs of the latest forward propagation then.
+	 */
+	bool softmax_output;
+	vector<double> output_log_probs;
+	/**
+	 * Trainer of the whole train set per epoch (see use_lbfgs and use_levenberg_marquardt). Null if the neurons learn by backpropagation.
+	 */
+	shared_ptr<FullBatchTrainer> full_batch_trainer;
 };
 
-template <typename order_iterator, typename value_iterator>
-void reorder(order_iterator order_begin, order_iterator order_end, value_iterator v);
-
 }
 
 #endif //_NEURONNETWORK_H
\ No newline at end of file
@@ -38,19 +38,16 @@ double OutputNeuron::get_activation()
  */
 void OutputNeuron::backpropagate(NeuronPtr from, double delta)
 {
-	// adjust bias & input weights
-	if (use_rprop) biasweight += rprop(delta);
-	else biasweight -= learning_rate * delta;
-	for (auto& in : input_weights)
-	{
-		auto grad = in.first->activation * delta * activation * (1.0 - activation) - regularization * in.second;
-		if (use_rprop) in.second += rprop(in.first, grad);
-		else in.second -= learning_rate * grad;
-	}
-
-	// bacpropage error further
-	for (auto& in : input_weights)
-		in.first->backpropagate(shared_from_this(), delta * in.second); // multiplied by input weight
+	learn(delta);
+}
+
+/**
+ * Creates an unconnected copy of the neuron with the same weights and learning parameters.
+ * @return NeuronPtr
+ */
+NeuronPtr OutputNeuron::clone() const
+{
+	return clone_as<OutputNeuron>();
 }
 
 }
\ No newline at end of file
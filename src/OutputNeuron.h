@@ -30,6 +30,11 @@ public:
      * @param delta
      */
     void backpropagate(NeuronPtr from, double delta);
+
+	/**
+	 * Creates an unconnected copy of the neuron with the same weights and learning parameters.
+	 */
+	NeuronPtr clone() const;
 };
 
 typedef shared_ptr<OutputNeuron> OutputNeuronPtr;
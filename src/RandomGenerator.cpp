@@ -0,0 +1,236 @@
+/**
+ * Project NNlight
+ */
+
+#include "RandomGenerator.h"
+#include <atomic>
+#include <random>
+#include <stdexcept>
+
+/**
+ * RandomGenerator implementation
+ *
+ * xoshiro256** by David Blackman and Sebastiano Vigna (http://prng.di.unimi.it/), seeded by splitmix64.
+ * The shared stream is splitmix64 over an atomic counter, so every thread can draw from it without locking.
+ */
+
+namespace NNlight {
+
+const size_t RandomGenerator::state_size;
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * Scrambles a counter value to 64 random bits (splitmix64 output function).
+ * @param z
+ */
+static inline uint64_t splitmix64(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static const uint64_t golden_gamma = 0x9E3779B97F4A7C15ULL;
+
+/**
+ * Converts 64 random bits to [0, 1) using the upper 53 bits.
+ * @param x
+ */
+static inline double to_unit(uint64_t x)
+{
+	return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t random_device_seed()
+{
+	std::random_device rand_dev;
+	return (static_cast<uint64_t>(rand_dev()) << 32) ^ rand_dev();
+}
+
+static std::atomic<uint64_t> shared_counter(random_device_seed());
+
+/**
+ * Seeds the generator by expanding the given value with splitmix64.
+ * @param seed_
+ */
+RandomGenerator::RandomGenerator(uint64_t seed_)
+{
+	seed(seed_);
+}
+
+/**
+ * Restarts the generator from the given seed.
+ * @param seed_
+ */
+void RandomGenerator::seed(uint64_t seed_)
+{
+	for (size_t i = 0; i < state_size; ++i)
+		s[i] = splitmix64(seed_ += golden_gamma);
+}
+
+/**
+ * Returns the next 64 random bits.
+ */
+uint64_t RandomGenerator::operator()()
+{
+	const uint64_t result = rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+/**
+ * Returns a uniformly distributed value in [lower, upper).
+ * @param lower
+ * @param upper
+ */
+double RandomGenerator::uniform(double lower, double upper)
+{
+	return lower + (upper - lower) * to_unit((*this)());
+}
+
+/**
+ * Returns a uniformly distributed integer in [0, n), n has to be positive.
+ * @param n
+ */
+uint64_t RandomGenerator::below(uint64_t n)
+{
+	// reject the lowest (2^64 mod n) values, so every remainder is equally likely
+	const uint64_t threshold = (0 - n) % n;
+	uint64_t x;
+	do
+		x = (*this)();
+	while (x < threshold);
+	return x % n;
+}
+
+/**
+ * Fills the buffer with uniformly distributed values in [lower, upper). Large buffers are filled by several interleaved generators,
+ * which the compiler can vectorize.
+ * @param values
+ * @param n
+ * @param lower
+ * @param upper
+ */
+void RandomGenerator::fill_uniform(double* values, size_t n, double lower, double upper)
+{
+	const size_t nlanes = 4;
+	const size_t min_vector_size = 64;
+	size_t i = 0;
+	if (n >= min_vector_size)
+	{
+		// lane generators seeded from this one, each state word is stored next to the same word of the other lanes
+		uint64_t lanes[state_size][nlanes];
+		for (size_t l = 0; l < nlanes; ++l)
+		{
+			uint64_t lane_seed = (*this)();
+			for (size_t w = 0; w < state_size; ++w)
+				lanes[w][l] = splitmix64(lane_seed += golden_gamma);
+		}
+		const double scale = (upper - lower) * (1.0 / 9007199254740992.0);
+		for (; i + nlanes <= n; i += nlanes)
+			for (size_t l = 0; l < nlanes; ++l)
+			{
+				const uint64_t result = rotl(lanes[1][l] * 5, 7) * 9;
+				const uint64_t t = lanes[1][l] << 17;
+				lanes[2][l] ^= lanes[0][l];
+				lanes[3][l] ^= lanes[1][l];
+				lanes[1][l] ^= lanes[2][l];
+				lanes[0][l] ^= lanes[3][l];
+				lanes[2][l] ^= t;
+				lanes[3][l] = rotl(lanes[3][l], 45);
+				values[i + l] = lower + (result >> 11) * scale;
+			}
+	}
+	for (; i < n; ++i)
+		values[i] = uniform(lower, upper);
+}
+
+/**
+ * Returns a generator continuing from the current state, and moves this generator 2^128 steps ahead.
+ * The two streams do not overlap, so they can be used by independent workers.
+ */
+RandomGenerator RandomGenerator::split()
+{
+	RandomGenerator child(*this);
+	jump();
+	return child;
+}
+
+/**
+ * Moves the generator 2^128 steps ahead.
+ */
+void RandomGenerator::jump()
+{
+	static const uint64_t jump_poly[state_size] = { 0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL, 0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL };
+
+	uint64_t jumped[state_size] = { 0, 0, 0, 0 };
+	for (size_t i = 0; i < state_size; ++i)
+		for (int b = 0; b < 64; ++b)
+		{
+			if (jump_poly[i] & (uint64_t(1) << b))
+				for (size_t w = 0; w < state_size; ++w)
+					jumped[w] ^= s[w];
+			(*this)();
+		}
+	std::copy(jumped, jumped + state_size, s);
+}
+
+/**
+ * Copies state_size words of the state to the given buffer.
+ * @param state
+ */
+void RandomGenerator::get_state(uint64_t* state) const
+{
+	std::copy(s, s + state_size, state);
+}
+
+/**
+ * Restores the state written by get_state().
+ * @param state
+ */
+void RandomGenerator::set_state(const uint64_t* state)
+{
+	if (std::all_of(state, state + state_size, [] (uint64_t w) { return w == 0; }))
+		throw std::runtime_error("Invalid random generator state, all words are zero!");
+	std::copy(state, state + state_size, s);
+}
+
+/**
+ * Returns the next 64 random bits of the stream shared by the whole process. Thread-safe.
+ */
+uint64_t RandomGenerator::shared_next()
+{
+	return splitmix64(shared_counter.fetch_add(golden_gamma) + golden_gamma);
+}
+
+/**
+ * Returns a uniformly distributed value in [lower, upper) from the stream shared by the whole process. Thread-safe, used to initialize weights
+ * when neurons are created and connected. The stream is seeded from std::random_device, unless seed_shared() is called.
+ * @param lower
+ * @param upper
+ */
+double RandomGenerator::shared_uniform(double lower, double upper)
+{
+	return lower + (upper - lower) * to_unit(shared_next());
+}
+
+/**
+ * Seeds the stream shared by the whole process, so the initial weights of the neurons created afterwards are reproducible.
+ * @param seed_
+ */
+void RandomGenerator::seed_shared(uint64_t seed_)
+{
+	shared_counter = seed_;
+}
+
+}
\ No newline at end of file
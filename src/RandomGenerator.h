@@ -0,0 +1,126 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _RANDOMGENERATOR_H
+#define _RANDOMGENERATOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+namespace NNlight {
+
+/**
+ * Fast seedable random generator (xoshiro256**) for weight initialization and shuffling. The results only depend on the seed,
+ * not on the platform or the standard library, so trainings can be reproduced and checkpoints resumed anywhere.
+ */
+class RandomGenerator
+{
+public:
+	/**
+	 * Seeds the generator by expanding the given value with splitmix64.
+	 * @param seed_
+	 */
+	explicit RandomGenerator(uint64_t seed_ = 0);
+
+	/**
+	 * Restarts the generator from the given seed.
+	 * @param seed_
+	 */
+	void seed(uint64_t seed_);
+
+	/**
+	 * Returns the next 64 random bits.
+	 */
+	uint64_t operator()();
+
+	/**
+	 * Returns a uniformly distributed value in [lower, upper).
+	 * @param lower
+	 * @param upper
+	 */
+	double uniform(double lower = 0.0, double upper = 1.0);
+
+	/**
+	 * Returns a uniformly distributed integer in [0, n), n has to be positive.
+	 * @param n
+	 */
+	uint64_t below(uint64_t n);
+
+	/**
+	 * Fills the buffer with uniformly distributed values in [lower, upper). Large buffers are filled by several interleaved generators,
+	 * which the compiler can vectorize.
+	 * @param values
+	 * @param n
+	 * @param lower
+	 * @param upper
+	 */
+	void fill_uniform(double* values, size_t n, double lower, double upper);
+
+	/**
+	 * Shuffles the range uniformly (Fisher-Yates).
+	 * @param first
+	 * @param last
+	 */
+	template <typename RandomIt>
+	void shuffle(RandomIt first, RandomIt last)
+	{
+		for (auto n = last - first; n > 1; --n)
+			std::iter_swap(first + (n - 1), first + static_cast<ptrdiff_t>(below(static_cast<uint64_t>(n))));
+	}
+
+	/**
+	 * Returns a generator continuing from the current state, and moves this generator 2^128 steps ahead.
+	 * The two streams do not overlap, so they can be used by independent workers.
+	 */
+	RandomGenerator split();
+
+	/**
+	 * Moves the generator 2^128 steps ahead.
+	 */
+	void jump();
+
+	/**
+	 * Number of 64-bit words describing the state of the generator.
+	 */
+	static const size_t state_size = 4;
+
+	/**
+	 * Copies state_size words of the state to the given buffer.
+	 * @param state
+	 */
+	void get_state(uint64_t* state) const;
+
+	/**
+	 * Restores the state written by get_state().
+	 * @param state
+	 */
+	void set_state(const uint64_t* state);
+
+	/**
+	 * Returns the next 64 random bits of the stream shared by the whole process. Thread-safe.
+	 */
+	static uint64_t shared_next();
+
+	/**
+	 * Returns a uniformly distributed value in [lower, upper) from the stream shared by the whole process. Thread-safe, used to initialize weights
+	 * when neurons are created and connected. The stream is seeded from std::random_device, unless seed_shared() is called.
+	 * @param lower
+	 * @param upper
+	 */
+	static double shared_uniform(double lower, double upper);
+
+	/**
+	 * Seeds the stream shared by the whole process, so the initial weights of the neurons created afterwards are reproducible.
+	 * @param seed_
+	 */
+	static void seed_shared(uint64_t seed_);
+
+private:
+	uint64_t s[state_size];
+};
+
+}
+
+#endif //_RANDOMGENERATOR_H
\ No newline at end of file
@@ -0,0 +1,81 @@
+/**
+ * Project NNlight
+ */
+
+#include "TrainingObserver.h"
+#include <stdexcept>
+
+/**
+ * TrainingObserver implementation
+ */
+
+namespace NNlight {
+
+TrainingControl::TrainingControl()
+	: session_stop_requested(false), training_stop_requested(false), checkpoint_requested(false), learning_rate(0)
+{
+}
+
+/**
+ * Stops the current session at the end of the epoch. Restarts still follow if the session is stuck.
+ */
+void TrainingControl::stop_session()
+{
+	session_stop_requested = true;
+}
+
+/**
+ * Stops the current session at the end of the epoch, and the training with it: no more sessions are started, and parallel sessions are cancelled.
+ */
+void TrainingControl::stop_training()
+{
+	session_stop_requested = true;
+	training_stop_requested = true;
+}
+
+/**
+ * Sets the learning rate of every neuron using default backpropagation (see NeuronNetwork::use_default_backpropation).
+ * @param learning_rate_
+ */
+void TrainingControl::set_learning_rate(double learning_rate_)
+{
+	if (learning_rate_ <= 0)
+		throw std::runtime_error("Learning rate has to be positive!");
+
+	learning_rate = learning_rate_;
+}
+
+/**
+ * Writes a checkpoint at the end of the epoch, if the training writes checkpoints (see NeuronNetwork::NNSettings::save_checkpoints).
+ */
+void TrainingControl::request_checkpoint()
+{
+	checkpoint_requested = true;
+}
+
+TrainingObserver::~TrainingObserver() {}
+
+/**
+ * Called after every batch is backpropagated: after every sample in online mode, once per epoch in batch mode.
+ * Session stops requested here take effect at the end of the epoch.
+ * @param metrics
+ * @param control
+ */
+void TrainingObserver::on_batch(const BatchMetrics& metrics, TrainingControl& control) {}
+
+/**
+ * Called at the end of every epoch, before the stopping criteria are checked.
+ * @param metrics
+ * @param control
+ */
+void TrainingObserver::on_epoch_end(const EpochMetrics& metrics, TrainingControl& control) {}
+
+/**
+ * Called when a training session ended, before the next session is started if it is restarted (see NeuronNetwork::NNSettings::restart_training_if_stuck).
+ * Stopping the training here cancels the restart. Not called for the sessions of cross-validation and hyperparameter search.
+ * @param metrics
+ * @param control
+ */
+void TrainingObserver::on_restart(const SessionMetrics& metrics, TrainingControl& control) {}
+
+}
\ No newline at end of file
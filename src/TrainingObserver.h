@@ -0,0 +1,149 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _TRAININGOBSERVER_H
+#define _TRAININGOBSERVER_H
+
+#include <cstddef>
+
+namespace NNlight {
+
+/**
+ * Errors of a batch: a single sample in online mode, all train samples of the epoch in batch mode.
+ */
+struct BatchMetrics
+{
+	size_t session, epoch;
+	/**
+	 * Index of the batch in the epoch, and the number of samples in it.
+	 */
+	size_t batch, nsamples;
+	/**
+	 * Error of the samples of the batch, measured before the weights were updated by it: the mean squared error, or the cross-entropy if the outputs
+	 * are normalized by softmax (see NeuronNetwork::use_softmax_output).
+	 */
+	double train_err;
+};
+
+/**
+ * Errors of an epoch, as NeuronNetwork::train uses them to decide on stopping.
+ */
+struct EpochMetrics
+{
+	size_t session;
+	/**
+	 * Number of completed epochs in the session, including this one.
+	 */
+	size_t epoch;
+	/**
+	 * Train error of the epoch, its change since the previous epoch, and the test error measured at its start.
+	 * Test errors are the maximum double value if there are no test samples.
+	 */
+	double train_err, delta_train_err, test_err;
+	/**
+	 * Lowest test error of the session and the epoch it was measured at. The weights of that epoch are restored when the session stops, unless the weights after the last epoch test better.
+	 */
+	double best_test_err;
+	size_t best_epoch;
+	/**
+	 * Ratio of the train samples of the epoch and of the test samples classified correctly: the largest output belongs to the largest desired output,
+	 * or with a single output neuron, both are on the same side of 0.5. The train accuracy is measured as the train error, the test accuracy is 0 if there are no test samples.
+	 */
+	double train_accuracy, test_accuracy;
+};
+
+/**
+ * Final errors of a training session.
+ */
+struct SessionMetrics
+{
+	size_t session;
+	/**
+	 * Number of epochs run in the session.
+	 */
+	size_t nepoch;
+	/**
+	 * Errors of the kept weights of the session.
+	 */
+	double train_err, test_err;
+	/**
+	 * True if another session follows unless the training is stopped: the train error is above the restart threshold (see
+	 * NeuronNetwork::NNSettings::restart_training_if_stuck) and there are sessions left.
+	 */
+	bool restarting;
+};
+
+/**
+ * Lets observer hooks steer the training. Requests take effect right after the hook returns.
+ */
+class TrainingControl
+{
+	friend class NeuronNetwork;
+public:
+	TrainingControl();
+
+	/**
+	 * Stops the current session at the end of the epoch. Restarts still follow if the session is stuck.
+	 */
+	void stop_session();
+
+	/**
+	 * Stops the current session at the end of the epoch, and the training with it: no more sessions are started, and parallel sessions are cancelled.
+	 */
+	void stop_training();
+
+	/**
+	 * Sets the learning rate of every neuron using default backpropagation (see NeuronNetwork::use_default_backpropation).
+	 * @param learning_rate_
+	 */
+	void set_learning_rate(double learning_rate_);
+
+	/**
+	 * Writes a checkpoint at the end of the epoch, if the training writes checkpoints (see NeuronNetwork::NNSettings::save_checkpoints).
+	 */
+	void request_checkpoint();
+
+private:
+	bool session_stop_requested;
+	bool training_stop_requested;
+	bool checkpoint_requested;
+	double learning_rate; // not changed if not positive
+};
+
+/**
+ * Receives the metrics of a training as it runs (see NeuronNetwork::NNSettings::set_observer). Every hook does nothing by default.
+ * Parallel restarts and cross-validation folds call the hooks of the same observer from several threads at once.
+ */
+class TrainingObserver
+{
+public:
+	virtual ~TrainingObserver();
+
+	/**
+	 * Called after every batch is backpropagated: after every sample in online mode, once per epoch in batch mode.
+	 * Session stops requested here take effect at the end of the epoch.
+	 * @param metrics
+	 * @param control
+	 */
+	virtual void on_batch(const BatchMetrics& metrics, TrainingControl& control);
+
+	/**
+	 * Called at the end of every epoch, before the stopping criteria are checked.
+	 * @param metrics
+	 * @param control
+	 */
+	virtual void on_epoch_end(const EpochMetrics& metrics, TrainingControl& control);
+
+	/**
+	 * Called when a training session ended, before the next session is started if it is restarted (see NeuronNetwork::NNSettings::restart_training_if_stuck).
+	 * Stopping the training here cancels the restart. Not called for the sessions of cross-validation and hyperparameter search.
+	 * @param metrics
+	 * @param control
+	 */
+	virtual void on_restart(const SessionMetrics& metrics, TrainingControl& control);
+};
+
+}
+
+#endif //_TRAININGOBSERVER_H
\ No newline at end of file
@@ -0,0 +1,136 @@
+/**
+ * Project NNlight
+ */
+
+#include "TrainingProfiler.h"
+#include <iomanip>
+#include <limits>
+
+/**
+ * TrainingProfiler implementation
+ *
+ * Records are small and produced once per epoch, so a single mutex is enough for the sessions recording concurrently.
+ */
+
+namespace NNlight {
+
+EpochProfile::EpochProfile(size_t session_, size_t epoch_)
+	: session(session_), epoch(epoch_), train_err(std::numeric_limits<double>::max()), test_err(std::numeric_limits<double>::max()),
+	train_accuracy(0), test_accuracy(-1), total_ms(0), ntrain(0), ntest(0), nallocs(0),
+	ninput_stalls(0), nbackpressure_stalls(0)
+{
+	for (auto& ms : phase_ms)
+		ms = 0;
+}
+
+/**
+ * Trained samples per second of the epoch.
+ * @return double
+ */
+double EpochProfile::samples_per_sec() const
+{
+	return total_ms > 0 ? ntrain * 1000.0 / total_ms : 0.0;
+}
+
+TrainingProfiler::TrainingProfiler() {}
+
+/**
+ * Adds the profile of an epoch.
+ * @param profile
+ */
+void TrainingProfiler::record(const EpochProfile& profile)
+{
+	std::lock_guard<std::mutex> lock(records_mutex);
+	records.push_back(profile);
+}
+
+/**
+ * Returns a copy of the profiles recorded so far, in the order they were recorded.
+ * @return vector<EpochProfile>
+ */
+vector<EpochProfile> TrainingProfiler::get_records() const
+{
+	std::lock_guard<std::mutex> lock(records_mutex);
+	return records;
+}
+
+/**
+ * Drops the recorded profiles.
+ */
+void TrainingProfiler::clear()
+{
+	std::lock_guard<std::mutex> lock(records_mutex);
+	records.clear();
+}
+
+/**
+ * Writes one line per epoch after a header line: session, epoch, errors, accuracies, milliseconds per phase, total milliseconds, samples per second, allocations
+ * and input pipeline stalls. A missing test error and accuracy are left empty.
+ * @param out
+ */
+void TrainingProfiler::write_csv(ostream& out) const
+{
+	auto profiles = get_records();
+	out << "session,epoch,train_err,test_err,train_accuracy,test_accuracy";
+	for (size_t p = 0; p < NUM_OF_PHASES; ++p)
+		out << "," << phase_name(static_cast<TrainingPhase>(p)) << "_ms";
+	out << ",total_ms,samples_per_sec,allocations,input_stalls,backpressure_stalls" << std::endl;
+
+	out << std::setprecision(8);
+	for (auto& profile : profiles)
+	{
+		out << profile.session << "," << profile.epoch << "," << profile.train_err << ",";
+		if (profile.test_err < std::numeric_limits<double>::max())
+			out << profile.test_err;
+		out << "," << profile.train_accuracy << ",";
+		if (profile.test_accuracy >= 0)
+			out << profile.test_accuracy;
+		for (auto ms : profile.phase_ms)
+			out << "," << ms;
+		out << "," << profile.total_ms << "," << profile.samples_per_sec() << "," << profile.nallocs
+			<< "," << profile.ninput_stalls << "," << profile.nbackpressure_stalls << std::endl;
+	}
+}
+
+/**
+ * Writes the same fields as write_csv, as a JSON object with an array of epochs, one epoch per line. A missing test error and accuracy are null.
+ * @param out
+ */
+void TrainingProfiler::write_json(ostream& out) const
+{
+	auto profiles = get_records();
+	out << "{" << std::endl << "  \"epochs\": [" << std::endl;
+	out << std::setprecision(8);
+	for (size_t i = 0; i < profiles.size(); ++i)
+	{
+		const auto& profile = profiles[i];
+		out << "    {\"session\": " << profile.session << ", \"epoch\": " << profile.epoch << ", \"train_err\": " << profile.train_err << ", \"test_err\": ";
+		if (profile.test_err < std::numeric_limits<double>::max())
+			out << profile.test_err;
+		else
+			out << "null";
+		out << ", \"train_accuracy\": " << profile.train_accuracy << ", \"test_accuracy\": ";
+		if (profile.test_accuracy >= 0)
+			out << profile.test_accuracy;
+		else
+			out << "null";
+		for (size_t p = 0; p < NUM_OF_PHASES; ++p)
+			out << ", \"" << phase_name(static_cast<TrainingPhase>(p)) << "_ms\": " << profile.phase_ms[p];
+		out << ", \"total_ms\": " << profile.total_ms << ", \"samples_per_sec\": " << profile.samples_per_sec() << ", \"allocations\": " << profile.nallocs
+			<< ", \"input_stalls\": " << profile.ninput_stalls << ", \"backpressure_stalls\": " << profile.nbackpressure_stalls << "}" << (i + 1 < profiles.size() ? "," : "") << std::endl;
+	}
+	out << "  ]" << std::endl << "}" << std::endl;
+}
+
+/**
+ * Name of a phase in the CSV header and JSON keys.
+ * @param phase
+ * @return const char*
+ */
+const char* TrainingProfiler::phase_name(TrainingPhase phase)
+{
+	static const char* names[] = { "shuffle", "input_wait", "test", "forward", "backward", "error", "checkpoint" };
+	return phase < NUM_OF_PHASES ? names[phase] : "unknown";
+}
+
+}
\ No newline at end of file
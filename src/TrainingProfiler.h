@@ -0,0 +1,162 @@
+/**
+ * Project NNlight
+ */
+
+#ifndef _TRAININGPROFILER_H
+#define _TRAININGPROFILER_H
+
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+
+using std::vector;
+using std::ostream;
+
+namespace NNlight {
+
+/**
+ * Phases of a training epoch. Weights are updated by the backpropagation itself, so updates are part of BACKWARD_PHASE;
+ * ERROR_PHASE is the bookkeeping of the train error, INPUT_WAIT_PHASE the waiting for batches of the input pipeline (see NeuronNetwork::NNSettings::set_input_pipeline).
+ */
+enum TrainingPhase { SHUFFLE_PHASE, INPUT_WAIT_PHASE, TEST_PHASE, FORWARD_PHASE, BACKWARD_PHASE, ERROR_PHASE, CHECKPOINT_PHASE, NUM_OF_PHASES };
+
+/**
+ * Measurements of a single epoch of a training session.
+ */
+struct EpochProfile
+{
+	EpochProfile(size_t session_ = 0, size_t epoch_ = 0);
+
+	/**
+	 * Index of the training session (restart, or fold of a cross-validation) and of the epoch in the session.
+	 */
+	size_t session, epoch;
+	/**
+	 * Train error of the epoch, and test error measured at its start. The test error is the maximum double value if there are no test samples.
+	 */
+	double train_err, test_err;
+	/**
+	 * Ratio of the train and test samples classified correctly in the epoch (see EpochMetrics::train_accuracy). The test accuracy is negative if there are no test samples.
+	 */
+	double train_accuracy, test_accuracy;
+	/**
+	 * Milliseconds spent in each phase, and in the whole epoch.
+	 */
+	double phase_ms[NUM_OF_PHASES];
+	double total_ms;
+	/**
+	 * Number of trained and tested samples.
+	 */
+	size_t ntrain, ntest;
+	/**
+	 * Heap allocations made by the training thread in the epoch, including the ones of observer hooks and checkpoint writes.
+	 * Zero unless allocations are counted (see AllocationCounter).
+	 */
+	uint64_t nallocs;
+	/**
+	 * Batches of the input pipeline the training had to wait for (input-bound), and batches the pipeline could not start gathering because
+	 * all of its buffers were in use (back-pressure, compute-bound). Zero without an input pipeline.
+	 */
+	uint64_t ninput_stalls, nbackpressure_stalls;
+
+	/**
+	 * Trained samples per second of the epoch.
+	 */
+	double samples_per_sec() const;
+};
+
+/**
+ * Collects an EpochProfile of every epoch trained by the networks it is given to (see NeuronNetwork::NNSettings::set_profiler), and writes them as CSV or JSON.
+ * Sessions of parallel restarts and cross-validation folds record to the same profiler concurrently.
+ * The phase timers are compiled out if NNLIGHT_NO_PROFILING is defined, then no profiler can be set.
+ */
+class TrainingProfiler
+{
+public:
+	TrainingProfiler();
+
+	/**
+	 * Adds the profile of an epoch.
+	 * @param profile
+	 */
+	void record(const EpochProfile& profile);
+
+	/**
+	 * Returns a copy of the profiles recorded so far, in the order they were recorded.
+	 */
+	vector<EpochProfile> get_records() const;
+
+	/**
+	 * Drops the recorded profiles.
+	 */
+	void clear();
+
+	/**
+	 * Writes one line per epoch after a header line: session, epoch, errors, accuracies, milliseconds per phase, total milliseconds, samples per second, allocations
+	 * and input pipeline stalls. A missing test error and accuracy are left empty.
+	 * @param out
+	 */
+	void write_csv(ostream& out) const;
+
+	/**
+	 * Writes the same fields as write_csv, as a JSON object with an array of epochs, one epoch per line. A missing test error and accuracy are null.
+	 * @param out
+	 */
+	void write_json(ostream& out) const;
+
+	/**
+	 * Name of a phase in the CSV header and JSON keys.
+	 * @param phase
+	 */
+	static const char* phase_name(TrainingPhase phase);
+
+private:
+	TrainingProfiler(const TrainingProfiler&); // not copyable
+	TrainingProfiler& operator=(const TrainingProfiler&);
+
+	mutable std::mutex records_mutex;
+	vector<EpochProfile> records;
+};
+
+/**
+ * Adds the time from its construction to its destruction to a phase of an epoch profile. Does nothing if the profile is null.
+ */
+class PhaseTimer
+{
+public:
+	PhaseTimer(EpochProfile* profile_, TrainingPhase phase_)
+		: profile(profile_), phase(phase_)
+	{
+		if (profile)
+			start = std::chrono::steady_clock::now();
+	}
+
+	~PhaseTimer()
+	{
+		if (profile)
+			profile->phase_ms[phase] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+private:
+	PhaseTimer(const PhaseTimer&); // not copyable
+	PhaseTimer& operator=(const PhaseTimer&);
+
+	EpochProfile* profile;
+	TrainingPhase phase;
+	std::chrono::steady_clock::time_point start;
+};
+
+}
+
+/**
+ * Times the rest of the enclosing scope as the given phase of the profile (EpochProfile*, may be null).
+ */
+#ifndef NNLIGHT_NO_PROFILING
+#define NNLIGHT_PROFILE_PHASE(profile, phase) NNlight::PhaseTimer phase_timer(profile, phase)
+#else
+#define NNLIGHT_PROFILE_PHASE(profile, phase)
+#endif
+
+#endif //_TRAININGPROFILER_H
\ No newline at end of file